@@ -0,0 +1,168 @@
+/*
+ *  iceprog -- simple programming tool for FTDI-based Lattice iCE programmers
+ *
+ *  Permission to use, copy, modify, and/or distribute this software for any
+ *  purpose with or without fee is hereby granted, provided that the above
+ *  copyright notice and this permission notice appear in all copies.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ *  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ *  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ *  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ *  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ *  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "bitstream.h"
+
+/* Device families by CRAM bank size, with the part names that use each
+   die. The parts are matched against the start of the user's name with
+   the "ice40" prefix removed. */
+static const struct {
+	int width, height;
+	const char *family;
+	const char *parts[5];
+} families[] = {
+	{ 182,  80, "LP384",     { "lp384", NULL } },
+	{ 332, 144, "HX1K/LP1K", { "hx1k", "lp1k", "lp640", NULL } },
+	{ 656, 176, "LM4K",      { "lm4k", "lm2k", "lm1k", NULL } },
+	{ 692, 336, "UP5K",      { "up5k", "up3k", NULL } },
+	{ 872, 272, "HX8K/LP8K", { "hx8k", "hx4k", "lp8k", "lp4k", NULL } },
+};
+
+#define N_FAMILIES ((int)(sizeof(families) / sizeof(families[0])))
+
+static void add_comment(struct bitstream_info *info, const char *text, int len)
+{
+	size_t used = strlen(info->comment);
+	if (len == 0)
+		return;
+	if (used > 0 && used + 2 < sizeof(info->comment)) {
+		strcat(info->comment, "; ");
+		used += 2;
+	}
+	if (used + len >= sizeof(info->comment))
+		len = sizeof(info->comment) - used - 1;
+	memcpy(info->comment + used, text, len);
+	info->comment[used + len] = '\0';
+}
+
+bool bitstream_parse(const uint8_t *data, long size, struct bitstream_info *info)
+{
+	memset(info, 0, sizeof(*info));
+	info->preamble = -1;
+
+	long pos = 0;
+
+	/* Comment: 0xFF 0x00, NUL terminated strings, 0x00 0xFF */
+	if (size >= 2 && data[0] == 0xff && data[1] == 0x00) {
+		long start = pos = 2;
+		while (pos + 1 < size && !(data[pos] == 0x00 && data[pos + 1] == 0xff)) {
+			if (data[pos] == 0x00) {
+				add_comment(info, (const char *)data + start, pos - start);
+				start = pos + 1;
+			}
+			pos++;
+		}
+		if (pos + 1 >= size)
+			return false;
+		add_comment(info, (const char *)data + start, pos - start);
+		pos += 2;
+	}
+
+	/* Some tools pad before the sync word, it has to come early though */
+	for (long limit = pos + 256; pos + 4 <= size && pos < limit; pos++)
+		if (data[pos] == 0x7e && data[pos + 1] == 0xaa && data[pos + 2] == 0x99 && data[pos + 3] == 0x7e)
+			break;
+	if (pos + 4 > size || data[pos] != 0x7e)
+		return false;
+	info->preamble = pos;
+	pos += 4;
+
+	/* Commands: opcode in the high nibble, number of big endian
+	   payload bytes in the low nibble */
+	int width = 0, height = 0;
+	while (pos < size) {
+		int opcode = data[pos] >> 4, n = data[pos] & 15;
+		pos++;
+		if (pos + n > size)
+			return false;
+		uint32_t payload = 0;
+		for (int i = 0; i < n; i++)
+			payload = (payload << 8) | data[pos++];
+
+		switch (opcode) {
+		case 0:
+			switch (payload) {
+			case 0x01: /* CRAM data */
+			case 0x03: /* BRAM data */
+				pos += (long)width * height / 8 + 2;
+				if (pos > size)
+					return false;
+				if (payload == 0x01) {
+					if (width > info->width)
+						info->width = width;
+					if (height > info->height)
+						info->height = height;
+				}
+				break;
+			case 0x05: /* reset CRC */
+				break;
+			case 0x06: /* wakeup */
+			case 0x08: /* reboot */
+				info->end = pos;
+				info->reboot = payload == 0x08;
+				for (int i = 0; i < N_FAMILIES; i++)
+					if (families[i].width == info->width && families[i].height == info->height)
+						info->family = families[i].family;
+				return true;
+			default:
+				return false;
+			}
+			break;
+		case 1: /* bank number */
+		case 2: /* CRC check */
+		case 4: /* warm boot address */
+		case 5: /* internal oscillator range */
+		case 8: /* bank offset */
+		case 9: /* feature flags */
+			break;
+		case 6:
+			width = payload + 1;
+			break;
+		case 7:
+			height = payload;
+			break;
+		default:
+			return false;
+		}
+	}
+
+	return false;
+}
+
+int bitstream_part_matches(const char *part, const char *family)
+{
+	char name[32];
+	int len = 0;
+	for (const char *p = part; *p && len + 1 < (int)sizeof(name); p++)
+		name[len++] = tolower((unsigned char)*p);
+	name[len] = '\0';
+
+	const char *base = name;
+	if (!strncmp(base, "ice40", 5))
+		base += 5;
+
+	for (int i = 0; i < N_FAMILIES; i++)
+		for (int j = 0; families[i].parts[j] != NULL; j++)
+			if (!strncmp(base, families[i].parts[j], strlen(families[i].parts[j])))
+				return family != NULL && !strcmp(family, families[i].family);
+	return -1;
+}
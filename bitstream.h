@@ -0,0 +1,43 @@
+/*
+ *  iceprog -- simple programming tool for FTDI-based Lattice iCE programmers
+ *
+ *  Permission to use, copy, modify, and/or distribute this software for any
+ *  purpose with or without fee is hereby granted, provided that the above
+ *  copyright notice and this permission notice appear in all copies.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ *  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ *  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ *  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ *  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ *  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef BITSTREAM_H
+#define BITSTREAM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* What an iCE40 configuration image says about itself */
+struct bitstream_info {
+	char comment[256];	/* comment strings, joined with "; " */
+	long preamble;		/* offset of the 7EAA997E sync word */
+	long end;		/* offset after the wakeup or reboot command */
+	int width, height;	/* largest CRAM bank written */
+	const char *family;	/* NULL if the CRAM size is not known */
+	bool reboot;		/* ends in a warm boot (multi-image header) */
+};
+
+/* Walk the comment, preamble and command stream up to the wakeup or
+ * reboot command. Returns false if data is not an iCE40 bitstream or is
+ * cut short. */
+bool bitstream_parse(const uint8_t *data, long size, struct bitstream_info *info);
+
+/* Whether a part name given by the user, like "up5k", "iCE40HX8K-CT256"
+ * or "lp1k", belongs to the family found by bitstream_parse(). Returns
+ * -1 for part names that are not known. */
+int bitstream_part_matches(const char *part, const char *family);
+
+#endif /* BITSTREAM_H */
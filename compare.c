@@ -0,0 +1,339 @@
+/*
+ *  iceprog -- simple programming tool for FTDI-based Lattice iCE programmers
+ *
+ *  Permission to use, copy, modify, and/or distribute this software for any
+ *  purpose with or without fee is hereby granted, provided that the above
+ *  copyright notice and this permission notice appear in all copies.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ *  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ *  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ *  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ *  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ *  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define COMPARE_SSE2
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define COMPARE_NEON
+#endif
+
+#include "compare.h"
+#include "iceprog_fn.h"
+#include "log.h"
+#include "stats.h"
+
+/* Amount of flash read per SPI transaction, a multiple of every erase
+ * block size */
+#define COMPARE_CHUNK_SIZE (256 * 1024)
+
+struct diff_block {
+	int addr;
+	int size;
+	long mismatches;
+	int first;
+	int last;
+	uint32_t flash_sum;
+	uint32_t file_sum;
+};
+
+// ---------------------------------------------------------
+// Checksum
+// ---------------------------------------------------------
+
+uint32_t compare_checksum(const uint8_t *data, int n)
+{
+	uint32_t a[4] = { 0, 0, 0, 0 }, b[4] = { 0, 0, 0, 0 };
+	int i = 0;
+
+#if defined(COMPARE_SSE2)
+	__m128i va = _mm_setzero_si128(), vb = _mm_setzero_si128();
+	for (; i + 16 <= n; i += 16) {
+		va = _mm_add_epi32(va, _mm_loadu_si128((const __m128i *)(data + i)));
+		vb = _mm_add_epi32(vb, va);
+	}
+	_mm_storeu_si128((__m128i *)a, va);
+	_mm_storeu_si128((__m128i *)b, vb);
+#elif defined(COMPARE_NEON)
+	uint32x4_t va = vdupq_n_u32(0), vb = vdupq_n_u32(0);
+	for (; i + 16 <= n; i += 16) {
+		va = vaddq_u32(va, vreinterpretq_u32_u8(vld1q_u8(data + i)));
+		vb = vaddq_u32(vb, va);
+	}
+	vst1q_u32(a, va);
+	vst1q_u32(b, vb);
+#else
+	for (; i + 16 <= n; i += 16) {
+		for (int j = 0; j < 4; j++) {
+			uint32_t w;
+			memcpy(&w, data + i + 4 * j, 4);
+			a[j] += w;
+			b[j] += a[j];
+		}
+	}
+#endif
+
+	/* Zero padded tail, so all three versions agree */
+	if (i < n) {
+		uint8_t tail[16] = { 0 };
+		memcpy(tail, data + i, n - i);
+		for (int j = 0; j < 4; j++) {
+			uint32_t w;
+			memcpy(&w, tail + 4 * j, 4);
+			a[j] += w;
+			b[j] += a[j];
+		}
+	}
+
+	uint32_t sum = (uint32_t)n;
+	for (int j = 0; j < 4; j++) {
+		sum = (sum ^ a[j]) * 0x01000193;
+		sum = (sum ^ b[j]) * 0x01000193;
+	}
+	return sum;
+}
+
+// ---------------------------------------------------------
+// Flash against file compare
+// ---------------------------------------------------------
+
+long compare_flash(FILE *f, int offset, long size, int map_block, long max_diffs, FILE *out)
+{
+	uint8_t *buffer_flash = malloc(COMPARE_CHUNK_SIZE);
+	uint8_t *buffer_file = malloc(COMPARE_CHUNK_SIZE);
+	if (buffer_flash == NULL || buffer_file == NULL) {
+		fprintf(stderr, "Out of memory.\n");
+		mpsse_error(1);
+	}
+
+	struct diff_block *diffs = NULL;
+	int n_diffs = 0, n_blocks = 0;
+	long total = 0, mismatches = 0;
+	bool stopped = false;
+
+	/* The first chunk ends on a block boundary, so that every block is
+	   compared from a single read */
+	int chunk = COMPARE_CHUNK_SIZE - offset % map_block;
+
+	while (!stopped) {
+		int len = fread(buffer_file, 1, chunk, f);
+		if (len <= 0)
+			break;
+		int addr = offset + total;
+
+		log_progress(addr, size > 0 ? (int)(100LL * total / size) : -1);
+		flash_fast_read(addr, buffer_flash, len);
+		stats_add_bytes(len);
+
+		for (int pos = 0; pos < len && !stopped; ) {
+			int n = map_block - (addr + pos) % map_block;
+			if (n > len - pos)
+				n = len - pos;
+			const uint8_t *fl = buffer_flash + pos, *fi = buffer_file + pos;
+			n_blocks++;
+
+			if (memcmp(fl, fi, n)) {
+				struct diff_block d = {
+					.addr = (addr + pos) & ~(map_block - 1),
+					.size = n,
+					.mismatches = 0,
+					.first = -1,
+					.last = -1,
+					.flash_sum = compare_checksum(fl, n),
+					.file_sum = compare_checksum(fi, n),
+				};
+				for (int i = 0; i < n; i++) {
+					if (fl[i] != fi[i]) {
+						if (d.first < 0)
+							d.first = addr + pos + i;
+						d.last = addr + pos + i;
+						d.mismatches++;
+					}
+				}
+
+				struct diff_block *grown = realloc(diffs, (n_diffs + 1) * sizeof(*diffs));
+				if (grown == NULL) {
+					fprintf(stderr, "Out of memory.\n");
+					mpsse_error(1);
+				}
+				diffs = grown;
+				diffs[n_diffs++] = d;
+
+				mismatches += d.mismatches;
+				if (max_diffs > 0 && mismatches >= max_diffs)
+					stopped = true;
+			}
+			pos += n;
+			total += n;
+		}
+
+		chunk = COMPARE_CHUNK_SIZE;
+	}
+
+	log_progress_done();
+
+	if (n_diffs > 0) {
+		fprintf(out, "difference map (%d kB blocks):\n", map_block >> 10);
+		fprintf(out, "  %-8s  %8s  %-8s  %-8s  %-8s  %s\n",
+				"block", "diffs", "first", "last", "flash", "file");
+		for (int i = 0; i < n_diffs; i++)
+			fprintf(out, "  0x%06X  %8ld  0x%06X  0x%06X  %08X  %08X\n",
+					diffs[i].addr, diffs[i].mismatches, diffs[i].first, diffs[i].last,
+					diffs[i].flash_sum, diffs[i].file_sum);
+		fprintf(out, "%ld of %ld bytes differ, in %d of %d blocks\n",
+				mismatches, total, n_diffs, n_blocks);
+		if (stopped)
+			fprintf(out, "stopped at 0x%06lX after %ld differences\n", offset + total, mismatches);
+	}
+
+	free(diffs);
+	free(buffer_flash);
+	free(buffer_file);
+	return mismatches;
+}
+
+// ---------------------------------------------------------
+// Sampled compare
+// ---------------------------------------------------------
+
+static uint64_t splitmix64(uint64_t x)
+{
+	x += UINT64_C(0x9e3779b97f4a7c15);
+	x = (x ^ (x >> 30)) * UINT64_C(0xbf58476d1ce4e5b9);
+	x = (x ^ (x >> 27)) * UINT64_C(0x94d049bb133111eb);
+	return x ^ (x >> 31);
+}
+
+/* Read the rest of f, which may be a pipe */
+static uint8_t *read_all(FILE *f, long *size)
+{
+	long cap = 0, len = 0;
+	uint8_t *data = NULL;
+
+	while (true) {
+		if (len == cap) {
+			cap = cap ? 2 * cap : 1024 * 1024;
+			uint8_t *grown = realloc(data, cap);
+			if (grown == NULL) {
+				fprintf(stderr, "Out of memory.\n");
+				mpsse_error(1);
+			}
+			data = grown;
+		}
+		size_t rc = fread(data + len, 1, cap - len, f);
+		if (rc == 0)
+			break;
+		len += rc;
+	}
+
+	*size = len;
+	return data;
+}
+
+long compare_sample(FILE *f, int offset, int block_size, double percent, uint64_t seed,
+		const int *forced_blocks, int n_forced, FILE *out)
+{
+	static uint8_t buffer[64 * 1024];
+
+	long size;
+	uint8_t *image = read_all(f, &size);
+	if (size == 0) {
+		free(image);
+		return 0;
+	}
+
+	/* Pages are aligned on the flash, the first and last may be partial */
+	int first_page = offset / 256, last_page = (offset + size - 1) / 256;
+	int n_pages = last_page - first_page + 1;
+	bool *selected = calloc(n_pages, sizeof(bool));
+	if (selected == NULL) {
+		fprintf(stderr, "Out of memory.\n");
+		mpsse_error(1);
+	}
+
+	uint64_t threshold = percent >= 100.0 ? UINT64_MAX : (uint64_t)(percent / 100.0 * 18446744073709551616.0);
+	int pages_per_block = block_size / 256;
+	int n_selected = 0;
+
+	for (int i = 0; i < n_pages; i++) {
+		int page = first_page + i;
+		int block_addr = page / pages_per_block * block_size;
+		bool pick = i == 0 || i == n_pages - 1 ||
+				page % pages_per_block == 0 || page % pages_per_block == pages_per_block - 1 ||
+				splitmix64(seed ^ (uint64_t)page) < threshold;
+		for (int k = 0; k < n_forced && !pick; k++)
+			if (forced_blocks[k] == block_addr)
+				pick = true;
+		selected[i] = pick;
+		n_selected += pick;
+	}
+
+	fprintf(out, "sampling %d of %d pages (%.1f%%), seed 0x%016llX\n", n_selected, n_pages,
+			100.0 * n_selected / n_pages, (unsigned long long)seed);
+
+	long mismatches = 0;
+	int bad_pages = 0;
+
+	for (int i = 0; i < n_pages; ) {
+		if (!selected[i]) {
+			i++;
+			continue;
+		}
+
+		/* One read for a run of selected pages */
+		int run = 1;
+		while (i + run < n_pages && selected[i + run] && run < (int)sizeof(buffer) / 256)
+			run++;
+
+		int begin = (first_page + i) * 256, end = (first_page + i + run) * 256;
+		if (begin < offset)
+			begin = offset;
+		if (end > offset + size)
+			end = offset + size;
+
+		log_progress(begin, (int)(100LL * (begin - offset) / size));
+		flash_fast_read(begin, buffer, end - begin);
+		stats_add_bytes(end - begin);
+
+		const uint8_t *expected = image + (begin - offset);
+		if (memcmp(buffer, expected, end - begin)) {
+			for (int pos = 0; pos < end - begin; ) {
+				int page_end = ((begin + pos) / 256 + 1) * 256 - begin;
+				if (page_end > end - begin)
+					page_end = end - begin;
+				int diffs = 0;
+				for (int k = pos; k < page_end; k++)
+					diffs += buffer[k] != expected[k];
+				if (diffs) {
+					log_progress_done();
+					fprintf(out, "  page 0x%06X: %d bytes differ\n", (begin + pos) & ~255, diffs);
+					mismatches += diffs;
+					bad_pages++;
+				}
+				pos = page_end;
+			}
+		}
+
+		i += run;
+	}
+
+	log_progress_done();
+	if (bad_pages)
+		fprintf(out, "%ld bytes differ in %d of %d sampled pages\n", mismatches, bad_pages, n_selected);
+
+	free(selected);
+	free(image);
+	return mismatches;
+}
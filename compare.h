@@ -0,0 +1,41 @@
+/*
+ *  iceprog -- simple programming tool for FTDI-based Lattice iCE programmers
+ *
+ *  Permission to use, copy, modify, and/or distribute this software for any
+ *  purpose with or without fee is hereby granted, provided that the above
+ *  copyright notice and this permission notice appear in all copies.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ *  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ *  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ *  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ *  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ *  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef COMPARE_H
+#define COMPARE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/* Checksum of 16 byte groups summed in four 32 bit lanes, Fletcher
+ * style. Only meant for telling blocks apart within one run. */
+uint32_t compare_checksum(const uint8_t *data, int n);
+
+/* Compare the flash from offset on with the rest of f. Differences are
+ * counted per map_block bytes of flash and printed as a map to out.
+ * Stops after the block in which max_diffs differing bytes have been
+ * seen, 0 compares everything. size is only used for progress and may
+ * be -1. Returns the number of differing bytes found. */
+long compare_flash(FILE *f, int offset, long size, int map_block, long max_diffs, FILE *out);
+
+/* Compare only a sample of the 256 byte pages of the rest of f: the
+ * first and last page of every block_size bytes of flash, every page of
+ * the forced blocks and a deterministic random percent of the others,
+ * chosen by seed. Returns the number of differing bytes found. */
+long compare_sample(FILE *f, int offset, int block_size, double percent, uint64_t seed,
+		const int *forced_blocks, int n_forced, FILE *out);
+
+#endif /* COMPARE_H */
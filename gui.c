@@ -11,19 +11,139 @@ static bool mpsse_initialized = false;
 static char *selected_file_path = NULL;
 static GtkWidget *lbl_file_path = NULL;
 static GtkWidget *progress_bar = NULL;
+static GtkWidget *btn_test_connection = NULL;
+static GtkWidget *btn_select_file = NULL;
+static GtkWidget *btn_flash_chip = NULL;
+static GtkWidget *btn_cancel = NULL;
+
+// Progress is posted from the worker at most this often
+#define PROGRESS_INTERVAL_US (G_USEC_PER_SEC / 20)
+
+// State shared between the flash worker and the GTK main thread
+struct flash_job {
+    char *path;
+    GThread *thread;
+    gint cancel;            // set by the Cancel button, read with g_atomic_int_get()
+
+    GMutex lock;            // protects everything below
+    double fraction;
+    char text[160];
+    bool idle_pending;      // a progress_idle() is queued already
+    bool finished;
+
+    // worker only
+    guint idle_id;          // the last progress_idle() queued
+    gint64 last_post;
+    gint64 phase_start;
+    long phase_bytes;
+};
+
+static struct flash_job *current_job = NULL;
 
 static void update_progress(double fraction, const char *text) {
     if (progress_bar) {
         gtk_progress_bar_set_fraction(GTK_PROGRESS_BAR(progress_bar), fraction);
         gtk_progress_bar_set_text(GTK_PROGRESS_BAR(progress_bar), text);
-        // Process pending GUI events to update the display
-        while (gtk_events_pending()) {
-            gtk_main_iteration();
-        }
     }
 }
 
+static void set_busy(bool busy) {
+    gtk_widget_set_sensitive(btn_test_connection, !busy);
+    gtk_widget_set_sensitive(btn_select_file, !busy);
+    gtk_widget_set_sensitive(btn_flash_chip, !busy);
+    gtk_widget_set_sensitive(btn_cancel, busy);
+}
+
+// Runs on the main thread, shows the latest state the worker posted
+static gboolean progress_idle(gpointer data) {
+    struct flash_job *job = data;
+    double fraction;
+    char text[sizeof(job->text)];
+    bool finished;
+
+    g_mutex_lock(&job->lock);
+    fraction = job->fraction;
+    memcpy(text, job->text, sizeof(text));
+    finished = job->finished;
+    job->idle_pending = false;
+    g_mutex_unlock(&job->lock);
+
+    update_progress(fraction, text);
+
+    if (finished) {
+        g_thread_join(job->thread);
+        g_mutex_clear(&job->lock);
+        g_free(job->path);
+        g_free(job);
+        current_job = NULL;
+        set_busy(false);
+    }
+    return G_SOURCE_REMOVE;
+}
+
+// Worker side: store the new state and wake up the main thread, unless
+// it was woken up less than PROGRESS_INTERVAL_US ago
+static void post_progress(struct flash_job *job, double fraction, const char *text, bool force) {
+    gint64 now = g_get_monotonic_time();
+    if (!force && now - job->last_post < PROGRESS_INTERVAL_US)
+        return;
+    job->last_post = now;
+
+    g_mutex_lock(&job->lock);
+    job->fraction = fraction;
+    snprintf(job->text, sizeof(job->text), "%s", text);
+    bool queue = !job->idle_pending;
+    job->idle_pending = true;
+    g_mutex_unlock(&job->lock);
+
+    if (queue)
+        job->idle_id = g_idle_add(progress_idle, job);
+}
+
+static void start_phase(struct flash_job *job, double fraction, const char *text) {
+    job->phase_start = g_get_monotonic_time();
+    job->phase_bytes = 0;
+    post_progress(job, fraction, text, true);
+}
+
+// Progress within a phase of total bytes, with throughput and ETA
+static void phase_progress(struct flash_job *job, double begin, double span,
+                           const char *what, int addr, long done, long total) {
+    gint64 now = g_get_monotonic_time();
+    if (now - job->last_post < PROGRESS_INTERVAL_US)
+        return;
+
+    double elapsed = (now - job->phase_start) / (double)G_USEC_PER_SEC;
+    double rate = elapsed > 0 ? done / elapsed : 0;
+    char text[160];
+    if (rate > 0 && done > 0)
+        snprintf(text, sizeof(text), "%s: %ld%% (0x%06X), %.1f kB/s, ETA %.0f s",
+                 what, 100 * done / total, addr, rate / 1024, (total - done) / rate);
+    else
+        snprintf(text, sizeof(text), "%s: %ld%% (0x%06X)", what, 100 * done / total, addr);
+    post_progress(job, begin + span * done / total, text, false);
+}
+
+static bool cancelled(struct flash_job *job) {
+    return g_atomic_int_get(&job->cancel) != 0;
+}
+
 static void cleanup_mpsse() {
+    if (current_job) {
+        struct flash_job *job = current_job;
+
+        // Let the worker stop at the next page before closing the device
+        g_atomic_int_set(&job->cancel, 1);
+        g_thread_join(job->thread);
+
+        // A progress_idle() still queued would use the job after it is freed
+        if (job->idle_pending)
+            g_source_remove(job->idle_id);
+        g_mutex_clear(&job->lock);
+        g_free(job->path);
+        g_free(job);
+        current_job = NULL;
+    }
     if (mpsse_initialized) {
         printf("Cleaning up MPSSE interface...\n");
         mpsse_close();
@@ -107,147 +227,183 @@ void on_btn_select_file(GtkButton *button, gpointer user_data) {
     gtk_widget_destroy(dialog);
 }
 
-void on_btn_flash_chip(GtkButton *button, gpointer user_data) {
-    printf("Flashing the chip...\n");
-    
-    // Check if a file is selected
-    if (!selected_file_path) {
-        printf("Error: No bitstream file selected!\n");
-        update_progress(0.0, "Error: No file selected");
-        return;
-    }
-    
-    update_progress(0.0, "Opening file...");
-    
+// Erase, program and verify on the worker thread. Only the progress
+// functions above may be used to talk to the GUI from here.
+static gpointer flash_worker(gpointer data) {
+    struct flash_job *job = data;
+    const char *result = "Flash completed successfully!";
+    double result_fraction = 1.0;
+
+    post_progress(job, 0.0, "Opening file...", true);
+
     // Open the selected file
-    FILE *f = fopen(selected_file_path, "rb");
+    FILE *f = fopen(job->path, "rb");
     if (f == NULL) {
-        printf("Error: Cannot open file '%s' for reading\n", selected_file_path);
-        update_progress(0.0, "Error: Cannot open file");
-        return;
+        printf("Error: Cannot open file '%s' for reading\n", job->path);
+        result = "Error: Cannot open file";
+        result_fraction = 0.0;
+        goto done;
     }
-    
+
     // Get file size
     fseek(f, 0L, SEEK_END);
     long file_size = ftell(f);
     fseek(f, 0L, SEEK_SET);
-    
+
     if (file_size <= 0) {
         printf("Error: Invalid file size\n");
-        update_progress(0.0, "Error: Invalid file size");
+        result = "Error: Invalid file size";
+        result_fraction = 0.0;
         fclose(f);
-        return;
+        goto done;
     }
-    
+
     printf("File size: %ld bytes\n", file_size);
-    update_progress(0.05, "File loaded successfully");
-    
+    post_progress(job, 0.05, "File loaded successfully", true);
+
     // Initialize MPSSE if not already done
     if (!mpsse_initialized) {
-        update_progress(0.1, "Initializing MPSSE interface...");
+        post_progress(job, 0.1, "Initializing MPSSE interface...", true);
         printf("Initializing MPSSE interface...\n");
         mpsse_init(0, NULL, false);
         mpsse_initialized = true;
         flash_release_reset();
         usleep(100000);
     }
-    
+
     // Reset and prepare flash
-    update_progress(0.15, "Preparing flash...");
+    post_progress(job, 0.15, "Preparing flash...", true);
     printf("Preparing flash...\n");
     flash_chip_deselect();
     usleep(250000);
     flash_reset();
     flash_power_up();
     flash_read_id();
-    
+
     // Erase flash (using 64kB sectors)
-    update_progress(0.2, "Erasing flash...");
+    start_phase(job, 0.2, "Erasing flash...");
     printf("Erasing flash...\n");
     int erase_block_size = 64; // 64kB sectors
     int block_size = erase_block_size << 10; // Convert to bytes
     int block_mask = block_size - 1;
     int begin_addr = 0 & ~block_mask;
     int end_addr = (file_size + block_mask) & ~block_mask;
-    
-    int total_erase_blocks = (end_addr - begin_addr) / block_size;
-    int current_erase_block = 0;
-    
-    for (int addr = begin_addr; addr < end_addr; addr += block_size) {
-        double erase_progress = 0.2 + (0.3 * current_erase_block / total_erase_blocks);
-        char erase_text[100];
-        snprintf(erase_text, sizeof(erase_text), "Erasing sector %d/%d", 
-                current_erase_block + 1, total_erase_blocks);
-        update_progress(erase_progress, erase_text);
-        
+
+    bool verify_ok = true;
+
+    for (int addr = begin_addr; addr < end_addr && !cancelled(job); addr += block_size) {
+        phase_progress(job, 0.2, 0.3, "Erasing", addr, addr - begin_addr, end_addr - begin_addr);
+
         printf("Erasing sector at 0x%06X\n", addr);
         flash_write_enable();
         flash_64kB_sector_erase(addr);
         flash_wait();
-        current_erase_block++;
     }
-    
+
     // Program flash
-    update_progress(0.5, "Programming flash...");
-    printf("Programming flash...\n");
-    for (int rc, addr = 0; true; addr += rc) {
+    if (!cancelled(job)) {
+        start_phase(job, 0.5, "Programming flash...");
+        printf("Programming flash...\n");
+    }
+    for (int rc, addr = 0; !cancelled(job); addr += rc) {
         uint8_t buffer[256];
         int page_size = 256 - addr % 256;
         rc = fread(buffer, 1, page_size, f);
         if (rc <= 0)
             break;
-            
-        double prog_progress = 0.5 + (0.3 * addr / file_size);
-        char prog_text[100];
-        snprintf(prog_text, sizeof(prog_text), "Programming: %ld%% (0x%06X)", 
-                100 * addr / file_size, addr);
-        update_progress(prog_progress, prog_text);
-        
+
+        phase_progress(job, 0.5, 0.3, "Programming", addr, addr, file_size);
+
         flash_write_enable();
         flash_prog(addr, buffer, rc);
         flash_wait();
     }
-    
+
     // Verify programming
-    update_progress(0.8, "Verifying flash...");
-    printf("Verifying flash...\n");
+    if (!cancelled(job)) {
+        start_phase(job, 0.8, "Verifying flash...");
+        printf("Verifying flash...\n");
+    }
     fseek(f, 0, SEEK_SET);
-    bool verify_ok = true;
-    for (int addr = 0; true; addr += 256) {
+    for (int addr = 0; !cancelled(job); addr += 256) {
         uint8_t buffer_flash[256], buffer_file[256];
         int rc = fread(buffer_file, 1, 256, f);
         if (rc <= 0)
             break;
-            
-        double verify_progress = 0.8 + (0.15 * addr / file_size);
-        char verify_text[100];
-        snprintf(verify_text, sizeof(verify_text), "Verifying: %ld%% (0x%06X)", 
-                100 * addr / file_size, addr);
-        update_progress(verify_progress, verify_text);
-        
+
+        phase_progress(job, 0.8, 0.15, "Verifying", addr, addr, file_size);
+
         flash_read(addr, buffer_flash, rc);
         if (memcmp(buffer_file, buffer_flash, rc)) {
             printf("\nVerification failed at address 0x%06X!\n", addr);
-            update_progress(0.95, "Verification failed!");
+            post_progress(job, 0.95, "Verification failed!", true);
             verify_ok = false;
             break;
         }
     }
-    
+
     // Power down flash
-    update_progress(0.95, "Finalizing...");
+    post_progress(job, 0.95, "Finalizing...", true);
     flash_power_down();
     flash_release_reset();
     usleep(250000);
-    
+
     fclose(f);
-    
-    if (verify_ok) {
+
+    if (cancelled(job)) {
+        printf("\nCancelled\n");
+        result = "Cancelled, flash contents are incomplete";
+        result_fraction = 0.0;
+    } else if (verify_ok) {
         printf("\nVERIFY OK\n");
-        update_progress(1.0, "Flash completed successfully!");
         printf("Flash operation completed.\n");
     } else {
-        update_progress(0.0, "Flash failed - verification error");
+        result = "Flash failed - verification error";
+        result_fraction = 0.0;
+    }
+
+done:
+    // The final state and the finished flag go out together: once
+    // progress_idle() sees the flag it joins this thread and frees the job
+    g_mutex_lock(&job->lock);
+    job->fraction = result_fraction;
+    snprintf(job->text, sizeof(job->text), "%s", result);
+    job->finished = true;
+    bool queue = !job->idle_pending;
+    job->idle_pending = true;
+    g_mutex_unlock(&job->lock);
+
+    if (queue)
+        job->idle_id = g_idle_add(progress_idle, job);
+    return NULL;
+}
+
+void on_btn_flash_chip(GtkButton *button, gpointer user_data) {
+    printf("Flashing the chip...\n");
+
+    // Check if a file is selected
+    if (!selected_file_path) {
+        printf("Error: No bitstream file selected!\n");
+        update_progress(0.0, "Error: No file selected");
+        return;
+    }
+    if (current_job)
+        return;
+
+    struct flash_job *job = g_new0(struct flash_job, 1);
+    job->path = g_strdup(selected_file_path);
+    g_mutex_init(&job->lock);
+
+    current_job = job;
+    set_busy(true);
+    job->thread = g_thread_new("flash", flash_worker, job);
+}
+
+static void on_btn_cancel(GtkButton *button, gpointer user_data) {
+    if (current_job) {
+        printf("Cancelling...\n");
+        g_atomic_int_set(&current_job->cancel, 1);
+        gtk_widget_set_sensitive(btn_cancel, FALSE);
     }
 }
 
@@ -264,11 +420,11 @@ int main(int argc, char *argv[]) {
     gtk_container_add(GTK_CONTAINER(window), vbox);
 
     // Add a button to test SPI flash connection
-    GtkWidget *btn_test_connection = gtk_button_new_with_label("Test Probe Connection");
+    btn_test_connection = gtk_button_new_with_label("Test Probe Connection");
     g_signal_connect(btn_test_connection, "clicked", G_CALLBACK(on_btn_test_connection), NULL);
     gtk_box_pack_start(GTK_BOX(vbox), btn_test_connection, TRUE, TRUE, 0);
     // Add bitstream file selection. file path selection dialog
-    GtkWidget *btn_select_file = gtk_button_new_with_label("Select Bitstream File");
+    btn_select_file = gtk_button_new_with_label("Select Bitstream File");
     g_signal_connect(btn_select_file, "clicked", G_CALLBACK(on_btn_select_file), NULL);
     gtk_box_pack_start(GTK_BOX(vbox), btn_select_file, TRUE, TRUE, 0);
 
@@ -283,10 +439,16 @@ int main(int argc, char *argv[]) {
     gtk_box_pack_start(GTK_BOX(vbox), progress_bar, TRUE, TRUE, 0);
 
     // Flash the Chip
-    GtkWidget *btn_flash_chip = gtk_button_new_with_label("Flash Chip");
+    btn_flash_chip = gtk_button_new_with_label("Flash Chip");
     g_signal_connect(btn_flash_chip, "clicked", G_CALLBACK(on_btn_flash_chip), NULL);
     gtk_box_pack_start(GTK_BOX(vbox), btn_flash_chip, TRUE, TRUE, 0);
 
+    // Stop a running flash operation at the next page
+    btn_cancel = gtk_button_new_with_label("Cancel");
+    g_signal_connect(btn_cancel, "clicked", G_CALLBACK(on_btn_cancel), NULL);
+    gtk_box_pack_start(GTK_BOX(vbox), btn_cancel, TRUE, TRUE, 0);
+    gtk_widget_set_sensitive(btn_cancel, FALSE);
+
     gtk_widget_show_all(window);
     gtk_main();
 
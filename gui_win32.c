@@ -7,6 +7,7 @@
 #include <string.h>
 #include <stdbool.h>
 #include <stdarg.h>
+#include <stdlib.h>
 
 // Force ANSI/ASCII string functions
 #ifdef UNICODE
@@ -38,10 +39,25 @@
 #define ID_PROGRESS_BAR         1005
 #define ID_EDIT_DEVICE_STRING   1006
 #define ID_LBL_DEVICE_STRING    1007
+#define ID_BTN_CANCEL           1008
+
+// Messages posted by the flash worker thread
+#define WM_APP_PROGRESS         (WM_APP + 1)  // new state in progress_percent/progress_text
+#define WM_APP_FLASH_DONE       (WM_APP + 2)  // wParam is an enum flash_result
+
+// The worker posts progress at most this often
+#define PROGRESS_INTERVAL_MS    50
+
+// Log lines are queued in a ring of this many slots and written out by a
+// low priority thread every LOG_DRAIN_INTERVAL_MS. When the ring is full
+// new lines are counted and dropped rather than blocking the caller.
+#define LOG_RING_SLOTS          256
+#define LOG_LINE_MAX            1024
+#define LOG_DRAIN_INTERVAL_MS   100
 
 // Window dimensions
 #define WINDOW_WIDTH    500
-#define WINDOW_HEIGHT   380  // Increased for device string input
+#define WINDOW_HEIGHT   420  // Increased for device string input and cancel button
 #define BUTTON_WIDTH    200
 #define BUTTON_HEIGHT   30
 #define MARGIN          10
@@ -57,20 +73,110 @@ static HWND hwnd_btn_test = NULL;
 static HWND hwnd_btn_select = NULL;
 static HWND hwnd_btn_flash = NULL;
 static HWND hwnd_edit_device = NULL;
+static HWND hwnd_btn_cancel = NULL;
 static FILE *log_file = NULL;
 
+// Log ring: a bounded multi-producer queue, drained by log_thread only.
+// A slot is free for the producer at position pos when seq == pos and
+// holds a line for the consumer when seq == pos + 1.
+struct log_slot {
+    volatile LONG seq;
+    FILETIME time;
+    char text[LOG_LINE_MAX];
+};
+static struct log_slot log_ring[LOG_RING_SLOTS];
+static volatile LONG log_head = 0;      // next position to claim
+static volatile LONG log_tail = 0;      // next position to write out
+static volatile LONG log_written = 0;   // log_tail at the last fflush()
+static volatile LONG log_dropped = 0;
+static HANDLE log_thread = NULL;
+static HANDLE log_stop = NULL;
+
+// Flash worker state
+enum flash_result {
+    FLASH_OK,
+    FLASH_CANCELLED,
+    FLASH_VERIFY_FAILED,
+    FLASH_OPEN_FAILED,
+    FLASH_BAD_SIZE
+};
+static HANDLE flash_thread = NULL;
+static volatile LONG flash_cancel = 0;
+static CRITICAL_SECTION progress_lock;  // protects progress_percent and progress_text
+static int progress_percent = 0;
+static char progress_text[128];
+static volatile LONG progress_pending = 0;  // a WM_APP_PROGRESS is in the queue
+static DWORD progress_last = 0;             // worker only
+
 // Function prototypes
 LRESULT CALLBACK WindowProc(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lParam);
 void CreateControls(HWND hwnd);
 void OnTestConnection(void);
 void OnSelectFile(HWND hwnd);
 void OnFlashChip(void);
+void OnFlashDone(enum flash_result result);
+void OnCancel(void);
 void UpdateProgress(int percent, const char *text);
 void CleanupMpsse(void);
 void InitLogging(void);
 void LogMessage(const char *format, ...);
+void LogFlush(void);
 void CloseLogging(void);
 
+static void log_drain(void) {
+    bool wrote = false;
+
+    for (;;) {
+        struct log_slot *slot = &log_ring[(ULONG)log_tail % LOG_RING_SLOTS];
+        if (slot->seq != log_tail + 1)
+            break;
+
+        FILETIME local;
+        SYSTEMTIME st;
+        FileTimeToLocalFileTime(&slot->time, &local);
+        FileTimeToSystemTime(&local, &st);
+
+        // Write to log file with timestamp
+        if (log_file) {
+            fprintf(log_file, "[%04d-%02d-%02d %02d:%02d:%02d.%03d] %s\n",
+                    st.wYear, st.wMonth, st.wDay,
+                    st.wHour, st.wMinute, st.wSecond, st.wMilliseconds,
+                    slot->text);
+        }
+
+        // Also write to console and Visual Studio output
+        printf("[%02d:%02d:%02d] %s\n", st.wHour, st.wMinute, st.wSecond, slot->text);
+
+        char debug_buffer[LOG_LINE_MAX + 16];
+        snprintf(debug_buffer, sizeof(debug_buffer), "[IceProg] %s\n", slot->text);
+        OutputDebugStringA(debug_buffer);
+
+        // Hand the slot back to the producers for the next round
+        InterlockedExchange(&slot->seq, log_tail + LOG_RING_SLOTS);
+        log_tail++;
+        wrote = true;
+    }
+
+    LONG dropped = InterlockedExchange(&log_dropped, 0);
+    if (dropped) {
+        if (log_file)
+            fprintf(log_file, "[%ld log messages dropped]\n", (long)dropped);
+        printf("[%ld log messages dropped]\n", (long)dropped);
+        wrote = true;
+    }
+
+    if (wrote && log_file)
+        fflush(log_file);
+    InterlockedExchange(&log_written, log_tail);
+}
+
+static DWORD WINAPI log_writer(LPVOID param) {
+    while (WaitForSingleObject(log_stop, LOG_DRAIN_INTERVAL_MS) == WAIT_TIMEOUT)
+        log_drain();
+    log_drain();
+    return 0;
+}
+
 void InitLogging(void) {
     // Create log file immediately with basic error handling
     log_file = fopen("iceprog_debug.log", "w");
@@ -99,41 +205,81 @@ void InitLogging(void) {
         fprintf(log_file, "InitLogging completed successfully\n");
         fflush(log_file);
     }
+
+    for (int i = 0; i < LOG_RING_SLOTS; i++)
+        log_ring[i].seq = i;
+
+    log_stop = CreateEvent(NULL, TRUE, FALSE, NULL);
+    log_thread = CreateThread(NULL, 0, log_writer, NULL, 0, NULL);
+    if (log_thread) {
+        SetThreadPriority(log_thread, THREAD_PRIORITY_LOWEST);
+    } else if (log_file) {
+        fprintf(log_file, "Cannot start log writer thread, logging synchronously\n");
+        fflush(log_file);
+    }
+
+    // mpsse_error() calls exit(), make sure queued lines still get written
+    atexit(CloseLogging);
 }
 
 void LogMessage(const char *format, ...) {
     va_list args;
-    char buffer[1024];
-    SYSTEMTIME st;
-    
-    GetLocalTime(&st);
-    
+    struct log_slot *slot;
+    LONG pos = log_head;
+
+    // Claim a slot, or drop the line if the writer is too far behind
+    for (;;) {
+        slot = &log_ring[(ULONG)pos % LOG_RING_SLOTS];
+        LONG diff = slot->seq - pos;
+        if (diff == 0) {
+            LONG prev = InterlockedCompareExchange(&log_head, pos + 1, pos);
+            if (prev == pos)
+                break;
+            pos = prev;
+        } else if (diff < 0) {
+            InterlockedIncrement(&log_dropped);
+            return;
+        } else {
+            pos = log_head;
+        }
+    }
+
+    GetSystemTimeAsFileTime(&slot->time);
+
     // Format the message
     va_start(args, format);
-    vsnprintf(buffer, sizeof(buffer), format, args);
+    vsnprintf(slot->text, sizeof(slot->text), format, args);
     va_end(args);
-    
-    // Write to log file with timestamp
-    if (log_file) {
-        fprintf(log_file, "[%04d-%02d-%02d %02d:%02d:%02d.%03d] %s\n",
-                st.wYear, st.wMonth, st.wDay,
-                st.wHour, st.wMinute, st.wSecond, st.wMilliseconds,
-                buffer);
-        fflush(log_file);
+
+    // Publish it to the writer
+    InterlockedExchange(&slot->seq, pos + 1);
+
+    if (!log_thread)
+        log_drain();
+}
+
+// Wait until everything logged so far is on disk
+void LogFlush(void) {
+    LONG target = log_head;
+    if (!log_thread) {
+        log_drain();
+        return;
     }
-    
-    // Also write to console and Visual Studio output
-    printf("[%02d:%02d:%02d] %s\n", st.wHour, st.wMinute, st.wSecond, buffer);
-    
-    // Write to debug output (visible in Visual Studio)
-    char debug_buffer[1100];
-    snprintf(debug_buffer, sizeof(debug_buffer), "[IceProg] %s\n", buffer);
-    OutputDebugStringA(debug_buffer);
+    for (int i = 0; i < 200 && log_written - target < 0; i++)
+        Sleep(5);
 }
 
 void CloseLogging(void) {
-    if (log_file) {
+    if (log_thread) {
         LogMessage("=== IceProg GUI Log Ended ===");
+        SetEvent(log_stop);
+        WaitForSingleObject(log_thread, 2000);
+        CloseHandle(log_thread);
+        CloseHandle(log_stop);
+        log_thread = NULL;
+        log_stop = NULL;
+    }
+    if (log_file) {
         fclose(log_file);
         log_file = NULL;
     }
@@ -144,19 +290,60 @@ static void update_progress(double fraction, const char *text) {
         int percent = (int)(fraction * 100);
         SendMessage(hwnd_progress_bar, PBM_SETPOS, percent, 0);
         SetWindowTextA(hwnd_progress_bar, text);
-        
-        // Process pending messages to update the display
-        MSG msg;
-        while (PeekMessage(&msg, NULL, 0, 0, PM_REMOVE)) {
-            TranslateMessage(&msg);
-            DispatchMessage(&msg);
-        }
     }
 }
 
+static void set_busy(bool busy) {
+    EnableWindow(hwnd_btn_test, !busy);
+    EnableWindow(hwnd_btn_select, !busy);
+    EnableWindow(hwnd_btn_flash, !busy);
+    EnableWindow(hwnd_edit_device, !busy);
+    EnableWindow(hwnd_btn_cancel, busy);
+}
+
+// Called on the worker thread. Stores the new state and posts
+// WM_APP_PROGRESS, unless the last one was posted less than
+// PROGRESS_INTERVAL_MS ago or has not been handled yet.
+static void post_progress(double fraction, const char *text, bool force) {
+    DWORD now = GetTickCount();
+    if (!force && now - progress_last < PROGRESS_INTERVAL_MS)
+        return;
+    progress_last = now;
+
+    EnterCriticalSection(&progress_lock);
+    progress_percent = (int)(fraction * 100);
+    snprintf(progress_text, sizeof(progress_text), "%s", text);
+    LeaveCriticalSection(&progress_lock);
+
+    if (InterlockedExchange(&progress_pending, 1) == 0)
+        PostMessage(hwnd_main, WM_APP_PROGRESS, 0, 0);
+}
+
+static void show_progress(void) {
+    char text[sizeof(progress_text)];
+    int percent;
+
+    InterlockedExchange(&progress_pending, 0);
+    EnterCriticalSection(&progress_lock);
+    percent = progress_percent;
+    memcpy(text, progress_text, sizeof(text));
+    LeaveCriticalSection(&progress_lock);
+
+    update_progress(percent / 100.0, text);
+}
+
 static void cleanup_mpsse() {
     LogMessage("=== Cleanup Started ===");
     
+    if (flash_thread) {
+        // Let the worker stop at the next page before closing the device
+        LogMessage("Waiting for flash operation to stop...");
+        InterlockedExchange(&flash_cancel, 1);
+        WaitForSingleObject(flash_thread, INFINITE);
+        CloseHandle(flash_thread);
+        flash_thread = NULL;
+    }
+    
     if (mpsse_initialized) {
         LogMessage("Cleaning up MPSSE interface...");
         __try {
@@ -222,9 +409,7 @@ void OnTestConnection(void) {
             LogMessage("Make sure the device is not in use by another application.");
             
             // Flush the log immediately so we can see this even if the app exits
-            if (log_file) {
-                fflush(log_file);
-            }
+            LogFlush();
             
             // Note: mpsse_init may call exit() if no device is found
             // This is a limitation of the current libftdi implementation
@@ -314,26 +499,20 @@ void OnSelectFile(HWND hwnd) {
     }
 }
 
-void OnFlashChip(void) {
-    printf("Flashing the chip...\n");
-    
-    // Check if a file is selected
-    if (strlen(selected_file_path) == 0) {
-        printf("Error: No bitstream file selected!\n");
-        MessageBoxA(hwnd_main, "Please select a bitstream file first!", "Error", MB_OK | MB_ICONERROR);
-        update_progress(0.0, "Error: No file selected");
-        return;
-    }
-    
-    update_progress(0.0, "Opening file...");
+// Erase, program and verify on the worker thread. Talks to the window
+// only through post_progress() and WM_APP_FLASH_DONE.
+static DWORD WINAPI FlashWorker(LPVOID param) {
+    enum flash_result result = FLASH_OK;
+
+    post_progress(0.0, "Opening file...", true);
     
     // Open the selected file
     FILE *f = fopen(selected_file_path, "rb");
     if (f == NULL) {
-        printf("Error: Cannot open file '%s' for reading\n", selected_file_path);
-        MessageBoxA(hwnd_main, "Cannot open the selected file!", "Error", MB_OK | MB_ICONERROR);
-        update_progress(0.0, "Error: Cannot open file");
-        return;
+        LogMessage("Error: Cannot open file '%s' for reading", selected_file_path);
+        post_progress(0.0, "Error: Cannot open file", true);
+        result = FLASH_OPEN_FAILED;
+        goto done;
     }
     
     // Get file size
@@ -342,20 +521,21 @@ void OnFlashChip(void) {
     fseek(f, 0L, SEEK_SET);
     
     if (file_size <= 0) {
-        printf("Error: Invalid file size\n");
-        MessageBoxA(hwnd_main, "Invalid file size!", "Error", MB_OK | MB_ICONERROR);
-        update_progress(0.0, "Error: Invalid file size");
+        LogMessage("Error: Invalid file size");
+        post_progress(0.0, "Error: Invalid file size", true);
         fclose(f);
-        return;
+        result = FLASH_BAD_SIZE;
+        goto done;
     }
     
-    printf("File size: %ld bytes\n", file_size);
-    update_progress(0.05, "File loaded successfully");
+    LogMessage("File size: %ld bytes", file_size);
+    post_progress(0.05, "File loaded successfully", true);
     
     // Initialize MPSSE if not already done
     if (!mpsse_initialized) {
-        update_progress(0.1, "Initializing MPSSE interface...");
-        printf("Initializing MPSSE interface...\n");
+        post_progress(0.1, "Initializing MPSSE interface...", true);
+        LogMessage("Initializing MPSSE interface...");
+        LogFlush();
         mpsse_init(0, NULL, false);
         mpsse_initialized = true;
         flash_release_reset();
@@ -363,8 +543,8 @@ void OnFlashChip(void) {
     }
     
     // Reset and prepare flash
-    update_progress(0.15, "Preparing flash...");
-    printf("Preparing flash...\n");
+    post_progress(0.15, "Preparing flash...", true);
+    LogMessage("Preparing flash...");
     flash_chip_deselect();
     usleep(250000);  // 250ms
     flash_reset();
@@ -372,8 +552,8 @@ void OnFlashChip(void) {
     flash_read_id();
     
     // Erase flash (using 64kB sectors)
-    update_progress(0.2, "Erasing flash...");
-    printf("Erasing flash...\n");
+    post_progress(0.2, "Erasing flash...", true);
+    LogMessage("Erasing flash...");
     int erase_block_size = 64; // 64kB sectors
     int block_size = erase_block_size << 10; // Convert to bytes
     int block_mask = block_size - 1;
@@ -383,14 +563,14 @@ void OnFlashChip(void) {
     int total_erase_blocks = (end_addr - begin_addr) / block_size;
     int current_erase_block = 0;
     
-    for (int addr = begin_addr; addr < end_addr; addr += block_size) {
+    for (int addr = begin_addr; addr < end_addr && !flash_cancel; addr += block_size) {
         double erase_progress = 0.2 + (0.3 * current_erase_block / total_erase_blocks);
         char erase_text[100];
         snprintf(erase_text, sizeof(erase_text), "Erasing sector %d/%d", 
                 current_erase_block + 1, total_erase_blocks);
-        update_progress(erase_progress, erase_text);
+        post_progress(erase_progress, erase_text, false);
         
-        printf("Erasing sector at 0x%06X\n", addr);
+        LogMessage("Erasing sector at 0x%06X", addr);
         flash_write_enable();
         flash_64kB_sector_erase(addr);
         flash_wait();
@@ -398,9 +578,11 @@ void OnFlashChip(void) {
     }
     
     // Program flash
-    update_progress(0.5, "Programming flash...");
-    printf("Programming flash...\n");
-    for (int rc, addr = 0; true; addr += rc) {
+    if (!flash_cancel) {
+        post_progress(0.5, "Programming flash...", true);
+        LogMessage("Programming flash...");
+    }
+    for (int rc, addr = 0; !flash_cancel; addr += rc) {
         uint8_t buffer[256];
         int page_size = 256 - addr % 256;
         rc = fread(buffer, 1, page_size, f);
@@ -411,7 +593,7 @@ void OnFlashChip(void) {
         char prog_text[100];
         snprintf(prog_text, sizeof(prog_text), "Programming: %ld%% (0x%06X)", 
                 100 * addr / file_size, addr);
-        update_progress(prog_progress, prog_text);
+        post_progress(prog_progress, prog_text, false);
         
         flash_write_enable();
         flash_prog(addr, buffer, rc);
@@ -419,11 +601,12 @@ void OnFlashChip(void) {
     }
     
     // Verify programming
-    update_progress(0.8, "Verifying flash...");
-    printf("Verifying flash...\n");
+    if (!flash_cancel) {
+        post_progress(0.8, "Verifying flash...", true);
+        LogMessage("Verifying flash...");
+    }
     fseek(f, 0, SEEK_SET);
-    bool verify_ok = true;
-    for (int addr = 0; true; addr += 256) {
+    for (int addr = 0; !flash_cancel; addr += 256) {
         uint8_t buffer_flash[256], buffer_file[256];
         int rc = fread(buffer_file, 1, 256, f);
         if (rc <= 0)
@@ -433,33 +616,96 @@ void OnFlashChip(void) {
         char verify_text[100];
         snprintf(verify_text, sizeof(verify_text), "Verifying: %ld%% (0x%06X)", 
                 100 * addr / file_size, addr);
-        update_progress(verify_progress, verify_text);
+        post_progress(verify_progress, verify_text, false);
         
         flash_read(addr, buffer_flash, rc);
         if (memcmp(buffer_file, buffer_flash, rc)) {
-            printf("\nVerification failed at address 0x%06X!\n", addr);
-            update_progress(0.95, "Verification failed!");
-            verify_ok = false;
+            LogMessage("Verification failed at address 0x%06X!", addr);
+            result = FLASH_VERIFY_FAILED;
             break;
         }
     }
     
     // Power down flash
-    update_progress(0.95, "Finalizing...");
+    post_progress(0.95, "Finalizing...", true);
     flash_power_down();
     flash_release_reset();
     usleep(250000);  // 250ms
     
     fclose(f);
     
-    if (verify_ok) {
-        printf("\nVERIFY OK\n");
-        update_progress(1.0, "Flash completed successfully!");
-        printf("Flash operation completed.\n");
-        MessageBoxA(hwnd_main, "Flash operation completed successfully!", "Success", MB_OK | MB_ICONINFORMATION);
+    if (flash_cancel) {
+        LogMessage("Flash operation cancelled");
+        post_progress(0.0, "Cancelled, flash contents are incomplete", true);
+        result = FLASH_CANCELLED;
+    } else if (result == FLASH_OK) {
+        LogMessage("VERIFY OK");
+        post_progress(1.0, "Flash completed successfully!", true);
+        LogMessage("Flash operation completed.");
     } else {
-        update_progress(0.0, "Flash failed - verification error");
-        MessageBoxA(hwnd_main, "Flash failed - verification error!", "Error", MB_OK | MB_ICONERROR);
+        post_progress(0.0, "Flash failed - verification error", true);
+    }
+
+done:
+    PostMessage(hwnd_main, WM_APP_FLASH_DONE, (WPARAM)result, 0);
+    return 0;
+}
+
+void OnFlashChip(void) {
+    LogMessage("Flashing the chip...");
+    
+    // Check if a file is selected
+    if (strlen(selected_file_path) == 0) {
+        LogMessage("Error: No bitstream file selected!");
+        MessageBoxA(hwnd_main, "Please select a bitstream file first!", "Error", MB_OK | MB_ICONERROR);
+        update_progress(0.0, "Error: No file selected");
+        return;
+    }
+    if (flash_thread)
+        return;
+    
+    flash_cancel = 0;
+    progress_last = GetTickCount() - PROGRESS_INTERVAL_MS;
+    flash_thread = CreateThread(NULL, 0, FlashWorker, NULL, 0, NULL);
+    if (flash_thread == NULL) {
+        LogMessage("Cannot start flash thread! Error: %d", GetLastError());
+        MessageBoxA(hwnd_main, "Cannot start the flash operation!", "Error", MB_OK | MB_ICONERROR);
+        return;
+    }
+    set_busy(true);
+}
+
+void OnFlashDone(enum flash_result result) {
+    if (flash_thread) {
+        WaitForSingleObject(flash_thread, INFINITE);
+        CloseHandle(flash_thread);
+        flash_thread = NULL;
+    }
+    set_busy(false);
+    
+    switch (result) {
+        case FLASH_OK:
+            MessageBoxA(hwnd_main, "Flash operation completed successfully!", "Success", MB_OK | MB_ICONINFORMATION);
+            break;
+        case FLASH_CANCELLED:
+            break;
+        case FLASH_VERIFY_FAILED:
+            MessageBoxA(hwnd_main, "Flash failed - verification error!", "Error", MB_OK | MB_ICONERROR);
+            break;
+        case FLASH_OPEN_FAILED:
+            MessageBoxA(hwnd_main, "Cannot open the selected file!", "Error", MB_OK | MB_ICONERROR);
+            break;
+        case FLASH_BAD_SIZE:
+            MessageBoxA(hwnd_main, "Invalid file size!", "Error", MB_OK | MB_ICONERROR);
+            break;
+    }
+}
+
+void OnCancel(void) {
+    if (flash_thread) {
+        LogMessage("Cancelling flash operation...");
+        InterlockedExchange(&flash_cancel, 1);
+        EnableWindow(hwnd_btn_cancel, FALSE);
     }
 }
 
@@ -535,6 +781,15 @@ void CreateControls(HWND hwnd) {
         (WINDOW_WIDTH - BUTTON_WIDTH) / 2, y_pos,
         BUTTON_WIDTH, BUTTON_HEIGHT,
         hwnd, (HMENU)ID_BTN_FLASH_CHIP, GetModuleHandle(NULL), NULL);
+    y_pos += BUTTON_HEIGHT + MARGIN;
+    
+    // Cancel button, enabled while a flash operation runs
+    hwnd_btn_cancel = CreateWindowA(
+        "BUTTON", "Cancel",
+        WS_TABSTOP | WS_VISIBLE | WS_CHILD | WS_DISABLED | BS_PUSHBUTTON,
+        (WINDOW_WIDTH - BUTTON_WIDTH) / 2, y_pos,
+        BUTTON_WIDTH, BUTTON_HEIGHT,
+        hwnd, (HMENU)ID_BTN_CANCEL, GetModuleHandle(NULL), NULL);
 }
 
 LRESULT CALLBACK WindowProc(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lParam) {
@@ -560,9 +815,21 @@ LRESULT CALLBACK WindowProc(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
                     LogMessage("Flash chip button clicked");
                     OnFlashChip();
                     break;
+                case ID_BTN_CANCEL:
+                    LogMessage("Cancel button clicked");
+                    OnCancel();
+                    break;
             }
             return 0;
             
+        case WM_APP_PROGRESS:
+            show_progress();
+            return 0;
+            
+        case WM_APP_FLASH_DONE:
+            OnFlashDone((enum flash_result)wParam);
+            return 0;
+            
         case WM_DESTROY:
             LogMessage("WM_DESTROY received, cleaning up...");
             cleanup_mpsse();
@@ -588,6 +855,7 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine
     InitLogging();
     LogMessage("=== Application Starting ===");
     LogMessage("Command line: %s", lpCmdLine ? lpCmdLine : "(empty)");
+    InitializeCriticalSection(&progress_lock);
     
     // Register the window class
     const char CLASS_NAME[] = "IceProgGUI";
@@ -0,0 +1,209 @@
+/*
+ *  iceprog -- simple programming tool for FTDI-based Lattice iCE programmers
+ *
+ *  Permission to use, copy, modify, and/or distribute this software for any
+ *  purpose with or without fee is hereby granted, provided that the above
+ *  copyright notice and this permission notice appear in all copies.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ *  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ *  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ *  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ *  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ *  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "health.h"
+#include "iceprog_fn.h"
+#include "log.h"
+#include "plan.h"
+
+struct health_stat {
+	uint32_t count;
+	uint64_t total_us;
+	uint32_t max_us;
+	uint32_t last_us;
+	uint32_t run_count;	/* this session only */
+	uint64_t run_total_us;
+};
+
+static const char *op_names[HEALTH_OPS] = { NULL, "erase4k", "erase32k", "erase64k", "program" };
+static const int op_granule[HEALTH_OPS] = { 0, 4 << 10, 32 << 10, 64 << 10, 64 << 10 };
+
+static bool health_active = false;
+static char health_path[1024];
+static double health_factor;
+static int typical_us[HEALTH_OPS];	/* 0 if the part isn't known */
+static struct health_stat *table[HEALTH_OPS];
+static int table_len[HEALTH_OPS];
+
+static struct health_stat *lookup(enum health_op op, int addr)
+{
+	if (op <= HEALTH_NONE || op >= HEALTH_OPS || addr < 0)
+		return NULL;
+	int i = addr / op_granule[op];
+	return i < table_len[op] ? &table[op][i] : NULL;
+}
+
+/* What a busy time is compared with: the datasheet, or else what the
+ * same sector took before this session */
+static double reference_us(enum health_op op, const struct health_stat *st)
+{
+	if (typical_us[op] > 0)
+		return typical_us[op];
+	uint32_t n = st->count - st->run_count;
+	return n >= 3 ? (double)(st->total_us - st->run_total_us) / n : 0.0;
+}
+
+static void health_save(void)
+{
+	for (int i = 0; i < table_len[HEALTH_PROGRAM]; i++) {
+		const struct health_stat *st = &table[HEALTH_PROGRAM][i];
+		if (st->run_count == 0)
+			continue;
+		double ref = reference_us(HEALTH_PROGRAM, st);
+		double mean = (double)st->run_total_us / st->run_count;
+		if (ref > 0.0 && mean > health_factor * ref)
+			log_warn(LOG_FLASH, "health: pages in 0x%06X took %.2f ms on average, %.1fx the earlier %.2f ms",
+					i * op_granule[HEALTH_PROGRAM], mean / 1000.0, mean / ref, ref / 1000.0);
+	}
+
+	char tmp_path[sizeof(health_path) + 4];
+	snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", health_path);
+
+	FILE *f = fopen(tmp_path, "w");
+	if (f == NULL) {
+		fprintf(stderr, "health: can't write `%s': %s\n", tmp_path, strerror(errno));
+		return;
+	}
+
+	fprintf(f, "iceprog-health 1 id=%06X\n", flash_jedec_id);
+	for (int op = HEALTH_NONE + 1; op < HEALTH_OPS; op++) {
+		for (int i = 0; i < table_len[op]; i++) {
+			const struct health_stat *st = &table[op][i];
+			if (st->count == 0)
+				continue;
+			fprintf(f, "%06X %s %u %llu %u %u\n", i * op_granule[op], op_names[op], st->count,
+					(unsigned long long)st->total_us, st->max_us, st->last_us);
+		}
+	}
+
+	if (fclose(f) != 0) {
+		fprintf(stderr, "health: can't write `%s': %s\n", tmp_path, strerror(errno));
+		remove(tmp_path);
+		return;
+	}
+
+#ifdef _WIN32
+	/* rename() doesn't replace existing files on Windows */
+	remove(health_path);
+#endif
+	if (rename(tmp_path, health_path) != 0) {
+		fprintf(stderr, "health: can't replace `%s': %s\n", health_path, strerror(errno));
+		remove(tmp_path);
+	}
+}
+
+bool health_open(const char *dir, uint64_t uid, uint32_t jedec_id, double factor)
+{
+#ifdef _WIN32
+	if (mkdir(dir) != 0 && errno != EEXIST) {
+#else
+	if (mkdir(dir, 0777) != 0 && errno != EEXIST) {
+#endif
+		fprintf(stderr, "health: can't create directory `%s': %s\n", dir, strerror(errno));
+		return false;
+	}
+
+	snprintf(health_path, sizeof(health_path), "%s/%016llX.health", dir, (unsigned long long)uid);
+	health_factor = factor;
+
+	struct flash_part part;
+	if (plan_part_by_id(jedec_id, &part)) {
+		typical_us[HEALTH_ERASE_4K] = part.erase_4k;
+		typical_us[HEALTH_ERASE_32K] = part.erase_32k;
+		typical_us[HEALTH_ERASE_64K] = part.erase_64k;
+		/* Not page programs: they are shorter than the 1 ms poll
+		   interval plus a USB round trip, what flash_wait() measures
+		   is mostly polling. Only their history is comparable. */
+	}
+
+	/* Sectors past the size from the ID are not recorded */
+	int size = flash_size_from_id(jedec_id);
+	if (size <= 0)
+		size = 16 << 20;
+	for (int op = HEALTH_NONE + 1; op < HEALTH_OPS; op++) {
+		table_len[op] = size / op_granule[op];
+		table[op] = calloc(table_len[op], sizeof(struct health_stat));
+		if (table[op] == NULL) {
+			fprintf(stderr, "Out of memory.\n");
+			return false;
+		}
+	}
+
+	FILE *f = fopen(health_path, "r");
+	if (f != NULL) {
+		char line[256];
+		if (fgets(line, sizeof(line), f) == NULL || strncmp(line, "iceprog-health 1 ", 17)) {
+			fprintf(stderr, "health: `%s' is not a health history, replacing it\n", health_path);
+		} else {
+			while (fgets(line, sizeof(line), f) != NULL) {
+				unsigned int addr, count, max_us, last_us;
+				unsigned long long total_us;
+				char name[16];
+				if (sscanf(line, "%x %15s %u %llu %u %u", &addr, name, &count, &total_us, &max_us, &last_us) != 6)
+					continue;
+				for (int op = HEALTH_NONE + 1; op < HEALTH_OPS; op++) {
+					struct health_stat *st = lookup(op, addr);
+					if (strcmp(name, op_names[op]) || st == NULL)
+						continue;
+					st->count = count;
+					st->total_us = total_us;
+					st->max_us = max_us;
+					st->last_us = last_us;
+				}
+			}
+		}
+		fclose(f);
+	}
+
+	if (!health_active)
+		atexit(health_save);
+	health_active = true;
+	return true;
+}
+
+void health_record(enum health_op op, int addr, uint64_t busy_us)
+{
+	if (!health_active)
+		return;
+	struct health_stat *st = lookup(op, addr);
+	if (st == NULL)
+		return;
+
+	if (op != HEALTH_PROGRAM) {
+		double ref = reference_us(op, st);
+		if (ref > 0.0 && busy_us > health_factor * ref)
+			log_warn(LOG_FLASH, "health: %s at 0x%06X took %.1f ms, %.1fx the typical %.1f ms",
+					op_names[op], addr, busy_us / 1000.0, busy_us / ref, ref / 1000.0);
+	}
+
+	st->count++;
+	st->total_us += busy_us;
+	st->run_count++;
+	st->run_total_us += busy_us;
+	st->last_us = busy_us;
+	if (busy_us > st->max_us)
+		st->max_us = busy_us;
+}
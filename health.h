@@ -0,0 +1,55 @@
+/*
+ *  iceprog -- simple programming tool for FTDI-based Lattice iCE programmers
+ *
+ *  Permission to use, copy, modify, and/or distribute this software for any
+ *  purpose with or without fee is hereby granted, provided that the above
+ *  copyright notice and this permission notice appear in all copies.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ *  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ *  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ *  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ *  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ *  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#ifndef HEALTH_H
+#define HEALTH_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* --health: flash_wait() times every erase and page program, and the busy
+ * times are kept per sector in one text file per flash unique ID,
+ * <dir>/<uid>.health:
+ *
+ *   iceprog-health 1 id=<jedec id>
+ *   <addr> <op> <count> <total us> <max us> <last us>
+ *
+ * Erases are kept per erase block, page programs per 64 kB sector. An
+ * erase that takes longer than factor times the typical figure of the
+ * part is reported right away; for parts missing from the --plan table
+ * the average of the earlier runs is the reference. A sector whose pages
+ * took that much longer on average than in earlier runs is reported when
+ * the history is saved: page programs are shorter than the poll
+ * interval, so only the same setup's history is comparable. */
+
+enum health_op {
+	HEALTH_NONE,
+	HEALTH_ERASE_4K,
+	HEALTH_ERASE_32K,
+	HEALTH_ERASE_64K,
+	HEALTH_PROGRAM,
+	HEALTH_OPS
+};
+
+/* Load the history of a flash and save it at exit. Returns false if the
+ * directory can't be created. */
+bool health_open(const char *dir, uint64_t uid, uint32_t jedec_id, double factor);
+
+/* Busy time of an operation at addr, does nothing before health_open() */
+void health_record(enum health_op op, int addr, uint64_t busy_us);
+
+#endif /* HEALTH_H */
@@ -32,6 +32,7 @@
 #include <string.h>
 #include <getopt.h>
 #include <errno.h>
+#include <time.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 
@@ -41,8 +42,551 @@
 #endif
 
 #include "iceprog_fn.h"
+#include "bitstream.h"
+#include "compare.h"
+#include "hash.h"
+#include "health.h"
+#include "job.h"
+#include "journal.h"
+#include "log.h"
+#include "manifest.h"
+#include "metrics.h"
+#include "patch.h"
+#include "plan.h"
+#include "probe.h"
+#include "scan.h"
+#include "spsc.h"
+#include "station.h"
+#include "stats.h"
+#include "thread.h"
+#include "trace.h"
+#include "warmboot.h"
+
+
+/* --stats / --stats-json reporting, done at exit so aborted runs are
+   covered as well */
+static bool stats_table = false;
+static bool stats_json = false;
+static const char *stats_json_filename = NULL;	/* NULL: stderr, the way the table goes */
+
+static void report_stats(void)
+{
+	stats_phase(PHASE_NONE);
+
+	if (stats_table)
+		stats_print(stderr);
+
+	if (stats_json) {
+		FILE *f = stats_json_filename == NULL ? stderr :
+				strcmp(stats_json_filename, "-") == 0 ? stdout : fopen(stats_json_filename, "w");
+		if (f == NULL) {
+			fprintf(stderr, "can't open '%s' for writing: ", stats_json_filename);
+			perror(0);
+			return;
+		}
+		stats_print_json(f);
+		if (f != stdout && f != stderr)
+			fclose(f);
+	}
+}
+
+// ---------------------------------------------------------
+// --retries / --journal / --manifest: program one erase block
+// at a time, redo a failing block after reconnecting instead
+// of aborting and skip blocks that already hold the image
+// ---------------------------------------------------------
+
+struct block_job {
+	uint8_t *image;		/* NULL to only erase */
+	long size;
+	int offset;
+	int block_size;
+	bool verify;
+	bool inline_verify;
+	int inline_retries;
+};
+
+struct retry_entry {
+	int addr;
+	char what[64];
+};
+
+static struct retry_entry *retry_log = NULL;
+static int retry_log_len = 0;
+
+static uint8_t block_buffer[64 * 1024];
+
+/* Erase (optionally), program and verify the part of the image inside
+   the erase block at block_addr. Returns NULL on success, otherwise
+   what went wrong. */
+static const char *program_block(const struct block_job *job, int block_addr, bool erase)
+{
+	static char what[64];
+
+	int begin = block_addr > job->offset ? block_addr : job->offset;
+	int end = block_addr + job->block_size;
+	if (end > job->offset + job->size)
+		end = job->offset + job->size;
+
+	if (erase) {
+		stats_phase(PHASE_ERASE);
+		flash_erase_block(block_addr, job->block_size);
+		if (mpsse_get_error())
+			return "USB error during erase";
+		stats_add_bytes(job->block_size);
+		journal_record(block_addr, JOURNAL_ERASED);
+	}
+
+	if (job->image == NULL)
+		return NULL;
+
+	stats_phase(PHASE_PROGRAM);
+	for (int n, addr = begin; addr < end; addr += n) {
+		uint8_t *data = job->image + (addr - job->offset);
+		n = 256 - addr % 256;
+		if (n > end - addr)
+			n = end - addr;
+
+		log_progress(addr, 100 * (addr - job->offset) / job->size);
+		if (job->inline_verify) {
+			int rc = flash_prog_verify(addr, data, n, job->inline_retries);
+			if (mpsse_get_error())
+				return "USB error during program";
+			if (rc < 0) {
+				snprintf(what, sizeof(what), "difference at 0x%06X after programming", addr);
+				return what;
+			}
+		} else if (!flash_page_blank(data, n)) {
+			flash_write_enable();
+			flash_prog(addr, data, n);
+			if (flash_wait())
+				return "USB error during program";
+		}
+		stats_add_bytes(n);
+	}
+	journal_record(block_addr, JOURNAL_PROGRAMMED);
+
+	if (job->verify && !job->inline_verify && end > begin) {
+		stats_phase(PHASE_VERIFY);
+		if (flash_fast_read(begin, block_buffer, end - begin))
+			return "USB error during verify";
+		stats_add_bytes(end - begin);
+		const uint8_t *expected = job->image + (begin - job->offset);
+		for (int i = 0; i < end - begin; i++) {
+			if (block_buffer[i] != expected[i]) {
+				snprintf(what, sizeof(what), "difference at 0x%06X in verify", begin + i);
+				return what;
+			}
+		}
+	}
+	if (job->verify)
+		journal_record(block_addr, JOURNAL_VERIFIED);
+
+	return NULL;
+}
+
+/* Flashes without command 0x4B read back all zeros or all ones. Keying
+   files by that would make every such board share one journal, manifest
+   or health history, so the option is dropped for the board. An option
+   that writes the ID can't be dropped and is required instead. */
+static bool uid_usable(uint64_t uid, const char *option, bool required)
+{
+	if (uid != 0 && uid != ~(uint64_t)0)
+		return true;
+	fprintf(stderr, "%s: flash has no unique ID (%016llX), %s\n", option, (unsigned long long)uid,
+			required ? "not programming the same ID into every board" : "ignoring it");
+	return false;
+}
+
+/* Spot-verify a block the journal says is done: the run may have died
+   right after writing the record, or the board may have been touched
+   since. Without an image the block has to be erased. A USB error reads
+   as a mismatch, in recoverable mode the caller checks mpsse_get_error(). */
+static bool block_matches(const struct block_job *job, int block_addr)
+{
+	int begin = block_addr, end = block_addr + job->block_size;
+	if (job->image != NULL) {
+		begin = block_addr > job->offset ? block_addr : job->offset;
+		if (end > job->offset + job->size)
+			end = job->offset + job->size;
+	}
+
+	stats_phase(PHASE_VERIFY);
+	if (flash_fast_read(begin, block_buffer, end - begin))
+		return false;
+	stats_add_bytes(end - begin);
+
+	for (int i = 0; i < end - begin; i++) {
+		uint8_t expected = job->image != NULL ? job->image[begin - job->offset + i] : 0xff;
+		if (block_buffer[i] != expected)
+			return false;
+	}
+	return true;
+}
+
+/* Hash of an erase block as it ends up on the flash when programmed from
+   the erased state: the image, padded with 0xFF */
+static uint64_t image_block_hash(const struct block_job *job, int block_addr)
+{
+	int begin = block_addr > job->offset ? block_addr : job->offset;
+	int end = block_addr + job->block_size;
+	if (end > job->offset + job->size)
+		end = job->offset + job->size;
+
+	memset(block_buffer, 0xff, job->block_size);
+	if (job->image != NULL && end > begin)
+		memcpy(block_buffer + (begin - block_addr), job->image + (begin - job->offset), end - begin);
+	return hash_update(HASH_INIT, block_buffer, job->block_size);
+}
+
+static uint64_t flash_block_hash(int block_addr, int block_size)
+{
+	stats_phase(PHASE_VERIFY);
+	flash_fast_read(block_addr, block_buffer, block_size);
+	stats_add_bytes(block_size);
+	return hash_update(HASH_INIT, block_buffer, block_size);
+}
+
+/* Reopen the programmer and bring the flash back to the state it is in
+   after the reset phase. A different flash ID means the board changed,
+   which is not something to resume on. */
+static bool reconnect_flash(uint32_t jedec_id)
+{
+	stats_phase(PHASE_RESET);
+	if (!mpsse_reconnect())
+		return false;
+
+	flash_chip_deselect();
+	usleep(250000);
+	flash_reset();
+	flash_power_up();
+
+	uint32_t id = flash_read_id();
+	if (mpsse_get_error())
+		return false;
+	if (id != jedec_id) {
+		fprintf(stderr, "flash ID changed from 0x%06X to 0x%06X, not resuming.\n", jedec_id, id);
+		mpsse_error(2);
+	}
+	return true;
+}
+
+static void log_retry(int addr, const char *what)
+{
+	retry_log = realloc(retry_log, (retry_log_len + 1) * sizeof(*retry_log));
+	if (retry_log == NULL) {
+		fprintf(stderr, "Out of memory.\n");
+		mpsse_error(1);
+	}
+	retry_log[retry_log_len].addr = addr;
+	snprintf(retry_log[retry_log_len].what, sizeof(retry_log[0].what), "%s", what);
+	retry_log_len++;
+}
+
+// ---------------------------------------------------------
+// File I/O and hashing on a thread of their own, so that they
+// overlap the USB transfers instead of taking turns with them
+// ---------------------------------------------------------
+
+#define PIPE_SLOTS 8
+#define PIPE_SLOT_SIZE (64 * 1024)
+
+/* Flash reads per slot, small enough for steady progress at 50 kHz */
+#define PIPE_READ_CHUNK 4096
+
+struct file_pipe {
+	struct spsc *q;
+	struct thread thread;
+	FILE *f;
+	int first;		/* length of the first chunk read */
+	uint64_t hash;
+	bool failed;
+};
+
+/* Producer: fill the slots from the file. The first chunk can be
+   shortened so the rest start on a flash page. */
+static void file_reader(void *arg)
+{
+	struct file_pipe *p = arg;
+	for (int len = p->first; true; len = PIPE_SLOT_SIZE) {
+		struct spsc_slot *slot = spsc_acquire(p->q);
+		slot->len = fread(slot->data, 1, len, p->f);
+		if (slot->len <= 0) {
+			p->failed = ferror(p->f);
+			break;
+		}
+		p->hash = hash_update(p->hash, slot->data, slot->len);
+		spsc_publish(p->q);
+	}
+	spsc_close(p->q);
+}
+
+/* Consumer: write the slots to the file, keep draining after an error
+   so the USB side doesn't stall */
+static void file_writer(void *arg)
+{
+	struct file_pipe *p = arg;
+	struct spsc_slot *slot;
+	while ((slot = spsc_peek(p->q)) != NULL) {
+		if (!p->failed && fwrite(slot->data, 1, slot->len, p->f) != (size_t)slot->len)
+			p->failed = true;
+		p->hash = hash_update(p->hash, slot->data, slot->len);
+		spsc_release(p->q);
+	}
+}
+
+static void pipe_start(struct file_pipe *p, FILE *f, void (*fn)(void *arg), int first)
+{
+	p->q = spsc_new(PIPE_SLOTS, PIPE_SLOT_SIZE);
+	p->f = f;
+	p->first = first;
+	p->hash = HASH_INIT;
+	p->failed = false;
+	if (p->q == NULL || !thread_start(&p->thread, fn, p)) {
+		fprintf(stderr, "Can't start I/O thread.\n");
+		mpsse_error(1);
+	}
+}
+
+/* Wait for the thread, returns false if the file couldn't be read or
+   written */
+static bool pipe_finish(struct file_pipe *p)
+{
+	thread_join(&p->thread);
+
+	struct spsc_stats st;
+	spsc_get_stats(p->q, &st);
+	log_debug(LOG_MAIN, "pipeline: %llu chunks, hash %016llX", (unsigned long long)st.items,
+			(unsigned long long)p->hash);
+	log_debug(LOG_MAIN, "pipeline: producer waited %llu times (%.1f ms), consumer %llu times (%.1f ms)",
+			(unsigned long long)st.producer_stalls, st.producer_stall_us / 1000.0,
+			(unsigned long long)st.consumer_stalls, st.consumer_stall_us / 1000.0);
+
+	spsc_free(p->q);
+	return !p->failed;
+}
+
+// ---------------------------------------------------------
+// Input inspection
+// ---------------------------------------------------------
+
+static FILE *tmp_stream(const uint8_t *data, long size, const char *my_name)
+{
+	FILE *f = tmpfile();
+	if (f == NULL || fwrite(data, 1, size, f) != (size_t)size || fseek(f, 0L, SEEK_SET) != 0) {
+		fprintf(stderr, "%s: can't write to temporary file\n", my_name);
+		if (f != NULL)
+			fclose(f);
+		return NULL;
+	}
+	return f;
+}
+
+static uint8_t *read_stream(FILE *f, const char *my_name, long *size)
+{
+	long cap = 0, len = 0;
+	uint8_t *data = NULL;
+	while (true) {
+		if (len == cap) {
+			cap = cap ? 2 * cap : 1024 * 1024;
+			uint8_t *grown = realloc(data, cap);
+			if (grown == NULL) {
+				fprintf(stderr, "%s: out of memory\n", my_name);
+				free(data);
+				return NULL;
+			}
+			data = grown;
+		}
+		size_t rc = fread(data + len, 1, cap - len, f);
+		if (rc == 0)
+			break;
+		len += rc;
+	}
+	*size = len;
+	return data;
+}
+
+/* Report what kind of image data is, so that an image for the wrong
+   part is refused before anything is erased. Returns the number of
+   bytes to program, which with trim ends at the wakeup command, or -1
+   after an error. */
+static long check_image(const uint8_t *data, long len, const char *my_name,
+		const char *part, bool trim, bool need_bitstream)
+{
+	struct bitstream_info info;
+	bool is_bitstream = bitstream_parse(data, len, &info);
+	long keep = len;
+
+	if (is_bitstream && info.reboot && need_bitstream) {
+		fprintf(stderr, "%s: input is a warm boot image already\n", my_name);
+		return -1;
+	}
+
+	if (is_bitstream) {
+		if (info.reboot)
+			fprintf(stderr, "bitstream: warm boot header, images follow\n");
+		else
+			fprintf(stderr, "bitstream: %s (CRAM %dx%d), %ld of %ld bytes configuration data\n",
+					info.family ? info.family : "unknown part", info.width, info.height, info.end, len);
+		if (info.comment[0])
+			fprintf(stderr, "bitstream: %s\n", info.comment);
+		/* A warm boot header is followed by the images it points to */
+		if (trim && !info.reboot)
+			keep = info.end;
+	} else if (part != NULL || trim || need_bitstream) {
+		fprintf(stderr, "%s: input is not an iCE40 bitstream\n", my_name);
+		return -1;
+	}
+
+	if (part != NULL) {
+		int match = bitstream_part_matches(part, info.family);
+		if (match < 0) {
+			fprintf(stderr, "%s: unknown part `%s'\n", my_name, part);
+			return -1;
+		}
+		if (!match) {
+			fprintf(stderr, "%s: image is for %s, not %s\n", my_name,
+					info.family ? info.family : "an unknown part", part);
+			return -1;
+		}
+	}
+
+	return keep;
+}
+
+/* Check the input with check_image(). Returns the stream to use from
+   here on, rewound, or NULL after an error. */
+static FILE *inspect_input(FILE *f, const char *my_name, const char *part, bool trim, long *size)
+{
+	long len;
+	uint8_t *data = read_stream(f, my_name, &len);
+	if (data == NULL)
+		return NULL;
+
+	long keep = check_image(data, len, my_name, part, trim, false);
+	if (keep < 0) {
+		free(data);
+		return NULL;
+	}
+
+	/* Go on with the stream as it is if possible, pipes and trimmed
+	   images continue from a temporary copy */
+	if (keep == len && fseek(f, 0L, SEEK_SET) == 0) {
+		free(data);
+		*size = len;
+		return f;
+	}
+
+	FILE *copy = tmp_stream(data, keep, my_name);
+	if (copy == NULL) {
+		free(data);
+		return NULL;
+	}
+	if (f != stdin)
+		fclose(f);
+	if (keep < len)
+		fprintf(stderr, "trimmed %ld bytes of padding\n", len - keep);
+	free(data);
+	*size = keep;
+	return copy;
+}
+
+/* Build the --warmboot flash image from up to four bitstreams, each in
+   its own slot of erase blocks. Returns it as a stream or NULL after an
+   error. */
+static FILE *pack_warmboot(char *const files[], int n, const char *my_name, const char *part,
+		bool trim, int block_size, int slot_size, long *size)
+{
+	uint8_t *images[WARMBOOT_MAX_IMAGES];
+	long sizes[WARMBOOT_MAX_IMAGES];
+	long largest = 0;
+	FILE *packed = NULL;
+	int loaded = 0;
+
+	for (; loaded < n; loaded++) {
+		FILE *f = fopen(files[loaded], "rb");
+		if (f == NULL) {
+			fprintf(stderr, "%s: can't open '%s' for reading: ", my_name, files[loaded]);
+			perror(0);
+			goto out;
+		}
+		images[loaded] = read_stream(f, my_name, &sizes[loaded]);
+		fclose(f);
+		if (images[loaded] == NULL)
+			goto out;
+
+		fprintf(stderr, "slot %d: %s\n", loaded, files[loaded]);
+		sizes[loaded] = check_image(images[loaded], sizes[loaded], my_name, part, trim, true);
+		if (sizes[loaded] < 0) {
+			free(images[loaded]);
+			goto out;
+		}
+		if (sizes[loaded] > largest)
+			largest = sizes[loaded];
+	}
+
+	if (slot_size == 0)
+		slot_size = (largest + block_size - 1) & ~(block_size - 1);
+	if (slot_size % block_size != 0 || slot_size < largest) {
+		fprintf(stderr, "%s: slot size must be a multiple of the %d kB erase block and fit %ld bytes\n",
+				my_name, block_size >> 10, largest);
+		goto out;
+	}
+
+	uint8_t *data = warmboot_pack((const uint8_t *const *)images, sizes, n, block_size, slot_size, size);
+	if (data == NULL) {
+		fprintf(stderr, "%s: out of memory\n", my_name);
+		goto out;
+	}
+
+	fprintf(stderr, "warmboot: headers at 0x000000, %d kB slots\n", slot_size >> 10);
+	for (int i = 0; i < n; i++)
+		fprintf(stderr, "  slot %d at 0x%06X, %ld bytes\n", i, block_size + i * slot_size, sizes[i]);
 
-static bool verbose = false;
+	packed = tmp_stream(data, *size, my_name);
+	free(data);
+
+out:
+	for (int i = 0; i < loaded; i++)
+		free(images[i]);
+	return packed;
+}
+
+/* getopt_long() return values for options without a short form */
+enum long_option {
+	OPT_HELP = -2,
+	OPT_SCAN = -3,
+	OPT_STATS = -4,
+	OPT_STATS_JSON = -5,
+	OPT_TRACE = -6,
+	OPT_TRACE_HASH = -7,
+	OPT_PROBE = -8,
+	OPT_PROBE_SAVE = -9,
+	OPT_PROFILE = -10,
+	OPT_READ_CHUNK = -11,
+	OPT_WRITE_CHUNK = -12,
+	OPT_INLINE_VERIFY = -13,
+	OPT_RETRIES = -14,
+	OPT_JOURNAL = -15,
+	OPT_MANIFEST = -16,
+	OPT_MANIFEST_SAMPLE = -17,
+	OPT_MAX_DIFFS = -18,
+	OPT_VERIFY_SAMPLE = -19,
+	OPT_TRIM = -20,
+	OPT_PART = -21,
+	OPT_WARMBOOT = -22,
+	OPT_SLOT_SIZE = -23,
+	OPT_PATCH = -24,
+	OPT_CSV_ROW = -25,
+	OPT_LOG = -26,
+	OPT_LOG_DUMP = -27,
+	OPT_STATION = -28,
+	OPT_JOB = -29,
+	OPT_PLAN = -30,
+	OPT_METRICS_FILE = -31,
+	OPT_HEALTH = -32,
+	OPT_HEALTH_FACTOR = -33,
+};
 
 int main(int argc, char **argv)
 {
@@ -53,11 +597,16 @@ int main(int argc, char **argv)
 			my_name = argv[0] + i + 1;
 
 	int read_size = 256 * 1024;
+	int scan_size = 0;
 	int erase_block_size = 64;
 	int erase_size = 0;
 	int rw_offset = 0;
+	int read_chunk = 0;
+	int write_chunk = 0;
 
 	bool read_mode = false;
+	bool scan_mode = false;
+	bool probe_mode = false;
 	bool check_mode = false;
 	bool erase_mode = false;
 	bool bulk_erase = false;
@@ -67,9 +616,33 @@ int main(int argc, char **argv)
 	bool slow_clock = false;
 	bool disable_protect = false;
 	bool disable_verify = false;
+	bool inline_verify = false;
+	int inline_retries = 2;
+	int retries = 0;
+	const char *journal_dir = NULL;
+	const char *manifest_dir = NULL;
+	int manifest_sample = 2;
+	const char *health_dir = NULL;
+	double health_factor = 2.0;
+	long max_diffs = 0;
+	double verify_sample = 0.0;
+	uint64_t verify_seed = 0;
+	bool verify_seed_set = false;
+	bool trim = false;
+	const char *part = NULL;
+	bool warmboot = false;
+	int slot_size = 0;
+	int station_ports = 0;
+	const char *job_filename = NULL;
+	const char *plan_spec = NULL;
 	bool disable_powerdown = false;
 	const char *filename = NULL;
 	const char *devstr = NULL;
+	const char *trace_filename = NULL;
+	bool trace_hash = false;
+	const char *probe_save_filename = NULL;
+	const char *profile_filename = NULL;
+	const char *metrics_filename = NULL;
 	int ifnum = 0;
 
 #ifdef _WIN32
@@ -78,7 +651,38 @@ int main(int argc, char **argv)
 #endif
 
 	static struct option long_options[] = {
-		{"help", no_argument, NULL, -2},
+		{"help", no_argument, NULL, OPT_HELP},
+		{"scan", optional_argument, NULL, OPT_SCAN},
+		{"stats", no_argument, NULL, OPT_STATS},
+		{"stats-json", optional_argument, NULL, OPT_STATS_JSON},
+		{"trace", required_argument, NULL, OPT_TRACE},
+		{"trace-hash", no_argument, NULL, OPT_TRACE_HASH},
+		{"probe", no_argument, NULL, OPT_PROBE},
+		{"probe-save", required_argument, NULL, OPT_PROBE_SAVE},
+		{"profile", required_argument, NULL, OPT_PROFILE},
+		{"read-chunk", required_argument, NULL, OPT_READ_CHUNK},
+		{"write-chunk", required_argument, NULL, OPT_WRITE_CHUNK},
+		{"inline-verify", optional_argument, NULL, OPT_INLINE_VERIFY},
+		{"retries", required_argument, NULL, OPT_RETRIES},
+		{"journal", required_argument, NULL, OPT_JOURNAL},
+		{"manifest", required_argument, NULL, OPT_MANIFEST},
+		{"manifest-sample", required_argument, NULL, OPT_MANIFEST_SAMPLE},
+		{"max-diffs", required_argument, NULL, OPT_MAX_DIFFS},
+		{"verify-sample", required_argument, NULL, OPT_VERIFY_SAMPLE},
+		{"trim", no_argument, NULL, OPT_TRIM},
+		{"part", required_argument, NULL, OPT_PART},
+		{"warmboot", no_argument, NULL, OPT_WARMBOOT},
+		{"slot-size", required_argument, NULL, OPT_SLOT_SIZE},
+		{"patch", required_argument, NULL, OPT_PATCH},
+		{"csv-row", required_argument, NULL, OPT_CSV_ROW},
+		{"log", required_argument, NULL, OPT_LOG},
+		{"log-dump", required_argument, NULL, OPT_LOG_DUMP},
+		{"station", optional_argument, NULL, OPT_STATION},
+		{"job", required_argument, NULL, OPT_JOB},
+		{"plan", optional_argument, NULL, OPT_PLAN},
+		{"metrics-file", required_argument, NULL, OPT_METRICS_FILE},
+		{"health", required_argument, NULL, OPT_HEALTH},
+		{"health-factor", required_argument, NULL, OPT_HEALTH_FACTOR},
 		{NULL, 0, NULL, 0}
 	};
 
@@ -179,7 +783,7 @@ int main(int argc, char **argv)
 			test_mode = 2;
 			break;
 		case 'v': /* provide verbose output */
-			verbose = true;
+			log_set_all(LOG_DEBUG);
 			break;
 		case 's': /* use slow SPI clock */
 			slow_clock = true;
@@ -193,7 +797,189 @@ int main(int argc, char **argv)
 		case 'k': /* disable power down command */
 			disable_powerdown = true;
 			break;
-		case -2:
+		case OPT_SCAN: /* map used sectors of the flash */
+			scan_mode = true;
+			if (optarg == NULL)
+				break;
+			scan_size = strtol(optarg, &endptr, 0);
+			if (*endptr == '\0')
+				/* ok */;
+			else if (!strcmp(endptr, "k"))
+				scan_size *= 1024;
+			else if (!strcmp(endptr, "M"))
+				scan_size *= 1024 * 1024;
+			else {
+				fprintf(stderr, "%s: `%s' is not a valid size\n", my_name, optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case OPT_STATS: /* print per-phase statistics */
+			stats_table = true;
+			break;
+		case OPT_STATS_JSON: /* write per-phase statistics as JSON */
+			stats_json = true;
+			stats_json_filename = optarg;
+			break;
+		case OPT_TRACE: /* record USB traffic */
+			trace_filename = optarg;
+			break;
+		case OPT_TRACE_HASH: /* only store hashes of written data */
+			trace_hash = true;
+			break;
+		case OPT_PROBE: /* measure USB latency and throughput */
+			probe_mode = true;
+			break;
+		case OPT_PROBE_SAVE: /* probe and save the result as a profile */
+			probe_mode = true;
+			probe_save_filename = optarg;
+			break;
+		case OPT_PROFILE: /* apply USB settings saved by --probe-save */
+			profile_filename = optarg;
+			break;
+		case OPT_READ_CHUNK: /* libftdi read chunk size */
+		case OPT_WRITE_CHUNK: /* libftdi write chunk and coalescing size */
+			{
+				int chunk = strtol(optarg, &endptr, 0);
+				if (*endptr == 'k') {
+					chunk *= 1024;
+					endptr++;
+				}
+				if (*endptr != '\0' || chunk < 64 || chunk > 65536) {
+					fprintf(stderr, "%s: chunk size `%s' must be between 64 and 64k\n", my_name, optarg);
+					return EXIT_FAILURE;
+				}
+				if (opt == OPT_READ_CHUNK)
+					read_chunk = chunk;
+				else
+					write_chunk = chunk;
+			}
+			break;
+		case OPT_INLINE_VERIFY: /* read back every page right after programming it */
+			inline_verify = true;
+			if (optarg == NULL)
+				break;
+			inline_retries = strtol(optarg, &endptr, 0);
+			if (*endptr != '\0' || inline_retries < 0) {
+				fprintf(stderr, "%s: `%s' is not a valid retry count\n", my_name, optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case OPT_RETRIES: /* redo failing erase blocks */
+			retries = strtol(optarg, &endptr, 0);
+			if (*endptr != '\0' || retries < 0) {
+				fprintf(stderr, "%s: `%s' is not a valid retry count\n", my_name, optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case OPT_JOURNAL: /* resumable block-wise programming */
+			journal_dir = optarg;
+			break;
+		case OPT_MANIFEST: /* skip blocks that are up to date */
+			manifest_dir = optarg;
+			break;
+		case OPT_MANIFEST_SAMPLE:
+			manifest_sample = strtol(optarg, &endptr, 0);
+			if (*endptr != '\0' || manifest_sample < 0) {
+				fprintf(stderr, "%s: `%s' is not a valid sample size\n", my_name, optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case OPT_MAX_DIFFS: /* stop comparing early */
+			max_diffs = strtol(optarg, &endptr, 0);
+			if (*endptr != '\0' || max_diffs < 0) {
+				fprintf(stderr, "%s: `%s' is not a valid difference count\n", my_name, optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case OPT_VERIFY_SAMPLE: /* verify only some pages */
+			verify_sample = strtod(optarg, &endptr);
+			if (*endptr == ',') {
+				verify_seed = strtoull(endptr + 1, &endptr, 0);
+				verify_seed_set = true;
+			}
+			if (*endptr != '\0' || !(verify_sample > 0.0 && verify_sample <= 100.0)) {
+				fprintf(stderr, "%s: `%s' is not a valid sample, expected <percent>[,<seed>]\n", my_name, optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case OPT_TRIM: /* drop padding after the configuration data */
+			trim = true;
+			break;
+		case OPT_PART: /* refuse images for other parts */
+			part = optarg;
+			break;
+		case OPT_WARMBOOT: /* pack several images */
+			warmboot = true;
+			break;
+		case OPT_PATCH: /* per-board data */
+			if (!patch_add(optarg))
+				return EXIT_FAILURE;
+			break;
+		case OPT_CSV_ROW: {
+			int row = strtol(optarg, &endptr, 0);
+			if (*endptr != '\0' || row <= 0) {
+				fprintf(stderr, "%s: `%s' is not a valid row number\n", my_name, optarg);
+				return EXIT_FAILURE;
+			}
+			patch_set_csv_row(row);
+			break;
+		}
+		case OPT_LOG: /* per-category log levels */
+			if (!log_configure(optarg)) {
+				fprintf(stderr, "%s: `%s' is not a valid log level spec\n", my_name, optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case OPT_LOG_DUMP: /* bytes shown per hex dump */
+			log_dump_limit = strtol(optarg, &endptr, 0);
+			if (*endptr != '\0' || log_dump_limit < -1) {
+				fprintf(stderr, "%s: `%s' is not a valid byte count\n", my_name, optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case OPT_STATION: /* program boards as they are plugged in */
+			station_ports = 1;
+			if (optarg != NULL) {
+				station_ports = strtol(optarg, &endptr, 0);
+				if (*endptr != '\0' || station_ports <= 0) {
+					fprintf(stderr, "%s: `%s' is not a valid number of ports\n", my_name, optarg);
+					return EXIT_FAILURE;
+				}
+			}
+			break;
+		case OPT_JOB: /* run a job file */
+			job_filename = optarg;
+			break;
+		case OPT_PLAN: /* estimate without hardware */
+			plan_spec = optarg != NULL ? optarg : "";
+			break;
+		case OPT_METRICS_FILE: /* counters for node_exporter */
+			metrics_filename = optarg;
+			break;
+		case OPT_HEALTH: /* per-sector busy time history */
+			health_dir = optarg;
+			break;
+		case OPT_HEALTH_FACTOR:
+			health_factor = strtod(optarg, &endptr);
+			if (*endptr != '\0' || !(health_factor > 1.0)) {
+				fprintf(stderr, "%s: `%s' is not a valid factor, must be above 1\n", my_name, optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case OPT_SLOT_SIZE:
+			slot_size = strtol(optarg, &endptr, 0);
+			if (*endptr == '\0')
+				/* ok */;
+			else if (!strcmp(endptr, "k"))
+				slot_size *= 1024;
+			else if (!strcmp(endptr, "M"))
+				slot_size *= 1024 * 1024;
+			else {
+				fprintf(stderr, "%s: `%s' is not a valid size\n", my_name, optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case OPT_HELP:
 			help(argv[0]);
 			return EXIT_SUCCESS;
 		default:
@@ -205,8 +991,16 @@ int main(int argc, char **argv)
 
 	/* Make sure that the combination of provided parameters makes sense */
 
-	if (read_mode + erase_mode + check_mode + prog_sram + !!test_mode > 1) {
-		fprintf(stderr, "%s: options `-r'/`-R', `-e`, `-c', `-S', and `-t' are mutually exclusive\n", my_name);
+	if (read_mode + erase_mode + check_mode + prog_sram + !!test_mode + scan_mode + probe_mode > 1) {
+		fprintf(stderr, "%s: options `-r'/`-R', `-e`, `-c', `-S', `-t', `--scan' and `--probe' are mutually exclusive\n", my_name);
+		return EXIT_FAILURE;
+	}
+
+	if (job_filename != NULL && (read_mode || erase_mode || check_mode || prog_sram || test_mode ||
+			scan_mode || probe_mode || bulk_erase || dont_erase || disable_protect || inline_verify ||
+			retries || journal_dir != NULL || manifest_dir != NULL || verify_sample > 0.0 || trim ||
+			part != NULL || warmboot || patch_active() || station_ports || rw_offset != 0)) {
+		fprintf(stderr, "%s: option `--job' can't be combined with other modes or `-o'\n", my_name);
 		return EXIT_FAILURE;
 	}
 
@@ -215,17 +1009,17 @@ int main(int argc, char **argv)
 		return EXIT_FAILURE;
 	}
 
-	if (disable_protect && (read_mode || check_mode || prog_sram || test_mode)) {
+	if (disable_protect && (read_mode || check_mode || prog_sram || test_mode || scan_mode || probe_mode)) {
 		fprintf(stderr, "%s: option `-p' only valid in programming mode\n", my_name);
 		return EXIT_FAILURE;
 	}
 
-	if (bulk_erase && (read_mode || check_mode || prog_sram || test_mode)) {
+	if (bulk_erase && (read_mode || check_mode || prog_sram || test_mode || scan_mode || probe_mode)) {
 		fprintf(stderr, "%s: option `-b' only valid in programming mode\n", my_name);
 		return EXIT_FAILURE;
 	}
 
-	if (dont_erase && (read_mode || check_mode || prog_sram || test_mode)) {
+	if (dont_erase && (read_mode || check_mode || prog_sram || test_mode || scan_mode || probe_mode)) {
 		fprintf(stderr, "%s: option `-n' only valid in programming mode\n", my_name);
 		return EXIT_FAILURE;
 	}
@@ -240,9 +1034,120 @@ int main(int argc, char **argv)
 		return EXIT_FAILURE;
 	}
 
-	if (optind + 1 == argc) {
-		if (test_mode) {
-			fprintf(stderr, "%s: test mode doesn't take a file name\n", my_name);
+	if (inline_verify && (read_mode || erase_mode || check_mode || prog_sram || test_mode || scan_mode || probe_mode)) {
+		fprintf(stderr, "%s: option `--inline-verify' only valid in programming mode\n", my_name);
+		return EXIT_FAILURE;
+	}
+
+	if (retries && (read_mode || check_mode || prog_sram || test_mode || scan_mode || probe_mode)) {
+		fprintf(stderr, "%s: option `--retries' only valid in programming and erase mode\n", my_name);
+		return EXIT_FAILURE;
+	}
+
+	if (journal_dir != NULL && (read_mode || check_mode || prog_sram || test_mode || scan_mode || probe_mode)) {
+		fprintf(stderr, "%s: option `--journal' only valid in programming and erase mode\n", my_name);
+		return EXIT_FAILURE;
+	}
+
+	if (manifest_dir != NULL && (read_mode || erase_mode || check_mode || prog_sram || test_mode || scan_mode || probe_mode)) {
+		fprintf(stderr, "%s: option `--manifest' only valid in programming mode\n", my_name);
+		return EXIT_FAILURE;
+	}
+
+	if (verify_sample > 0.0 && (read_mode || erase_mode || prog_sram || test_mode || scan_mode || probe_mode)) {
+		fprintf(stderr, "%s: option `--verify-sample' only valid in programming and check mode\n", my_name);
+		return EXIT_FAILURE;
+	}
+
+	if (verify_sample > 0.0 && (inline_verify || disable_verify)) {
+		fprintf(stderr, "%s: option `--verify-sample' can't be combined with `--inline-verify' or `-X'\n", my_name);
+		return EXIT_FAILURE;
+	}
+
+	if ((trim || part != NULL) && (read_mode || erase_mode || test_mode || scan_mode || probe_mode)) {
+		fprintf(stderr, "%s: options `--trim' and `--part' need an image to program or check\n", my_name);
+		return EXIT_FAILURE;
+	}
+
+	if (warmboot && (read_mode || erase_mode || prog_sram || test_mode || scan_mode || probe_mode)) {
+		fprintf(stderr, "%s: option `--warmboot' only valid in programming and check mode\n", my_name);
+		return EXIT_FAILURE;
+	}
+
+	if (warmboot && rw_offset != 0) {
+		fprintf(stderr, "%s: option `-o' not supported with `--warmboot', the headers go at 0\n", my_name);
+		return EXIT_FAILURE;
+	}
+
+	if (patch_active() && (read_mode || erase_mode || check_mode || prog_sram || test_mode || scan_mode || probe_mode)) {
+		fprintf(stderr, "%s: option `--patch' only valid in programming mode\n", my_name);
+		return EXIT_FAILURE;
+	}
+
+	if (station_ports && (read_mode || test_mode || scan_mode || probe_mode)) {
+		fprintf(stderr, "%s: option `--station' only valid in programming, erase and check mode\n", my_name);
+		return EXIT_FAILURE;
+	}
+
+	if (station_ports && trace_filename != NULL) {
+		fprintf(stderr, "%s: options `--station' and `--trace' are mutually exclusive\n", my_name);
+		return EXIT_FAILURE;
+	}
+
+	int station_vendor = 0, station_product = 0;
+	if (station_ports && devstr != NULL) {
+		int end = 0;
+		if (sscanf(devstr, "i:%i:%i%n", &station_vendor, &station_product, &end) != 2 || devstr[end] != '\0') {
+			fprintf(stderr, "%s: `--station' only takes `-d i:<vendor>:<product>'\n", my_name);
+			return EXIT_FAILURE;
+		}
+	}
+
+	/* Counters must go up one board at a time */
+	if (station_ports > 1 && patch_active()) {
+		fprintf(stderr, "%s: `--patch' with `--station', programming one board at a time\n", my_name);
+		station_ports = 1;
+	}
+
+	if (health_dir != NULL && (read_mode || check_mode || prog_sram || test_mode || scan_mode || probe_mode)) {
+		fprintf(stderr, "%s: option `--health' only valid in programming, erase and job mode\n", my_name);
+		return EXIT_FAILURE;
+	}
+
+	if (plan_spec != NULL && (read_mode || check_mode || prog_sram || test_mode || scan_mode || probe_mode ||
+			job_filename != NULL || station_ports || verify_sample > 0.0)) {
+		fprintf(stderr, "%s: option `--plan' only valid in programming and erase mode\n", my_name);
+		return EXIT_FAILURE;
+	}
+
+	if (slot_size != 0 && !warmboot) {
+		fprintf(stderr, "%s: option `--slot-size' only valid with `--warmboot'\n", my_name);
+		return EXIT_FAILURE;
+	}
+
+	if (inline_verify && disable_verify) {
+		fprintf(stderr, "%s: options `--inline-verify' and `-X' are mutually exclusive\n", my_name);
+		return EXIT_FAILURE;
+	}
+
+	if (profile_filename != NULL && probe_mode) {
+		fprintf(stderr, "%s: options `--profile' and `--probe' are mutually exclusive\n", my_name);
+		return EXIT_FAILURE;
+	}
+
+	/* These work one erase block at a time and verify as they go */
+	bool block_mode = retries > 0 || journal_dir != NULL || manifest_dir != NULL || warmboot || patch_active();
+
+	if (warmboot) {
+		if (optind == argc || argc - optind > WARMBOOT_MAX_IMAGES) {
+			fprintf(stderr, "%s: `--warmboot' takes 1 to %d bitstreams\n", my_name, WARMBOOT_MAX_IMAGES);
+			fprintf(stderr, "Try `%s --help' for more information.\n", argv[0]);
+			return EXIT_FAILURE;
+		}
+	} else if (optind + 1 == argc) {
+		if (test_mode || scan_mode || probe_mode || job_filename != NULL) {
+			fprintf(stderr, "%s: %s mode doesn't take a file name\n", my_name,
+					test_mode ? "test" : scan_mode ? "scan" : probe_mode ? "probe" : "job");
 			fprintf(stderr, "Try `%s --help' for more information.\n", argv[0]);
 			return EXIT_FAILURE;
 		}
@@ -253,20 +1158,35 @@ int main(int argc, char **argv)
 		return EXIT_FAILURE;
 	} else if (bulk_erase || disable_protect) {
 		filename = "/dev/null";
-	} else if (!test_mode && !erase_mode && !disable_protect) {
+	} else if (!test_mode && !scan_mode && !probe_mode && !erase_mode && !disable_protect && job_filename == NULL) {
 		fprintf(stderr, "%s: missing argument\n", my_name);
 		fprintf(stderr, "Try `%s --help' for more information.\n", argv[0]);
 		return EXIT_FAILURE;
 	}
 
+	/* From here on a run that stops early counts as a failed job. A
+	   station only counts its boards, and a plan isn't a run at all. */
+	if (metrics_filename != NULL && !station_ports && plan_spec == NULL)
+		metrics_enable(metrics_filename);
+
 	/* open input/output file in advance
 	   so we can fail before initializing the hardware */
 
 	FILE *f = NULL;
 	long file_size = -1;
+	struct job *job = NULL;
 
-	if (test_mode) {
+	if (test_mode || scan_mode || probe_mode) {
 		/* nop */;
+	} else if (job_filename != NULL) {
+		job = job_load(job_filename, erase_block_size << 10, my_name);
+		if (job == NULL)
+			return EXIT_FAILURE;
+	} else if (warmboot) {
+		f = pack_warmboot(argv + optind, argc - optind, my_name, part, trim,
+				erase_block_size << 10, slot_size, &file_size);
+		if (f == NULL)
+			return EXIT_FAILURE;
 	} else if (erase_mode) {
 		file_size = erase_size;
 	} else if (read_mode) {
@@ -336,23 +1256,134 @@ int main(int argc, char **argv)
 				fseek(f, 0, SEEK_SET);
 			}
 		}
+
+		long image_size;
+		f = inspect_input(f, my_name, part, trim, &image_size);
+		if (f == NULL)
+			return EXIT_FAILURE;
+		if (!prog_sram)
+			file_size = image_size;
+	}
+
+	if (patch_active() && !patch_prepare())
+		return EXIT_FAILURE;
+
+	if (plan_spec != NULL) {
+		uint8_t *image = NULL;
+		if (f != NULL) {
+			image = read_stream(f, my_name, &file_size);
+			if (image == NULL)
+				return EXIT_FAILURE;
+			if (f != stdin)
+				fclose(f);
+		}
+
+		struct plan_settings settings = {
+			.offset = rw_offset,
+			.block_size = erase_block_size << 10,
+			.bulk_erase = bulk_erase,
+			.dont_erase = dont_erase,
+			.verify = !disable_verify && !erase_mode,
+			.inline_verify = inline_verify,
+			.block_mode = block_mode,
+			.delta = warmboot || patch_active(),
+			.slow_clock = slow_clock,
+			.read_chunk = read_chunk,
+			.write_chunk = write_chunk,
+		};
+		bool ok = plan_run(plan_spec, image, file_size, &settings, my_name);
+		free(image);
+		return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+
+	if (station_ports) {
+		/* The image stays in memory, every board reads its own stream
+		   of it */
+		uint8_t *image = NULL;
+		long image_len = 0;
+		if (f != NULL) {
+			image = read_stream(f, my_name, &image_len);
+			if (image == NULL)
+				return EXIT_FAILURE;
+			if (f != stdin)
+				fclose(f);
+		}
+
+		devstr = station_run(station_vendor, station_product, station_ports, my_name);
+		if (devstr == NULL)
+			return EXIT_FAILURE;
+
+		/* Only the child for one board gets here */
+		if (metrics_filename != NULL)
+			metrics_enable(metrics_filename);
+		if (image != NULL) {
+#ifdef _WIN32
+			f = tmp_stream(image, image_len, my_name);
+#else
+			f = image_len > 0 ? fmemopen(image, image_len, "rb") : tmp_stream(image, 0, my_name);
+#endif
+			if (f == NULL)
+				return EXIT_FAILURE;
+		}
+
+		/* Pick up the counters as the previous board left them */
+		if (patch_active() && !patch_prepare())
+			return EXIT_FAILURE;
 	}
 
 	// ---------------------------------------------------------
 	// Initialize USB connection to FT2232H
 	// ---------------------------------------------------------
 
+	struct probe_profile profile;
+	if (profile_filename != NULL && !probe_profile_load(profile_filename, &profile)) {
+		fprintf(stderr, "%s: can't read profile '%s'\n", my_name, profile_filename);
+		return EXIT_FAILURE;
+	}
+
+	if (trace_filename != NULL && !trace_record_open(trace_filename, trace_hash)) {
+		fprintf(stderr, "%s: can't open '%s' for writing: ", my_name, trace_filename);
+		perror(0);
+		return EXIT_FAILURE;
+	}
+
+	if (stats_table || stats_json)
+		atexit(report_stats);
+
 	fprintf(stderr, "init..\n");
 
+	stats_phase(PHASE_INIT);
 	mpsse_init(ifnum, devstr, slow_clock);
+	if (profile_filename != NULL)
+		probe_profile_apply(&profile);
+	if (read_chunk || write_chunk)
+		mpsse_set_chunksize(read_chunk, write_chunk);
+	if (metrics_filename != NULL)
+		metrics_set_serial(mpsse_get_serial());
 
 	fprintf(stderr, "cdone: %s\n", get_cdone() ? "high" : "low");
 
 	flash_release_reset();
 	usleep(100000);
 
-	if (test_mode)
+	if (probe_mode)
 	{
+		/* flash_release_reset() left CS high, loopback traffic doesn't
+		   reach the flash */
+		probe_run(stderr, &profile);
+
+		if (probe_save_filename != NULL) {
+			if (!probe_profile_save(probe_save_filename, &profile)) {
+				fprintf(stderr, "%s: can't write profile '%s': ", my_name, probe_save_filename);
+				perror(0);
+				mpsse_error(1);
+			}
+			fprintf(stderr, "profile saved to '%s'\n", probe_save_filename);
+		}
+	}
+	else if (test_mode)
+	{
+		stats_phase(PHASE_RESET);
 		fprintf(stderr, "reset..\n");
 
 		flash_chip_deselect();
@@ -363,11 +1394,13 @@ int main(int argc, char **argv)
 		flash_reset();
 		flash_power_up();
 
+		stats_phase(PHASE_ID);
 		if (test_mode == 1)
 			flash_read_id();
 		else
 			flash_enable_quad();
 
+		stats_phase(PHASE_SHUTDOWN);
 		flash_power_down();
 
 		flash_release_reset();
@@ -375,12 +1408,49 @@ int main(int argc, char **argv)
 
 		fprintf(stderr, "cdone: %s\n", get_cdone() ? "high" : "low");
 	}
+	else if (job != NULL)
+	{
+		stats_phase(PHASE_RESET);
+		fprintf(stderr, "reset..\n");
+
+		flash_chip_deselect();
+		usleep(250000);
+
+		fprintf(stderr, "cdone: %s\n", get_cdone() ? "high" : "low");
+
+		flash_reset();
+		flash_power_up();
+
+		stats_phase(PHASE_ID);
+		uint32_t jedec_id = flash_read_id();
+		if (health_dir != NULL) {
+			uint64_t uid = flash_read_uid();
+			if (uid_usable(uid, "--health", false) && !health_open(health_dir, uid, jedec_id, health_factor))
+				mpsse_error(1);
+		}
+
+		int rc = job_run(job, !disable_verify);
+		job_free(job);
+
+		stats_phase(PHASE_SHUTDOWN);
+		if (!disable_powerdown)
+			flash_power_down();
+
+		flash_release_reset();
+		usleep(250000);
+
+		if (rc)
+			mpsse_error(rc);
+
+		fprintf(stderr, "cdone: %s\n", get_cdone() ? "high" : "low");
+	}
 	else if (prog_sram)
 	{
 		// ---------------------------------------------------------
 		// Reset
 		// ---------------------------------------------------------
 
+		stats_phase(PHASE_RESET);
 		fprintf(stderr, "reset..\n");
 
 		sram_reset();
@@ -396,20 +1466,27 @@ int main(int argc, char **argv)
 		// Program
 		// ---------------------------------------------------------
 
+		stats_phase(PHASE_SRAM);
 		fprintf(stderr, "programming..\n");
-		while (1) {
-			static unsigned char buffer[4096];
-			int rc = fread(buffer, 1, 4096, f);
-			if (rc <= 0)
-				break;
-			if (verbose)
-				fprintf(stderr, "sending %d bytes.\n", rc);
-			mpsse_send_spi(buffer, rc);
+		struct file_pipe pipe;
+		struct spsc_slot *slot;
+		pipe_start(&pipe, f, file_reader, PIPE_SLOT_SIZE);
+		while ((slot = spsc_peek(pipe.q)) != NULL) {
+			log_debug(LOG_MAIN, "sending %d bytes.", slot->len);
+			mpsse_send_spi(slot->data, slot->len);
+			stats_add_bytes(slot->len);
+			spsc_release(pipe.q);
+		}
+		if (!pipe_finish(&pipe)) {
+			fprintf(stderr, "Can't read input file.\n");
+			mpsse_error(1);
 		}
 
 		mpsse_send_dummy_bytes(6);
 		mpsse_send_dummy_bit();
 
+		stats_phase(PHASE_SHUTDOWN);
+
 		fprintf(stderr, "cdone: %s\n", get_cdone() ? "high" : "low");
 	}
 	else /* program flash */
@@ -418,6 +1495,7 @@ int main(int argc, char **argv)
 		// Reset
 		// ---------------------------------------------------------
 
+		stats_phase(PHASE_RESET);
 		fprintf(stderr, "reset..\n");
 
 		flash_chip_deselect();
@@ -428,14 +1506,279 @@ int main(int argc, char **argv)
 		flash_reset();
 		flash_power_up();
 
-		flash_read_id();
-
+		stats_phase(PHASE_ID);
+		uint32_t jedec_id = flash_read_id();
+		if (health_dir != NULL) {
+			uint64_t uid = flash_read_uid();
+			if (uid_usable(uid, "--health", false) && !health_open(health_dir, uid, jedec_id, health_factor))
+				mpsse_error(1);
+		}
 
 		// ---------------------------------------------------------
 		// Program
 		// ---------------------------------------------------------
 
-		if (!read_mode && !check_mode)
+		if (block_mode && !read_mode && !check_mode && !scan_mode)
+		{
+			if (disable_protect)
+			{
+				flash_write_enable();
+				flash_disable_protection();
+			}
+
+			struct block_job job = {
+				.image = NULL,
+				.size = file_size,
+				.offset = rw_offset,
+				.block_size = erase_block_size << 10,
+				.verify = !disable_verify && verify_sample == 0.0,
+				.inline_verify = inline_verify,
+				.inline_retries = inline_retries,
+			};
+
+			if (!erase_mode) {
+				job.image = malloc(file_size > 0 ? file_size : 1);
+				if (job.image == NULL || (long)fread(job.image, 1, file_size, f) != file_size) {
+					fprintf(stderr, "Can't read %ld bytes of input file.\n", file_size);
+					mpsse_error(1);
+				}
+			}
+
+			uint64_t uid = journal_dir != NULL || manifest_dir != NULL || patch_active() ? flash_read_uid() : 0;
+			if (journal_dir != NULL && !uid_usable(uid, "--journal", false))
+				journal_dir = NULL;
+			if (manifest_dir != NULL && !uid_usable(uid, "--manifest", false))
+				manifest_dir = NULL;
+			if (patch_needs_uid() && !uid_usable(uid, "--patch", true))
+				mpsse_error(1);
+			if (patch_active()) {
+				long flash_size = flash_size_from_id(jedec_id);
+				if (!patch_apply(&job.image, &job.size, uid, flash_size > rw_offset ? flash_size - rw_offset : 0))
+					mpsse_error(1);
+				file_size = job.size;
+			}
+
+			int block_mask = job.block_size - 1;
+			int begin_addr = rw_offset & ~block_mask;
+			int end_addr = (rw_offset + file_size + block_mask) & ~block_mask;
+			int n_blocks = (end_addr - begin_addr) / job.block_size;
+			bool keep_blocks = false;
+
+			if (journal_dir != NULL) {
+				uint64_t image_hash = hash_update(HASH_INIT, job.image, job.image ? file_size : 0);
+				enum journal_state done_state = erase_mode ? JOURNAL_ERASED :
+						job.verify ? JOURNAL_VERIFIED : JOURNAL_PROGRAMMED;
+				int done = journal_open(journal_dir, mpsse_get_serial(), uid,
+						image_hash, file_size, rw_offset, job.block_size, done_state);
+				if (done < 0)
+					mpsse_error(1);
+
+				keep_blocks = done > 0 || journal_bulk_erased();
+				if (done > 0) {
+					fprintf(stderr, "journal: %d of %d blocks already done\n", done, n_blocks);
+					int last = journal_last_done();
+					if (last >= 0 && !block_matches(&job, last)) {
+						fprintf(stderr, "journal: block 0x%06X doesn't match, redoing it\n", last);
+						journal_reset_block(last);
+					}
+				}
+			}
+
+			bool *up_to_date = calloc(n_blocks > 0 ? n_blocks : 1, sizeof(bool));
+			if (up_to_date == NULL) {
+				fprintf(stderr, "Out of memory.\n");
+				mpsse_error(1);
+			}
+
+			if (manifest_dir != NULL) {
+				if (!manifest_load(manifest_dir, uid, job.block_size))
+					mpsse_error(1);
+
+				int n_same = 0;
+				for (int i = 0; i < n_blocks; i++) {
+					int addr = begin_addr + i * job.block_size;
+					uint64_t hash;
+					if (!journal_done(addr) && manifest_lookup(addr, &hash) &&
+							hash == image_block_hash(&job, addr)) {
+						up_to_date[i] = true;
+						n_same++;
+					}
+				}
+
+				/* Read back an evenly spread sample, ending with the last
+				   block, before trusting the manifest */
+				int n_sample = manifest_sample < n_same ? manifest_sample : n_same;
+				for (int i = 0, rank = 0, k = 0; i < n_blocks && k < n_sample; i++) {
+					if (!up_to_date[i])
+						continue;
+					if (rank++ != (k + 1) * n_same / n_sample - 1)
+						continue;
+					k++;
+
+					int addr = begin_addr + i * job.block_size;
+					uint64_t hash;
+					manifest_lookup(addr, &hash);
+					if (flash_block_hash(addr, job.block_size) != hash) {
+						fprintf(stderr, "manifest: block 0x%06X changed since it was recorded, not using the manifest\n", addr);
+						memset(up_to_date, 0, n_blocks * sizeof(bool));
+						n_same = 0;
+						break;
+					}
+				}
+
+				if (n_same > 0) {
+					fprintf(stderr, "manifest: %d of %d blocks up to date, %d read back\n",
+							n_same, n_blocks, n_sample);
+					keep_blocks = true;
+				}
+
+				/* Until they are verified again the blocks about to be
+				   rewritten have unknown contents */
+				for (int i = 0; i < n_blocks; i++)
+					if (!up_to_date[i])
+						manifest_forget(begin_addr + i * job.block_size);
+				if (n_same < n_blocks && !manifest_save())
+					mpsse_error(1);
+			}
+
+			/* Slots and patched images mostly match what is on the
+			   board already, blocks are read back before being
+			   rewritten */
+			bool delta = warmboot || patch_active();
+			if (delta)
+				keep_blocks = true;
+
+			/* A session that keeps some blocks can't bulk erase, it
+			   erases the remaining ones instead. */
+			if (bulk_erase && !dont_erase && !keep_blocks)
+			{
+				stats_phase(PHASE_ERASE);
+				flash_write_enable();
+				flash_bulk_erase();
+				flash_wait();
+				journal_record_bulk_erase();
+			}
+
+			fprintf(stderr, "file size: %ld\n", file_size);
+			if (!erase_mode)
+				fprintf(stderr, "programming..\n");
+
+			mpsse_set_recoverable(true);
+
+			int unchanged = 0;
+			for (int addr = begin_addr; addr < end_addr; addr += job.block_size) {
+				/* A resumed session programmed the block before it was
+				   interrupted, from the same counters */
+				if (journal_done(addr)) {
+					patch_written(addr - rw_offset, addr - rw_offset + job.block_size);
+					continue;
+				}
+				if (up_to_date[(addr - begin_addr) / job.block_size])
+					continue;
+
+				/* After a failure the block is erased again even with -b,
+				   the partial program may have cleared bits. -n leaves
+				   only reprogramming. */
+				bool erase = !dont_erase && (!bulk_erase || keep_blocks);
+
+				/* Reading a block back is much cheaper than erasing and
+				   programming it. Once programming started the block
+				   isn't compared again. */
+				bool compare = delta;
+				for (int attempt = 1; true; attempt++) {
+					const char *what = NULL;
+					if (compare) {
+						bool same = block_matches(&job, addr);
+						if (mpsse_get_error()) {
+							what = "USB error during read-back";
+						} else if (same) {
+							unchanged++;
+							break;
+						} else {
+							compare = false;
+						}
+					}
+					if (what == NULL)
+						what = program_block(&job, addr, erase);
+					if (what == NULL) {
+						patch_written(addr - rw_offset, addr - rw_offset + job.block_size);
+						break;
+					}
+
+					fprintf(stderr, "\nblock 0x%06X: %s\n", addr, what);
+					log_retry(addr, what);
+					if (attempt > retries) {
+						if (retries > 0)
+							fprintf(stderr, "giving up after %d retries.\n", retries);
+						mpsse_set_recoverable(false);
+						if (!mpsse_get_error()) {
+							if (!disable_powerdown)
+							  flash_power_down();
+							flash_release_reset();
+							usleep(250000);
+						}
+						mpsse_error(mpsse_get_error() ? mpsse_get_error() : 3);
+					}
+
+					fprintf(stderr, "retry %d/%d: reconnecting..\n", attempt, retries);
+					metrics_retry();
+					while (!reconnect_flash(jedec_id)) {
+						if (++attempt > retries) {
+							fprintf(stderr, "giving up, can't reconnect.\n");
+							mpsse_set_recoverable(false);
+							mpsse_error(2);
+						}
+						usleep(500000);
+						fprintf(stderr, "retry %d/%d: reconnecting..\n", attempt, retries);
+					}
+					erase = !dont_erase;
+				}
+			}
+
+			mpsse_set_recoverable(false);
+			journal_close(true);
+
+			if (delta)
+				fprintf(stderr, "%d of %d blocks unchanged\n", unchanged, n_blocks);
+			if (!patch_commit())
+				mpsse_error(1);
+
+			/* With -n the bytes around the image are unknown */
+			if (manifest_dir != NULL && job.verify && !dont_erase) {
+				for (int i = 0; i < n_blocks; i++) {
+					int addr = begin_addr + i * job.block_size;
+					if (!up_to_date[i])
+						manifest_set(addr, image_block_hash(&job, addr));
+				}
+				manifest_save();
+			}
+
+			free(up_to_date);
+
+			/* seek to the beginning for a sampled verify, which has to
+			   see the patched image */
+			if (patch_active()) {
+				fclose(f);
+				f = tmp_stream(job.image, job.size, my_name);
+				if (f == NULL)
+					mpsse_error(1);
+			} else {
+				fseek(f, 0, SEEK_SET);
+			}
+			free(job.image);
+
+			log_progress_done();
+			fprintf(stderr, "done.\n");
+			if (job.verify && !erase_mode)
+				fprintf(stderr, "VERIFY OK\n");
+
+			if (retry_log_len) {
+				fprintf(stderr, "%d retr%s:\n", retry_log_len, retry_log_len == 1 ? "y" : "ies");
+				for (int i = 0; i < retry_log_len; i++)
+					fprintf(stderr, "  0x%06X  %s\n", retry_log[i].addr, retry_log[i].what);
+			}
+		}
+		else if (!read_mode && !check_mode && !scan_mode)
 		{
 			if (disable_protect)
 			{
@@ -445,6 +1788,7 @@ int main(int argc, char **argv)
 			
 			if (!dont_erase)
 			{
+				stats_phase(PHASE_ERASE);
 				if (bulk_erase)
 				{
 					flash_write_enable();
@@ -473,33 +1817,83 @@ int main(int argc, char **argv)
 								flash_64kB_sector_erase(addr);
 								break;
 						}
-						if (verbose) {
-							fprintf(stderr, "Status after block erase:\n");
+						if (log_enabled(LOG_FLASH, LOG_DEBUG)) {
+							log_debug(LOG_FLASH, "Status after block erase:");
 							flash_read_status();
 						}
 						flash_wait();
+						stats_add_bytes(block_size);
 					}
 				}
 			}
 
 			if (!erase_mode)
 			{
+				stats_phase(PHASE_PROGRAM);
 				fprintf(stderr, "programming..\n");
 
-				for (int rc, addr = 0; true; addr += rc) {
-					uint8_t buffer[256];
-					int page_size = 256 - (rw_offset + addr) % 256;
-					rc = fread(buffer, 1, page_size, f);
-					if (rc <= 0)
-						break;
-					fprintf(stderr, "                      \r");
-					fprintf(stderr, "addr 0x%06X %3ld%%\r", rw_offset + addr, 100 * addr / file_size);
-					flash_write_enable();
-					flash_prog(rw_offset + addr, buffer, rc);
-					flash_wait();
+				if (inline_verify) {
+					/* The whole image is kept in memory, each page is
+					   compared as soon as it is programmed and there is
+					   no second pass. */
+					uint8_t *image = malloc(file_size > 0 ? file_size : 1);
+					if (image == NULL || (long)fread(image, 1, file_size, f) != file_size) {
+						fprintf(stderr, "Can't read %ld bytes of input file.\n", file_size);
+						mpsse_error(1);
+					}
+
+					int reprogrammed = 0;
+					for (int n, addr = 0; addr < file_size; addr += n) {
+						n = 256 - (rw_offset + addr) % 256;
+						if (n > file_size - addr)
+							n = file_size - addr;
+						log_progress(rw_offset + addr, 100 * addr / file_size);
+						int rc = flash_prog_verify(rw_offset + addr, image + addr, n, inline_retries);
+						if (rc < 0) {
+							fprintf(stderr, "Found difference between flash and file at 0x%06X!\n", rw_offset + addr);
+							if (!disable_powerdown)
+							  flash_power_down();
+							flash_release_reset();
+							usleep(250000);
+							mpsse_error(3);
+						}
+						reprogrammed += rc;
+						stats_add_bytes(n);
+					}
+					free(image);
+
+					log_progress_done();
+					if (reprogrammed)
+						fprintf(stderr, "%d page program(s) repeated after read-back\n", reprogrammed);
+					fprintf(stderr, "VERIFY OK\n");
+				} else {
+					/* The first chunk ends on a page boundary, no
+					   page spans two slots */
+					struct file_pipe pipe;
+					struct spsc_slot *slot;
+					pipe_start(&pipe, f, file_reader, PIPE_SLOT_SIZE - rw_offset % 256);
+					for (int addr = 0; (slot = spsc_peek(pipe.q)) != NULL; spsc_release(pipe.q)) {
+						for (int rc, pos = 0; pos < slot->len; pos += rc, addr += rc) {
+							uint8_t *page = slot->data + pos;
+							rc = 256 - (rw_offset + addr) % 256;
+							if (rc > slot->len - pos)
+								rc = slot->len - pos;
+							log_progress(rw_offset + addr, 100 * addr / file_size);
+							if (!flash_page_blank(page, rc)) {
+								flash_write_enable();
+								flash_prog(rw_offset + addr, page, rc);
+								flash_wait();
+							}
+							stats_add_bytes(rc);
+						}
+					}
+					if (!pipe_finish(&pipe)) {
+						fprintf(stderr, "Can't read input file.\n");
+						mpsse_error(1);
+					}
+					log_progress_done();
+					fprintf(stderr, "done.\n");
 				}
-				fprintf(stderr, "                      \r");
-				fprintf(stderr, "done.\n");
 
 				/* seek to the beginning for second pass */
 				fseek(f, 0, SEEK_SET);
@@ -510,38 +1904,79 @@ int main(int argc, char **argv)
 		// Read/Verify
 		// ---------------------------------------------------------
 
-		if (read_mode) {
+		if (scan_mode) {
+			stats_phase(PHASE_READ);
+			if (scan_size == 0) {
+				scan_size = flash_size_from_id(jedec_id) - rw_offset;
+				if (scan_size <= 0) {
+					fprintf(stderr, "Can't determine flash size from ID, use `--scan=<size>'.\n");
+					mpsse_error(1);
+				}
+			}
+			if (!slow_clock)
+				fprintf(stderr, "SPI clock: %d kHz\n", mpsse_set_max_clock());
+			flash_scan(rw_offset, scan_size, stdout);
+			stats_add_bytes(scan_size);
+		} else if (read_mode) {
+			stats_phase(PHASE_READ);
 			fprintf(stderr, "reading..\n");
-			for (int addr = 0; addr < read_size; addr += 256) {
-				uint8_t buffer[256];
-				fprintf(stderr, "                      \r");
-				fprintf(stderr, "addr 0x%06X %3d%%\r", rw_offset + addr, 100 * addr / read_size);
-				flash_read(rw_offset + addr, buffer, 256);
-				fwrite(buffer, read_size - addr > 256 ? 256 : read_size - addr, 1, f);
-			}
-			fprintf(stderr, "                      \r");
+			struct file_pipe pipe;
+			pipe_start(&pipe, f, file_writer, 0);
+			for (int n, addr = 0; addr < read_size; addr += n) {
+				n = read_size - addr > PIPE_READ_CHUNK ? PIPE_READ_CHUNK : read_size - addr;
+				struct spsc_slot *slot = spsc_acquire(pipe.q);
+				log_progress(rw_offset + addr, 100 * addr / read_size);
+				flash_read(rw_offset + addr, slot->data, n);
+				slot->len = n;
+				spsc_publish(pipe.q);
+				stats_add_bytes(n);
+			}
+			spsc_close(pipe.q);
+			if (!pipe_finish(&pipe)) {
+				fprintf(stderr, "Can't write output file.\n");
+				mpsse_error(1);
+			}
+			log_progress_done();
 			fprintf(stderr, "done.\n");
-		} else if (!erase_mode && !disable_verify) {
+		} else if (verify_sample > 0.0) {
+			stats_phase(PHASE_VERIFY);
+			if (!verify_seed_set)
+				verify_seed = stats_time_us() ^ ((uint64_t)time(NULL) << 24);
+
+			/* Blocks that needed retries are checked completely */
+			int *retried = malloc((retry_log_len + 1) * sizeof(int));
+			if (retried == NULL) {
+				fprintf(stderr, "Out of memory.\n");
+				mpsse_error(1);
+			}
+			for (int i = 0; i < retry_log_len; i++)
+				retried[i] = retry_log[i].addr;
+
 			fprintf(stderr, "reading..\n");
-			for (int addr = 0; true; addr += 256) {
-				uint8_t buffer_flash[256], buffer_file[256];
-				int rc = fread(buffer_file, 1, 256, f);
-				if (rc <= 0)
-					break;
-				fprintf(stderr, "                      \r");
-				fprintf(stderr, "addr 0x%06X %3ld%%\r", rw_offset + addr, 100 * addr / file_size);
-				flash_read(rw_offset + addr, buffer_flash, rc);
-				if (memcmp(buffer_file, buffer_flash, rc)) {
-					fprintf(stderr, "Found difference between flash and file!\n");
-					if (!disable_powerdown)
-					  flash_power_down();
-					flash_release_reset();
-					usleep(250000);
-					mpsse_error(3);
-				}
+			if (compare_sample(f, rw_offset, erase_block_size << 10, verify_sample, verify_seed,
+					retried, retry_log_len, stderr)) {
+				fprintf(stderr, "Found difference between flash and file!\n");
+				if (!disable_powerdown)
+				  flash_power_down();
+				flash_release_reset();
+				usleep(250000);
+				mpsse_error(3);
+			}
+			free(retried);
+
+			fprintf(stderr, "VERIFY OK (sampled)\n");
+		} else if (!erase_mode && !disable_verify && !inline_verify && (check_mode || !block_mode)) {
+			stats_phase(PHASE_VERIFY);
+			fprintf(stderr, "reading..\n");
+			if (compare_flash(f, rw_offset, file_size, erase_block_size << 10, max_diffs, stderr)) {
+				fprintf(stderr, "Found difference between flash and file!\n");
+				if (!disable_powerdown)
+				  flash_power_down();
+				flash_release_reset();
+				usleep(250000);
+				mpsse_error(3);
 			}
 
-			fprintf(stderr, "                      \r");
 			fprintf(stderr, "VERIFY OK\n");
 		}
 
@@ -550,6 +1985,7 @@ int main(int argc, char **argv)
 		// Reset
 		// ---------------------------------------------------------
 
+		stats_phase(PHASE_SHUTDOWN);
 		if (!disable_powerdown)
 			flash_power_down();
 
@@ -568,5 +2004,6 @@ int main(int argc, char **argv)
 
 	fprintf(stderr, "Bye.\n");
 	mpsse_close();
+	metrics_done();
 	return 0;
 }
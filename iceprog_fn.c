@@ -43,9 +43,25 @@
 #include <sys/stat.h>
 #endif
 
+#include "health.h"
 #include "iceprog_fn.h"
+#include "log.h"
+#include "probes.h"
+#include "stats.h"
 
-static bool verbose = false;
+/* Number of status register reads done by flash_wait() */
+unsigned long flash_wait_polls = 0;
+
+/* Last ID returned by flash_read_id() */
+uint32_t flash_jedec_id = 0;
+
+/* Erase or program the next flash_wait() is timing for --health */
+static enum health_op busy_op = HEALTH_NONE;
+static int busy_addr;
+
+/* Last command queued, for the wait_start probe */
+static uint8_t last_opcode;
+static int last_addr = -1;
 
 // ---------------------------------------------------------
 // FLASH definitions
@@ -92,6 +108,14 @@ enum flash_cmd {
 	FC_RESET = 0x99, /* Reset Device */
 };
 
+/* Note a command being queued, addr -1 if it has none */
+static void flash_cmd(uint8_t opcode, int addr)
+{
+	PROBE_FLASH_CMD(opcode, addr);
+	last_opcode = opcode;
+	last_addr = addr;
+}
+
 // ---------------------------------------------------------
 // Hardware specific CS, CReset, CDone functions
 // ---------------------------------------------------------
@@ -111,7 +135,14 @@ void set_cs_creset(int cs_b, int creset_b)
 		direction |= 0x80;
 	}
 
+	int last_direction = mpsse_get_gpio_direction();
 	mpsse_set_gpio(gpio, direction);
+
+	/* Callers time the FPGA reset with usleep(), so a CRESET edge can't
+	   sit in the write buffer. CS changes are ordered by the MPSSE and
+	   stay coalesced. */
+	if (last_direction < 0 || ((last_direction ^ direction) & 0x80))
+		mpsse_flush();
 }
 
 bool get_cdone(void)
@@ -134,6 +165,7 @@ void flash_release_reset()
 // should only happen while FPGA reset is asserted
 void flash_chip_select()
 {
+	PROBE_CS_ASSERT();
 	set_cs_creset(0, 0);
 }
 
@@ -141,6 +173,7 @@ void flash_chip_select()
 void flash_chip_deselect()
 {
 	set_cs_creset(1, 0);
+	PROBE_CS_DEASSERT();
 }
 
 // SRAM reset is the same as flash_chip_select()
@@ -155,10 +188,11 @@ void sram_reset()
 // When accessing FPGA SRAM the reset should be released
 void sram_chip_select()
 {
+	PROBE_CS_ASSERT();
 	set_cs_creset(0, 1);
 }
 
-void flash_read_id()
+uint32_t flash_read_id()
 {
 	/* JEDEC ID structure:
 	 * Byte No. | Data Type
@@ -173,17 +207,17 @@ void flash_read_id()
 	uint8_t data[260] = { FC_JEDECID };
 	int len = 5; // command + 4 response bytes
 
-	if (verbose)
-		fprintf(stderr, "read flash ID..\n");
+	log_debug(LOG_FLASH, "read flash ID..");
 
+	flash_cmd(FC_JEDECID, -1);
 	flash_chip_select();
 
 	// Write command and read first 4 bytes
 	mpsse_xfer_spi(data, len);
 
 	if (data[4] == 0xFF)
-		fprintf(stderr, "Extended Device String Length is 0xFF, "
-				"this is likely a read error. Ignoring...\n");
+		log_warn(LOG_FLASH, "Extended Device String Length is 0xFF, "
+				"this is likely a read error. Ignoring...");
 	else {
 		// Read extended JEDEC ID bytes
 		if (data[4] != 0) {
@@ -195,13 +229,48 @@ void flash_read_id()
 	flash_chip_deselect();
 
 	// TODO: Add full decode of the JEDEC ID.
-	fprintf(stderr, "flash ID:");
+	char id_text[5 * 259 + 1];
 	for (int i = 1; i < len; i++)
-		fprintf(stderr, " 0x%02X", data[i]);
-	fprintf(stderr, "\n");
+		snprintf(id_text + 5 * (i - 1), 6, " 0x%02X", data[i]);
+	log_info(LOG_FLASH, "flash ID:%s", id_text);
+
+	flash_jedec_id = (data[1] << 16) | (data[2] << 8) | data[3];
+	return flash_jedec_id;
 }
 
-void flash_reset()
+// Derive the flash size in bytes from the JEDEC ID capacity byte.
+// Returns 0 if the capacity code doesn't follow the usual 2^n encoding.
+int flash_size_from_id(uint32_t jedec_id)
+{
+	int capacity = jedec_id & 0xff;
+
+	if (capacity < 0x10 || capacity > 0x18)
+		return 0;
+
+	return 1 << capacity;
+}
+
+// Read the 64 bit factory unique ID (W25Q and most compatible parts).
+// Flashes without the command usually return all ones.
+uint64_t flash_read_uid()
+{
+	uint8_t data[13] = { FC_UID };
+
+	flash_cmd(FC_UID, -1);
+	flash_chip_select();
+	mpsse_xfer_spi(data, 13);
+	flash_chip_deselect();
+
+	uint64_t uid = 0;
+	for (int i = 5; i < 13; i++)
+		uid = (uid << 8) | data[i];
+
+	log_debug(LOG_FLASH, "flash UID: %016llX", (unsigned long long)uid);
+
+	return uid;
+}
+
+int flash_reset()
 {
 	uint8_t data[8] = { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff };
 
@@ -214,70 +283,71 @@ void flash_reset()
 	flash_chip_select();
 	mpsse_xfer_spi_bits(0xFF, 2);
 	flash_chip_deselect();
+
+	return mpsse_get_error();
 }
 
-void flash_power_up()
+int flash_power_up()
 {
 	uint8_t data_rpd[1] = { FC_RPD };
+	flash_cmd(FC_RPD, -1);
 	flash_chip_select();
 	mpsse_xfer_spi(data_rpd, 1);
 	flash_chip_deselect();
+
+	return mpsse_get_error();
 }
 
-void flash_power_down()
+int flash_power_down()
 {
 	uint8_t data[1] = { FC_PD };
+	flash_cmd(FC_PD, -1);
 	flash_chip_select();
 	mpsse_xfer_spi(data, 1);
 	flash_chip_deselect();
+
+	return mpsse_get_error();
 }
 
 uint8_t flash_read_status()
 {
 	uint8_t data[2] = { FC_RSR1 };
 
+	flash_cmd(FC_RSR1, -1);
 	flash_chip_select();
 	mpsse_xfer_spi(data, 2);
 	flash_chip_deselect();
 
-	if (verbose) {
-		fprintf(stderr, "SR1: 0x%02X\n", data[1]);
-		fprintf(stderr, " - SPRL: %s\n",
-			((data[1] & (1 << 7)) == 0) ? 
-				"unlocked" : 
+	if (log_enabled(LOG_FLASH, LOG_DEBUG)) {
+		static const char *const swp[4] = {
+			"All sectors unprotected",
+			"Some sectors protected",
+			"Reserved (xxxx 10xx)",
+			"All sectors protected"
+		};
+		log_debug(LOG_FLASH, "SR1: 0x%02X", data[1]);
+		log_debug(LOG_FLASH, " - SPRL: %s",
+			((data[1] & (1 << 7)) == 0) ?
+				"unlocked" :
 				"locked");
-		fprintf(stderr, " -  SPM: %s\n",
+		log_debug(LOG_FLASH, " -  SPM: %s",
 			((data[1] & (1 << 6)) == 0) ?
 				"Byte/Page Prog Mode" :
 				"Sequential Prog Mode");
-		fprintf(stderr, " -  EPE: %s\n",
+		log_debug(LOG_FLASH, " -  EPE: %s",
 			((data[1] & (1 << 5)) == 0) ?
 				"Erase/Prog success" :
 				"Erase/Prog error");
-		fprintf(stderr, "-  SPM: %s\n",
+		log_debug(LOG_FLASH, "-  SPM: %s",
 			((data[1] & (1 << 4)) == 0) ?
 				"~WP asserted" :
 				"~WP deasserted");
-		fprintf(stderr, " -  SWP: ");
-		switch((data[1] >> 2) & 0x3) {
-			case 0:
-				fprintf(stderr, "All sectors unprotected\n");
-				break;
-			case 1:
-				fprintf(stderr, "Some sectors protected\n");
-				break;
-			case 2:
-				fprintf(stderr, "Reserved (xxxx 10xx)\n");
-				break;
-			case 3:
-				fprintf(stderr, "All sectors protected\n");
-				break;
-		}
-		fprintf(stderr, " -  WEL: %s\n",
+		log_debug(LOG_FLASH, " -  SWP: %s", swp[(data[1] >> 2) & 0x3]);
+		log_debug(LOG_FLASH, " -  WEL: %s",
 			((data[1] & (1 << 1)) == 0) ?
 				"Not write enabled" :
 				"Write enabled");
-		fprintf(stderr, " - ~RDY: %s\n",
+		log_debug(LOG_FLASH, " - ~RDY: %s",
 			((data[1] & (1 << 0)) == 0) ?
 				"Ready" :
 				"Busy");
@@ -288,111 +358,180 @@ uint8_t flash_read_status()
 	return data[1];
 }
 
-void flash_write_enable()
+int flash_write_enable()
 {
-	if (verbose) {
-		fprintf(stderr, "status before enable:\n");
+	/* Two extra status reads per page, only at trace level */
+	if (log_enabled(LOG_FLASH, LOG_TRACE)) {
+		log_trace(LOG_FLASH, "status before enable:");
 		flash_read_status();
 	}
 
-	if (verbose)
-		fprintf(stderr, "write enable..\n");
+	log_debug(LOG_FLASH, "write enable..");
 
 	uint8_t data[1] = { FC_WE };
+	flash_cmd(FC_WE, -1);
 	flash_chip_select();
 	mpsse_xfer_spi(data, 1);
 	flash_chip_deselect();
 
-	if (verbose) {
-		fprintf(stderr, "status after enable:\n");
+	if (log_enabled(LOG_FLASH, LOG_TRACE)) {
+		log_trace(LOG_FLASH, "status after enable:");
 		flash_read_status();
 	}
+
+	return mpsse_get_error();
 }
 
-void flash_bulk_erase()
+int flash_bulk_erase()
 {
-	fprintf(stderr, "bulk erase..\n");
+	log_info(LOG_FLASH, "bulk erase..");
 
 	uint8_t data[1] = { FC_CE };
+	flash_cmd(FC_CE, -1);
 	flash_chip_select();
 	mpsse_xfer_spi(data, 1);
 	flash_chip_deselect();
+
+	return mpsse_get_error();
 }
 
-void flash_4kB_sector_erase(int addr)
+int flash_4kB_sector_erase(int addr)
 {
-	fprintf(stderr, "erase 4kB sector at 0x%06X..\n", addr);
+	log_info(LOG_FLASH, "erase 4kB sector at 0x%06X..", addr);
 
 	uint8_t command[4] = { FC_SE, (uint8_t)(addr >> 16), (uint8_t)(addr >> 8), (uint8_t)addr };
 
+	flash_cmd(FC_SE, addr);
 	flash_chip_select();
 	mpsse_send_spi(command, 4);
 	flash_chip_deselect();
+
+	busy_op = HEALTH_ERASE_4K;
+	busy_addr = addr;
+
+	return mpsse_get_error();
 }
 
-void flash_32kB_sector_erase(int addr)
+int flash_32kB_sector_erase(int addr)
 {
-	fprintf(stderr, "erase 64kB sector at 0x%06X..\n", addr);
+	log_info(LOG_FLASH, "erase 32kB sector at 0x%06X..", addr);
 
 	uint8_t command[4] = { FC_BE32, (uint8_t)(addr >> 16), (uint8_t)(addr >> 8), (uint8_t)addr };
 
+	flash_cmd(FC_BE32, addr);
 	flash_chip_select();
 	mpsse_send_spi(command, 4);
 	flash_chip_deselect();
+
+	busy_op = HEALTH_ERASE_32K;
+	busy_addr = addr;
+
+	return mpsse_get_error();
 }
 
-void flash_64kB_sector_erase(int addr)
+int flash_64kB_sector_erase(int addr)
 {
-	fprintf(stderr, "erase 64kB sector at 0x%06X..\n", addr);
+	log_info(LOG_FLASH, "erase 64kB sector at 0x%06X..", addr);
 
 	uint8_t command[4] = { FC_BE64, (uint8_t)(addr >> 16), (uint8_t)(addr >> 8), (uint8_t)addr };
 
+	flash_cmd(FC_BE64, addr);
 	flash_chip_select();
 	mpsse_send_spi(command, 4);
 	flash_chip_deselect();
+
+	busy_op = HEALTH_ERASE_64K;
+	busy_addr = addr;
+
+	return mpsse_get_error();
+}
+
+/* Erase one 4, 32 or 64 kB block and wait for it */
+int flash_erase_block(int addr, int block_size)
+{
+	flash_write_enable();
+	switch (block_size >> 10) {
+		case 4:
+			flash_4kB_sector_erase(addr);
+			break;
+		case 32:
+			flash_32kB_sector_erase(addr);
+			break;
+		case 64:
+			flash_64kB_sector_erase(addr);
+			break;
+	}
+	return flash_wait();
 }
 
-void flash_prog(int addr, uint8_t *data, int n)
+int flash_prog(int addr, uint8_t *data, int n)
 {
-	if (verbose)
-		fprintf(stderr, "prog 0x%06X +0x%03X..\n", addr, n);
+	log_debug(LOG_FLASH, "prog 0x%06X +0x%03X..", addr, n);
 
 	uint8_t command[4] = { FC_PP, (uint8_t)(addr >> 16), (uint8_t)(addr >> 8), (uint8_t)addr };
 
+	flash_cmd(FC_PP, addr);
 	flash_chip_select();
 	mpsse_send_spi(command, 4);
 	mpsse_send_spi(data, n);
 	flash_chip_deselect();
 
-	if (verbose)
-		for (int i = 0; i < n; i++)
-			fprintf(stderr, "%02x%c", data[i], i == n - 1 || i % 32 == 31 ? '\n' : ' ');
+	busy_op = HEALTH_PROGRAM;
+	busy_addr = addr;
+
+	log_hexdump(LOG_DATA, data, n);
+
+	return mpsse_get_error();
+}
+
+/* Programming can only clear bits, a page of 0xFF leaves the flash as it
+ * is and doesn't need to be sent */
+bool flash_page_blank(const uint8_t *data, int n)
+{
+	for (int i = 0; i < n; i++)
+		if (data[i] != 0xff)
+			return false;
+	return true;
 }
 
-void flash_read(int addr, uint8_t *data, int n)
+int flash_read(int addr, uint8_t *data, int n)
 {
-	if (verbose)
-		fprintf(stderr, "read 0x%06X +0x%03X..\n", addr, n);
+	log_debug(LOG_FLASH, "read 0x%06X +0x%03X..", addr, n);
 
 	uint8_t command[4] = { FC_RD, (uint8_t)(addr >> 16), (uint8_t)(addr >> 8), (uint8_t)addr };
 
+	flash_cmd(FC_RD, addr);
 	flash_chip_select();
 	mpsse_send_spi(command, 4);
 	memset(data, 0, n);
 	mpsse_xfer_spi(data, n);
 	flash_chip_deselect();
 
-	if (verbose)
-		for (int i = 0; i < n; i++)
-			fprintf(stderr, "%02x%c", data[i], i == n - 1 || i % 32 == 31 ? '\n' : ' ');
+	log_hexdump(LOG_DATA, data, n);
+
+	return mpsse_get_error();
 }
 
-void flash_wait()
+int flash_fast_read(int addr, uint8_t *data, int n)
 {
-	if (verbose)
-		fprintf(stderr, "waiting..");
+	log_debug(LOG_FLASH, "fast read 0x%06X +0x%03X..", addr, n);
+
+	uint8_t command[5] = { FC_FR, (uint8_t)(addr >> 16), (uint8_t)(addr >> 8), (uint8_t)addr, 0x00 };
+
+	flash_cmd(FC_FR, addr);
+	flash_chip_select();
+	mpsse_send_spi(command, 5);
+	mpsse_recv_spi(data, n);
+	flash_chip_deselect();
 
-	int count = 0;
+	return mpsse_get_error();
+}
+
+int flash_wait()
+{
+	int count = 0, polls = 0;
+	uint64_t start = stats_time_us(), last_busy = start, first_ready = 0;
+	PROBE_WAIT_START(last_opcode, last_addr);
 	while (1)
 	{
 		uint8_t data[2] = { FC_RSR1 };
@@ -400,43 +539,136 @@ void flash_wait()
 		flash_chip_select();
 		mpsse_xfer_spi(data, 2);
 		flash_chip_deselect();
+		flash_wait_polls++;
+		polls++;
 
 		if ((data[1] & 0x01) == 0) {
+			if (count == 0)
+				first_ready = stats_time_us();
 			if (count < 2) {
 				count++;
-				if (verbose) {
-					fprintf(stderr, "r");
-					fflush(stderr);
-				}
 			} else {
-				if (verbose) {
-					fprintf(stderr, "R");
-					fflush(stderr);
-				}
 				break;
 			}
 		} else {
-			if (verbose) {
-				fprintf(stderr, ".");
-				fflush(stderr);
-			}
 			count = 0;
+			last_busy = stats_time_us();
 		}
 
+		/* The flash is busy, write out buffered diagnostics meanwhile */
+		log_idle();
 		usleep(1000);
 	}
 
-	if (verbose)
-		fprintf(stderr, "\n");
+	log_debug(LOG_WAIT, "waited for %d status polls", polls);
+
+	/* The flash got ready between the last busy and the first ready
+	   poll. The first poll also sent the command. */
+	uint64_t busy_us = (last_busy + first_ready) / 2 - start;
+	PROBE_WAIT_DONE(polls, busy_us);
+	if (busy_op != HEALTH_NONE && !mpsse_get_error())
+		health_record(busy_op, busy_addr, busy_us);
+	busy_op = HEALTH_NONE;
 
+	return mpsse_get_error();
 }
 
-void flash_disable_protection()
+/* Like flash_wait(), but a read of the given range is queued behind every
+ * status poll, so the data is in hand the moment the flash reports ready.
+ * Reads issued while the flash is still busy are ignored by it and their
+ * result is discarded. The same three ready polls in a row as in
+ * flash_wait() are needed, the data is the one read after the last. */
+int flash_wait_read(int addr, uint8_t *data, int n)
 {
-	fprintf(stderr, "disable flash protection...\n");
+	uint8_t command[5] = { FC_FR, (uint8_t)(addr >> 16), (uint8_t)(addr >> 8), (uint8_t)addr, 0x00 };
+	uint64_t start = stats_time_us(), last_busy = start, first_ready = 0;
+	int count = 0, polls = 0;
+
+	PROBE_WAIT_START(last_opcode, last_addr);
+	while (1)
+	{
+		uint8_t status[2] = { FC_RSR1 };
+
+		flash_chip_select();
+		mpsse_xfer_spi_queue(status, 2);
+		flash_chip_deselect();
+
+		flash_chip_select();
+		mpsse_send_spi(command, 5);
+		mpsse_recv_spi_queue(n);
+		flash_chip_deselect();
+
+		mpsse_recv_queued(status, 2);
+		mpsse_recv_queued(data, n);
+		flash_wait_polls++;
+		polls++;
+
+		if ((status[1] & 0x01) == 0) {
+			if (count == 0)
+				first_ready = stats_time_us();
+			if (count < 2) {
+				count++;
+			} else {
+				break;
+			}
+		} else {
+			count = 0;
+			last_busy = stats_time_us();
+		}
+
+		/* A page program takes well under a millisecond, poll faster
+		   than flash_wait() does */
+		usleep(250);
+	}
+
+	uint64_t busy_us = (last_busy + first_ready) / 2 - start;
+	PROBE_WAIT_DONE(polls, busy_us);
+	if (busy_op != HEALTH_NONE && !mpsse_get_error())
+		health_record(busy_op, busy_addr, busy_us);
+	busy_op = HEALTH_NONE;
+
+	return mpsse_get_error();
+}
+
+/* Program a page (n <= 256, not crossing a page boundary) and check it
+ * with flash_wait_read(). All-0xFF data isn't programmed, only checked.
+ * A page that came back with bits still set is programmed again, up to
+ * max_retries times. Returns the number of retries needed or -1 if the
+ * page is still wrong or has bits cleared that only an erase can set,
+ * or if there was a USB error. */
+int flash_prog_verify(int addr, uint8_t *data, int n, int max_retries)
+{
+	uint8_t readback[256];
+	bool blank = flash_page_blank(data, n);
+
+	for (int attempt = 0; true; attempt++) {
+		if (!blank) {
+			flash_write_enable();
+			flash_prog(addr, data, n);
+		}
+
+		if (flash_wait_read(addr, readback, n))
+			return -1;
+		if (!memcmp(readback, data, n))
+			return attempt;
+
+		log_debug(LOG_FLASH, "page 0x%06X differs after programming (attempt %d)", addr, attempt + 1);
+
+		if (blank || attempt == max_retries)
+			return -1;
+		for (int i = 0; i < n; i++)
+			if (data[i] & ~readback[i])
+				return -1;
+	}
+}
+
+int flash_disable_protection()
+{
+	log_info(LOG_FLASH, "disable flash protection...");
 
 	// Write Status Register 1 <- 0x00
 	uint8_t data[2] = { FC_WSR1, 0x00 };
+	flash_cmd(FC_WSR1, -1);
 	flash_chip_select();
 	mpsse_xfer_spi(data, 2);
 	flash_chip_deselect();
@@ -451,19 +683,21 @@ void flash_disable_protection()
 	flash_chip_deselect();
 
 	if (data[1] != 0x00)
-		fprintf(stderr, "failed to disable protection, SR now equal to 0x%02x (expected 0x00)\n", data[1]);
+		log_error(LOG_FLASH, "failed to disable protection, SR now equal to 0x%02x (expected 0x00)", data[1]);
 
+	return mpsse_get_error();
 }
 
-void flash_enable_quad()
+int flash_enable_quad()
 {
-	fprintf(stderr, "Enabling Quad operation...\n");
+	log_info(LOG_FLASH, "Enabling Quad operation...");
 
 	// Allow write
 	flash_write_enable();
 
 	// Write Status Register 2 <- 0x02
 	uint8_t data[2] = { FC_WSR2, 0x02 };
+	flash_cmd(FC_WSR2, -1);
 	flash_chip_select();
 	mpsse_xfer_spi(data, 2);
 	flash_chip_deselect();
@@ -478,9 +712,11 @@ void flash_enable_quad()
 	flash_chip_deselect();
 
 	if ((data[1] & 0x02) != 0x02)
-		fprintf(stderr, "failed to set QE=1, SR2 now equal to 0x%02x (expected 0x%02x)\n", data[1], data[1] | 0x02);
+		log_error(LOG_FLASH, "failed to set QE=1, SR2 now equal to 0x%02x (expected 0x%02x)", data[1], data[1] | 0x02);
+
+	log_info(LOG_FLASH, "SR2: %08x", data[1]);
 
-	fprintf(stderr, "SR2: %08x\n", data[1]);
+	return mpsse_get_error();
 }
 
 // ---------------------------------------------------------
@@ -493,7 +729,11 @@ void help(const char *progname)
 	fprintf(stderr, "Usage: %s [-b|-n|-c] <input file>\n", progname);
 	fprintf(stderr, "       %s -r|-R<bytes> <output file>\n", progname);
 	fprintf(stderr, "       %s -S <input file>\n", progname);
+	fprintf(stderr, "       %s --warmboot [-c] <image 0> [<image 1> ...]\n", progname);
+	fprintf(stderr, "       %s --job <job file>\n", progname);
+	fprintf(stderr, "       %s --plan[=<flash>] [-b|-n] [-i 4|32|64] <input file>\n", progname);
 	fprintf(stderr, "       %s -t\n", progname);
+	fprintf(stderr, "       %s --scan[=<size>]\n", progname);
 	fprintf(stderr, "\n");
 	fprintf(stderr, "General options:\n");
 	fprintf(stderr, "  -d <device string>    use the specified USB device [default: i:0x0403:0x6010 or i:0x0403:0x6014]\n");
@@ -501,6 +741,11 @@ void help(const char *progname)
 	fprintf(stderr, "                          i:<vendor>:<product>         (e.g. i:0x0403:0x6010)\n");
 	fprintf(stderr, "                          i:<vendor>:<product>:<index> (e.g. i:0x0403:0x6010:0)\n");
 	fprintf(stderr, "                          s:<vendor>:<product>:<serial-string>\n");
+	fprintf(stderr, "                          replay:<trace file>          (see --trace)\n");
+	fprintf(stderr, "                          sim:<size>[,time=<scale>][,latency=<us>][,file=<path>]\n");
+	fprintf(stderr, "                              [,sr1=<value>][,uid=<hex>][,fail=<n>]\n");
+	fprintf(stderr, "                              (simulated flash, e.g. sim:4M; fail=<n> makes every\n");
+	fprintf(stderr, "                              n-th USB read fail, to try out --retries)\n");
 	fprintf(stderr, "  -I [ABCD]             connect to the specified interface on the FTDI chip\n");
 	fprintf(stderr, "                          [default: A]\n");
 	fprintf(stderr, "  -o <offset in bytes>  start address for read/write [default: 0]\n");
@@ -508,20 +753,108 @@ void help(const char *progname)
 	fprintf(stderr, "                          or 'M' for size in megabytes)\n");
 	fprintf(stderr, "  -s                    slow SPI (50 kHz instead of 6 MHz)\n");
 	fprintf(stderr, "  -k                    keep flash in powered up state (i.e. skip power down command)\n");
-	fprintf(stderr, "  -v                    verbose output\n");
+	fprintf(stderr, "  -v                    verbose output (same as --log debug)\n");
+	fprintf(stderr, "  --log <spec>          log levels, <level> or <category>=<level>[,...]\n");
+	fprintf(stderr, "                          categories: all, main, flash, wait, data\n");
+	fprintf(stderr, "                          levels: error, warn, info, debug, trace\n");
+	fprintf(stderr, "  --log-dump <bytes>    bytes shown per hex dump of the data category\n");
+	fprintf(stderr, "                          [default: 32, -1 for all]\n");
+	fprintf(stderr, "  --stats               print time, throughput, USB transfer and status\n");
+	fprintf(stderr, "                          poll counts of every phase at exit\n");
+	fprintf(stderr, "  --stats-json[=<file>] write the same statistics as JSON [default: stderr]\n");
+	fprintf(stderr, "  --health <dir>        time every erase and page program and keep the\n");
+	fprintf(stderr, "                          busy times per sector in <dir>/<uid>.health;\n");
+	fprintf(stderr, "                          warn about sectors slower than the part should be\n");
+	fprintf(stderr, "  --health-factor <x>   how much slower than typical is reported [default: 2]\n");
+	fprintf(stderr, "  --metrics-file <file> add the run to Prometheus counters in file, for\n");
+	fprintf(stderr, "                          node_exporter's textfile collector: runs, failures\n");
+	fprintf(stderr, "                          by exit status, bytes, polls, retries and phase\n");
+	fprintf(stderr, "                          durations per programmer serial and flash ID\n");
+	fprintf(stderr, "  --trace <file>        record all USB transfers to a binary trace that\n");
+	fprintf(stderr, "                          can be replayed with `-d replay:<file>'\n");
+	fprintf(stderr, "  --trace-hash          store only a hash of written data in the trace\n");
+	fprintf(stderr, "  --profile <file>      apply USB latency timer and chunk sizes saved\n");
+	fprintf(stderr, "                          by --probe-save\n");
+	fprintf(stderr, "  --read-chunk <size>   libftdi read chunk size\n");
+	fprintf(stderr, "  --write-chunk <size>  libftdi write chunk size, also the most commands\n");
+	fprintf(stderr, "                          and data sent per USB write [default: 16k/64k\n");
+	fprintf(stderr, "                          on hi-speed FTDI parts, 4k/4k otherwise]\n");
 	fprintf(stderr, "  -i [4,32,64]          select erase block size [default: 64k]\n");
 	fprintf(stderr, "\n");
 	fprintf(stderr, "Mode of operation:\n");
 	fprintf(stderr, "  [default]             write file contents to flash, then verify\n");
 	fprintf(stderr, "  -X                    write file contents to flash only\n");	
+	fprintf(stderr, "  --inline-verify[=<n>] read each page back right after programming it\n");
+	fprintf(stderr, "                          instead of a second verify pass, repeating the\n");
+	fprintf(stderr, "                          page program up to n times [default: 2]\n");
+	fprintf(stderr, "  --retries <n>         work one erase block at a time; after a USB error\n");
+	fprintf(stderr, "                          or verify mismatch reconnect, check the flash ID\n");
+	fprintf(stderr, "                          and redo the block, up to n times per block\n");
+	fprintf(stderr, "  --journal <dir>       work one erase block at a time and record finished\n");
+	fprintf(stderr, "                          blocks in <dir>; a rerun with the same image and\n");
+	fprintf(stderr, "                          flash skips them after spot-verifying the last one\n");
+	fprintf(stderr, "  --manifest <dir>      keep hashes of the verified erase blocks of each\n");
+	fprintf(stderr, "                          flash (by unique ID) in <dir> and skip blocks\n");
+	fprintf(stderr, "                          that already hold the image\n");
+	fprintf(stderr, "  --manifest-sample <n> read back n of the skipped blocks to check the\n");
+	fprintf(stderr, "                          manifest is still right [default: 2]\n");
 	fprintf(stderr, "  -r                    read first 256 kB from flash and write to file\n");
 	fprintf(stderr, "  -R <size in bytes>    read the specified number of bytes from flash\n");
 	fprintf(stderr, "                          (append 'k' to the argument for size in kilobytes,\n");
 	fprintf(stderr, "                          or 'M' for size in megabytes)\n");
 	fprintf(stderr, "  -c                    do not write flash, only verify (`check')\n");
+	fprintf(stderr, "  --max-diffs <n>       stop verifying after the erase block in which n\n");
+	fprintf(stderr, "                          differing bytes were found [default: compare all]\n");
+	fprintf(stderr, "  --verify-sample <percent>[,<seed>]\n");
+	fprintf(stderr, "                        verify only the first and last page of each erase\n");
+	fprintf(stderr, "                          block, every page of a block that needed retries\n");
+	fprintf(stderr, "                          and a random percentage of the rest; the seed is\n");
+	fprintf(stderr, "                          printed so a run can be repeated\n");
+	fprintf(stderr, "  --trim                only program (or check) the bitstream up to its\n");
+	fprintf(stderr, "                          wakeup command, dropping the padding after it\n");
+	fprintf(stderr, "  --part <name>         refuse to program a bitstream made for another\n");
+	fprintf(stderr, "                          device family (e.g. up5k, hx8k, lp1k)\n");
+	fprintf(stderr, "  --warmboot            take 1 to 4 bitstreams, write the warm boot headers\n");
+	fprintf(stderr, "                          and put each image in its own erase block aligned\n");
+	fprintf(stderr, "                          slot; blocks that already match are not rewritten\n");
+	fprintf(stderr, "  --slot-size <size>    slot size for --warmboot, a multiple of the erase\n");
+	fprintf(stderr, "                          block size [default: fit the largest image]\n");
+	fprintf(stderr, "  --patch <offset>=<source>\n");
+	fprintf(stderr, "                        write per-board data into the image before\n");
+	fprintf(stderr, "                          programming; only changed blocks are rewritten\n");
+	fprintf(stderr, "                          hex:<bytes>              literal bytes\n");
+	fprintf(stderr, "                          str:<text>               text\n");
+	fprintf(stderr, "                          uid                      flash unique ID (8 bytes)\n");
+	fprintf(stderr, "                          counter:<file>[,<bytes>] number kept in file,\n");
+	fprintf(stderr, "                                                   incremented once programmed\n");
+	fprintf(stderr, "                          numbers are written big endian\n");
+	fprintf(stderr, "                          csv:<file>,<column>      CSV field as hex bytes\n");
+	fprintf(stderr, "                          csvstr:<file>,<column>   CSV field as text\n");
+	fprintf(stderr, "  --csv-row <n>         CSV row for --patch, counting from 1 after the header\n");
+	fprintf(stderr, "  --job <file>          run the steps in file in one session, one per line:\n");
+	fprintf(stderr, "                          id, quad, unprotect, erase <offset> <size>,\n");
+	fprintf(stderr, "                          program <file> [<offset>], verify <file> [<offset>],\n");
+	fprintf(stderr, "                          read <file> <offset> <size>; consecutive erase and\n");
+	fprintf(stderr, "                          program steps share one merged erase pass\n");
+	fprintf(stderr, "  --station[=<ports>]   wait for programmers to be plugged in and program\n");
+	fprintf(stderr, "                          each board as it appears, up to <ports> at a\n");
+	fprintf(stderr, "                          time [default: 1]; -d may only give i:<vid>:<pid>\n");
 	fprintf(stderr, "  -S                    perform SRAM programming\n");
 	fprintf(stderr, "  -t                    just read the flash ID sequence\n");
 	fprintf(stderr, "  -Q                    just set the flash QE=1 bit\n");
+	fprintf(stderr, "  --scan[=<size>]       print a map of blank, all-zero and used 4 kB\n");
+	fprintf(stderr, "                          sectors [default size: detected from flash ID]\n");
+	fprintf(stderr, "  --probe               measure USB round trip and throughput through\n");
+	fprintf(stderr, "                          MPSSE loopback and recommend settings\n");
+	fprintf(stderr, "  --probe-save <file>   like --probe, and save the settings as a profile\n");
+	fprintf(stderr, "  --plan[=<flash>][,base=<file>][,rtt=<us>]\n");
+	fprintf(stderr, "                        don't program, print the erase plan, page and USB\n");
+	fprintf(stderr, "                          transfer counts and estimated time per phase for\n");
+	fprintf(stderr, "                          the given options, and the time other -i, -b and\n");
+	fprintf(stderr, "                          -s settings would take; <flash> is W25Q128JV,\n");
+	fprintf(stderr, "                          W25Q32JV, W25Q80DV, N25Q032A, a JEDEC ID or a\n");
+	fprintf(stderr, "                          timing file; base is the current flash contents\n");
+	fprintf(stderr, "                          for --warmboot/--patch [default: W25Q128JV]\n");
 	fprintf(stderr, "\n");
 	fprintf(stderr, "Erase mode (only meaningful in default mode):\n");
 	fprintf(stderr, "  [default]             erase aligned chunks of 64kB in write mode\n");
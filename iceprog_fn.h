@@ -4,6 +4,9 @@
 #include <stdbool.h>
 #include "mpsse.h"
 
+extern unsigned long flash_wait_polls;
+extern uint32_t flash_jedec_id;
+
 void set_cs_creset(int cs_b, int creset_b);
 bool get_cdone(void);
 void flash_release_reset();
@@ -11,21 +14,31 @@ void flash_chip_select();
 void flash_chip_deselect();
 void sram_reset();
 void sram_chip_select();
-void flash_read_id();
-void flash_reset();
-void flash_power_up();
-void flash_power_down();
+uint32_t flash_read_id();
+int flash_size_from_id(uint32_t jedec_id);
+uint64_t flash_read_uid();
+
+/* The flash operations below return 0, or the first USB error when the
+ * MPSSE layer is in recoverable mode (see mpsse_set_recoverable()) */
+int flash_reset();
+int flash_power_up();
+int flash_power_down();
 uint8_t flash_read_status();
-void flash_write_enable();
-void flash_bulk_erase();
-void flash_4kB_sector_erase(int addr);
-void flash_32kB_sector_erase(int addr);
-void flash_64kB_sector_erase(int addr);
-void flash_prog(int addr, uint8_t *data, int n);
-void flash_read(int addr, uint8_t *data, int n);
-void flash_wait();
-void flash_disable_protection();
-void flash_enable_quad();
+int flash_write_enable();
+int flash_bulk_erase();
+int flash_4kB_sector_erase(int addr);
+int flash_32kB_sector_erase(int addr);
+int flash_64kB_sector_erase(int addr);
+int flash_erase_block(int addr, int block_size);
+int flash_prog(int addr, uint8_t *data, int n);
+bool flash_page_blank(const uint8_t *data, int n);
+int flash_read(int addr, uint8_t *data, int n);
+int flash_fast_read(int addr, uint8_t *data, int n);
+int flash_wait();
+int flash_wait_read(int addr, uint8_t *data, int n);
+int flash_prog_verify(int addr, uint8_t *data, int n, int max_retries);
+int flash_disable_protection();
+int flash_enable_quad();
 void help(const char *progname);
 
 #endif // ICEPROG_FN_H
\ No newline at end of file
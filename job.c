@@ -0,0 +1,491 @@
+/*
+ *  iceprog -- simple programming tool for FTDI-based Lattice iCE programmers
+ *
+ *  Permission to use, copy, modify, and/or distribute this software for any
+ *  purpose with or without fee is hereby granted, provided that the above
+ *  copyright notice and this permission notice appear in all copies.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ *  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ *  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ *  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ *  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ *  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "iceprog_fn.h"
+#include "job.h"
+#include "log.h"
+#include "stats.h"
+
+#define JOB_CHUNK_SIZE (64 * 1024)
+
+enum step_kind {
+	STEP_ID,
+	STEP_QUAD,
+	STEP_UNPROTECT,
+	STEP_ERASE,
+	STEP_PROGRAM,
+	STEP_VERIFY,
+	STEP_READ
+};
+
+struct step {
+	enum step_kind kind;
+	int line;
+	char *file;
+	int offset;
+	long size;
+	uint8_t *data;  /* program and verify */
+};
+
+struct job {
+	struct step *steps;
+	int n_steps;
+	int block_size;
+};
+
+struct range {
+	int begin, end;
+};
+
+static uint8_t chunk_buffer[JOB_CHUNK_SIZE];
+
+static bool is_write(const struct step *s)
+{
+	return s->kind == STEP_ERASE || s->kind == STEP_PROGRAM;
+}
+
+/* The erase blocks a write step touches */
+static struct range erase_range(const struct step *s, int block_size)
+{
+	int mask = block_size - 1;
+	struct range r = { s->offset & ~mask, (int)((s->offset + s->size + mask) & ~mask) };
+	return r;
+}
+
+static bool overlaps(int begin1, int end1, int begin2, int end2)
+{
+	return begin1 < end2 && begin2 < end1;
+}
+
+static bool parse_number(const char *text, long *value)
+{
+	char *end;
+	long v = strtol(text, &end, 0);
+	if (end == text)
+		return false;
+	if (!strcmp(end, "k"))
+		v *= 1024;
+	else if (!strcmp(end, "M"))
+		v *= 1024 * 1024;
+	else if (*end != '\0')
+		return false;
+	if (v < 0 || v > 0x1000000 * 16)
+		return false;
+	*value = v;
+	return true;
+}
+
+static uint8_t *read_file(const char *filename, long *size)
+{
+	FILE *f = fopen(filename, "rb");
+	if (f == NULL)
+		return NULL;
+
+	long cap = 0, len = 0;
+	uint8_t *data = NULL;
+	while (true) {
+		if (len == cap) {
+			cap = cap ? 2 * cap : 256 * 1024;
+			uint8_t *grown = realloc(data, cap);
+			if (grown == NULL) {
+				free(data);
+				fclose(f);
+				errno = ENOMEM;
+				return NULL;
+			}
+			data = grown;
+		}
+		size_t rc = fread(data + len, 1, cap - len, f);
+		if (rc == 0)
+			break;
+		len += rc;
+	}
+	bool failed = ferror(f);
+	fclose(f);
+	if (failed) {
+		free(data);
+		errno = EIO;
+		return NULL;
+	}
+	*size = len;
+	return data;
+}
+
+/* Steps of one batch are reordered (all erases first), refuse the
+   combinations where that would make a difference */
+static bool check_steps(const struct job *job, const char *filename, const char *my_name)
+{
+	int batch = 0;
+
+	for (int i = 0; i < job->n_steps; i++) {
+		const struct step *s = &job->steps[i];
+		if (!is_write(s)) {
+			batch = i + 1;
+			continue;
+		}
+		struct range r = erase_range(s, job->block_size);
+
+		for (int k = 0; k < i; k++) {
+			const struct step *p = &job->steps[k];
+			if (p->kind != STEP_PROGRAM)
+				continue;
+			if (k >= batch && s->kind == STEP_PROGRAM &&
+					overlaps(s->offset, s->offset + s->size, p->offset, p->offset + p->size)) {
+				fprintf(stderr, "%s: %s:%d: program overlaps the one on line %d\n",
+						my_name, filename, s->line, p->line);
+				return false;
+			}
+			if (k >= batch && s->kind == STEP_ERASE &&
+					overlaps(r.begin, r.end, p->offset, p->offset + p->size)) {
+				fprintf(stderr, "%s: %s:%d: erase after a program of the same blocks (line %d)\n",
+						my_name, filename, s->line, p->line);
+				return false;
+			}
+			if (k < batch && s->kind == STEP_PROGRAM &&
+					overlaps(r.begin, r.end, p->offset, p->offset + p->size)) {
+				fprintf(stderr, "%s: %s:%d: erasing for this program would clobber line %d, "
+						"put the two next to each other\n", my_name, filename, s->line, p->line);
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+struct job *job_load(const char *filename, int block_size, const char *my_name)
+{
+	FILE *f = fopen(filename, "r");
+	if (f == NULL) {
+		fprintf(stderr, "%s: can't open job file '%s': %s\n", my_name, filename, strerror(errno));
+		return NULL;
+	}
+
+	struct job *job = calloc(1, sizeof(*job));
+	if (job == NULL) {
+		fclose(f);
+		return NULL;
+	}
+	job->block_size = block_size;
+
+	char line[1024];
+	int line_no = 0, cap = 0;
+	bool ok = true;
+
+	while (ok && fgets(line, sizeof(line), f) != NULL) {
+		line_no++;
+		line[strcspn(line, "#\r\n")] = '\0';
+
+		char *word[4];
+		int n_words = 0;
+		for (char *w = strtok(line, " \t"); w != NULL; w = strtok(NULL, " \t")) {
+			if (n_words == 4) {
+				n_words++;
+				break;
+			}
+			word[n_words++] = w;
+		}
+		if (n_words == 0)
+			continue;
+
+		struct step s;
+		memset(&s, 0, sizeof(s));
+		s.line = line_no;
+		long offset = 0, size = 0;
+		int args = n_words - 1;
+
+		if (!strcmp(word[0], "id") && args == 0) {
+			s.kind = STEP_ID;
+		} else if (!strcmp(word[0], "quad") && args == 0) {
+			s.kind = STEP_QUAD;
+		} else if (!strcmp(word[0], "unprotect") && args == 0) {
+			s.kind = STEP_UNPROTECT;
+		} else if (!strcmp(word[0], "erase") && args == 2 &&
+				parse_number(word[1], &offset) && parse_number(word[2], &size)) {
+			s.kind = STEP_ERASE;
+		} else if ((!strcmp(word[0], "program") || !strcmp(word[0], "verify")) &&
+				(args == 1 || (args == 2 && parse_number(word[2], &offset)))) {
+			s.kind = word[0][0] == 'p' ? STEP_PROGRAM : STEP_VERIFY;
+			s.file = word[1];
+		} else if (!strcmp(word[0], "read") && args == 3 &&
+				parse_number(word[2], &offset) && parse_number(word[3], &size)) {
+			s.kind = STEP_READ;
+			s.file = word[1];
+		} else {
+			fprintf(stderr, "%s: %s:%d: can't parse `%s' step\n", my_name, filename, line_no, word[0]);
+			ok = false;
+			break;
+		}
+		s.offset = offset;
+		s.size = size;
+
+		if (s.file != NULL) {
+			s.file = strdup(s.file);
+			if (s.file == NULL) {
+				ok = false;
+				break;
+			}
+		}
+
+		if (s.kind == STEP_PROGRAM || s.kind == STEP_VERIFY) {
+			s.data = read_file(s.file, &s.size);
+			if (s.data == NULL) {
+				fprintf(stderr, "%s: %s:%d: can't read '%s': %s\n", my_name, filename, line_no,
+						s.file, strerror(errno));
+				free(s.file);
+				ok = false;
+				break;
+			}
+		}
+
+		if (job->n_steps == cap) {
+			cap = cap ? 2 * cap : 16;
+			struct step *grown = realloc(job->steps, cap * sizeof(struct step));
+			if (grown == NULL) {
+				free(s.file);
+				free(s.data);
+				ok = false;
+				break;
+			}
+			job->steps = grown;
+		}
+		job->steps[job->n_steps++] = s;
+	}
+	fclose(f);
+
+	if (ok && job->n_steps == 0) {
+		fprintf(stderr, "%s: %s: no steps\n", my_name, filename);
+		ok = false;
+	}
+	if (ok)
+		ok = check_steps(job, filename, my_name);
+
+	if (!ok) {
+		job_free(job);
+		return NULL;
+	}
+	return job;
+}
+
+void job_free(struct job *job)
+{
+	if (job == NULL)
+		return;
+	for (int i = 0; i < job->n_steps; i++) {
+		free(job->steps[i].file);
+		free(job->steps[i].data);
+	}
+	free(job->steps);
+	free(job);
+}
+
+static int compare_range(const void *a, const void *b)
+{
+	const struct range *ra = a, *rb = b;
+	return ra->begin - rb->begin;
+}
+
+static int verify_step(const struct step *s)
+{
+	long diffs = 0;
+	int first = -1;
+
+	for (long pos = 0; pos < s->size; pos += JOB_CHUNK_SIZE) {
+		int n = s->size - pos > JOB_CHUNK_SIZE ? JOB_CHUNK_SIZE : s->size - pos;
+		log_progress(s->offset + pos, (int)(100LL * pos / s->size));
+		flash_fast_read(s->offset + pos, chunk_buffer, n);
+		stats_add_bytes(n);
+		if (!memcmp(chunk_buffer, s->data + pos, n))
+			continue;
+		for (int k = 0; k < n; k++) {
+			if (chunk_buffer[k] != s->data[pos + k]) {
+				if (first < 0)
+					first = s->offset + pos + k;
+				diffs++;
+			}
+		}
+	}
+	log_progress_done();
+
+	if (diffs) {
+		fprintf(stderr, "line %d: %ld bytes of '%s' differ, the first at 0x%06X\n",
+				s->line, diffs, s->file, first);
+		return 3;
+	}
+	fprintf(stderr, "line %d: VERIFY OK\n", s->line);
+	return 0;
+}
+
+static int run_batch(struct job *job, int first, int last, bool verify)
+{
+	struct range *ranges = malloc((last - first) * sizeof(struct range));
+	int n_ranges = 0;
+	if (ranges == NULL) {
+		fprintf(stderr, "Out of memory.\n");
+		return 1;
+	}
+
+	for (int i = first; i < last; i++)
+		if (job->steps[i].size > 0)
+			ranges[n_ranges++] = erase_range(&job->steps[i], job->block_size);
+
+	/* Merge overlapping and adjacent ranges, so every block is erased
+	   once however many steps cover it */
+	qsort(ranges, n_ranges, sizeof(struct range), compare_range);
+	int n_merged = 0;
+	for (int i = 0; i < n_ranges; i++) {
+		if (n_merged > 0 && ranges[i].begin <= ranges[n_merged - 1].end) {
+			if (ranges[i].end > ranges[n_merged - 1].end)
+				ranges[n_merged - 1].end = ranges[i].end;
+		} else {
+			ranges[n_merged++] = ranges[i];
+		}
+	}
+
+	stats_phase(PHASE_ERASE);
+	for (int i = 0; i < n_merged; i++) {
+		fprintf(stderr, "erase 0x%06X..0x%06X (lines %d-%d)\n", ranges[i].begin, ranges[i].end - 1,
+				job->steps[first].line, job->steps[last - 1].line);
+		for (int addr = ranges[i].begin; addr < ranges[i].end; addr += job->block_size) {
+			flash_erase_block(addr, job->block_size);
+			stats_add_bytes(job->block_size);
+		}
+	}
+	free(ranges);
+
+	stats_phase(PHASE_PROGRAM);
+	for (int i = first; i < last; i++) {
+		struct step *s = &job->steps[i];
+		if (s->kind != STEP_PROGRAM)
+			continue;
+
+		fprintf(stderr, "line %d: programming '%s' at 0x%06X..\n", s->line, s->file, s->offset);
+		for (int n, pos = 0; pos < s->size; pos += n) {
+			int addr = s->offset + pos;
+			n = 256 - addr % 256;
+			if (n > s->size - pos)
+				n = s->size - pos;
+			log_progress(addr, (int)(100LL * pos / s->size));
+			if (!flash_page_blank(s->data + pos, n)) {
+				flash_write_enable();
+				flash_prog(addr, s->data + pos, n);
+				flash_wait();
+			}
+			stats_add_bytes(n);
+		}
+		log_progress_done();
+	}
+
+	if (!verify)
+		return 0;
+
+	stats_phase(PHASE_VERIFY);
+	for (int i = first; i < last; i++) {
+		if (job->steps[i].kind != STEP_PROGRAM)
+			continue;
+		int rc = verify_step(&job->steps[i]);
+		if (rc)
+			return rc;
+	}
+	return 0;
+}
+
+static int read_step(const struct step *s)
+{
+	FILE *f = fopen(s->file, "wb");
+	if (f == NULL) {
+		fprintf(stderr, "line %d: can't open '%s' for writing: %s\n", s->line, s->file, strerror(errno));
+		return 1;
+	}
+
+	fprintf(stderr, "line %d: reading 0x%06X..0x%06lX to '%s'..\n", s->line,
+			s->offset, s->offset + s->size - 1, s->file);
+	for (long pos = 0; pos < s->size; pos += JOB_CHUNK_SIZE) {
+		int n = s->size - pos > JOB_CHUNK_SIZE ? JOB_CHUNK_SIZE : s->size - pos;
+		log_progress(s->offset + pos, (int)(100LL * pos / s->size));
+		flash_fast_read(s->offset + pos, chunk_buffer, n);
+		stats_add_bytes(n);
+		if (fwrite(chunk_buffer, 1, n, f) != (size_t)n) {
+			log_progress_done();
+			fprintf(stderr, "line %d: can't write '%s'\n", s->line, s->file);
+			fclose(f);
+			return 1;
+		}
+	}
+	log_progress_done();
+
+	if (fclose(f) != 0) {
+		fprintf(stderr, "line %d: can't write '%s': %s\n", s->line, s->file, strerror(errno));
+		return 1;
+	}
+	return 0;
+}
+
+int job_run(struct job *job, bool verify)
+{
+	for (int i = 0; i < job->n_steps; ) {
+		struct step *s = &job->steps[i];
+		int rc = 0;
+
+		if (is_write(s)) {
+			int last = i;
+			while (last < job->n_steps && is_write(&job->steps[last]))
+				last++;
+			rc = run_batch(job, i, last, verify);
+			if (rc)
+				return rc;
+			i = last;
+			continue;
+		}
+
+		switch (s->kind) {
+			case STEP_ID:
+				stats_phase(PHASE_ID);
+				flash_read_id();
+				break;
+			case STEP_QUAD:
+				flash_enable_quad();
+				break;
+			case STEP_UNPROTECT:
+				flash_write_enable();
+				flash_disable_protection();
+				break;
+			case STEP_VERIFY:
+				stats_phase(PHASE_VERIFY);
+				rc = verify_step(s);
+				break;
+			case STEP_READ:
+				stats_phase(PHASE_READ);
+				rc = read_step(s);
+				break;
+			default:
+				break;
+		}
+		if (rc)
+			return rc;
+		i++;
+	}
+	return 0;
+}
@@ -0,0 +1,53 @@
+/*
+ *  iceprog -- simple programming tool for FTDI-based Lattice iCE programmers
+ *
+ *  Permission to use, copy, modify, and/or distribute this software for any
+ *  purpose with or without fee is hereby granted, provided that the above
+ *  copyright notice and this permission notice appear in all copies.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ *  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ *  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ *  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ *  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ *  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#ifndef JOB_H
+#define JOB_H
+
+#include <stdbool.h>
+
+/* A job file runs several operations in one session: the programmer is
+ * opened, the flash reset and powered up once, and powered down once at
+ * the end. One step per line, '#' starts a comment, offsets and sizes
+ * take a 'k' or 'M' suffix:
+ *
+ *   id                           print the flash ID
+ *   quad                         set the QE bit
+ *   unprotect                    clear the status register protection
+ *   erase <offset> <size>        erase the blocks covering the range
+ *   program <file> [<offset>]    erase as needed, program and verify
+ *   verify <file> [<offset>]     compare the flash with the file
+ *   read <file> <offset> <size>  save a flash range to the file
+ *
+ * Consecutive erase and program steps are done together: the union of
+ * their erase blocks is erased first, each block once, then the files
+ * are programmed. Input files are read when the job is loaded, so a
+ * missing file is reported before the programmer is touched. */
+
+struct job;
+
+/* Parse the job file and read its input files. block_size is the erase
+ * block size in bytes. Returns NULL after printing an error. */
+struct job *job_load(const char *filename, int block_size, const char *my_name);
+
+/* Run the steps on the reset and powered up flash. Returns 0, or the
+ * exit status for mpsse_error() after a failed step. */
+int job_run(struct job *job, bool verify);
+
+void job_free(struct job *job);
+
+#endif /* JOB_H */
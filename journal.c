@@ -0,0 +1,276 @@
+/*
+ *  iceprog -- simple programming tool for FTDI-based Lattice iCE programmers
+ *
+ *  Permission to use, copy, modify, and/or distribute this software for any
+ *  purpose with or without fee is hereby granted, provided that the above
+ *  copyright notice and this permission notice appear in all copies.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ *  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ *  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ *  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ *  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ *  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <io.h> /* _commit() */
+#endif
+
+#include "journal.h"
+
+static FILE *journal_file = NULL;
+static char journal_path[1024];
+
+static int journal_offset;
+static int journal_block_size;
+static int journal_blocks;
+static enum journal_state journal_done_state;
+static uint8_t *journal_states = NULL;
+static bool journal_bulk;
+static int journal_last = -1;
+
+static int block_index(int addr)
+{
+	int index = (addr - (journal_offset & ~(journal_block_size - 1))) / journal_block_size;
+	return index >= 0 && index < journal_blocks ? index : -1;
+}
+
+static bool journal_sync(void)
+{
+	if (fflush(journal_file) != 0)
+		return false;
+#ifdef _WIN32
+	return _commit(_fileno(journal_file)) == 0;
+#else
+	return fsync(fileno(journal_file)) == 0;
+#endif
+}
+
+static void journal_write(char type, int addr)
+{
+	if (journal_file == NULL)
+		return;
+
+	if (addr < 0)
+		fprintf(journal_file, "%c\n", type);
+	else
+		fprintf(journal_file, "%c %06X\n", type, addr);
+
+	if (!journal_sync()) {
+		/* Keep programming, the worst case is a full run next time */
+		fprintf(stderr, "journal: can't write `%s': %s, journal disabled\n",
+				journal_path, strerror(errno));
+		fclose(journal_file);
+		journal_file = NULL;
+	}
+}
+
+/* Apply one record to the in-memory state */
+static void journal_apply(char type, int addr)
+{
+	int index = block_index(addr);
+	if (type == 'B') {
+		journal_bulk = true;
+		return;
+	}
+	if (index < 0)
+		return;
+
+	switch (type) {
+	case 'E':
+		journal_states[index] = JOURNAL_ERASED;
+		break;
+	case 'P':
+		journal_states[index] = JOURNAL_PROGRAMMED;
+		break;
+	case 'V':
+		journal_states[index] = JOURNAL_VERIFIED;
+		break;
+	case 'X':
+		journal_states[index] = JOURNAL_NONE;
+		if (journal_last == addr)
+			journal_last = -1;
+		return;
+	}
+	if (journal_states[index] >= journal_done_state)
+		journal_last = addr;
+}
+
+/* Read an existing journal. Returns false if it doesn't exist or belongs
+   to a different job. */
+static bool journal_load(const char *header)
+{
+	FILE *f = fopen(journal_path, "r");
+	if (f == NULL)
+		return false;
+
+	char line[256];
+	if (fgets(line, sizeof(line), f) == NULL || strcmp(line, header)) {
+		fclose(f);
+		fprintf(stderr, "journal: `%s' is for a different image, starting over\n", journal_path);
+		return false;
+	}
+
+	while (fgets(line, sizeof(line), f) != NULL) {
+		char type;
+		unsigned int addr;
+		int fields = sscanf(line, "%c %x", &type, &addr);
+		if (fields == 1 && type == 'B')
+			journal_apply(type, -1);
+		else if (fields == 2)
+			journal_apply(type, addr);
+		/* anything else is a line cut short by the crash */
+	}
+
+	fclose(f);
+	return true;
+}
+
+int journal_open(const char *dir, const char *serial, uint64_t uid,
+		uint64_t image_hash, long size, int offset, int block_size,
+		enum journal_state done_state)
+{
+#ifdef _WIN32
+	if (mkdir(dir) != 0 && errno != EEXIST) {
+#else
+	if (mkdir(dir, 0777) != 0 && errno != EEXIST) {
+#endif
+		fprintf(stderr, "journal: can't create directory `%s': %s\n", dir, strerror(errno));
+		return -1;
+	}
+
+	/* The serial comes from the USB descriptor, keep it file name safe */
+	char name[128];
+	snprintf(name, sizeof(name), "%s", serial[0] ? serial : "noserial");
+	for (char *p = name; *p; p++)
+		if (!((*p >= '0' && *p <= '9') || (*p >= 'A' && *p <= 'Z') ||
+				(*p >= 'a' && *p <= 'z') || *p == '-' || *p == '_'))
+			*p = '_';
+
+	snprintf(journal_path, sizeof(journal_path), "%s/%s-%016llX.journal",
+			dir, name, (unsigned long long)uid);
+
+	journal_offset = offset;
+	journal_block_size = block_size;
+	journal_done_state = done_state;
+	int begin = offset & ~(block_size - 1);
+	int end = (offset + size + block_size - 1) & ~(block_size - 1);
+	journal_blocks = (end - begin) / block_size;
+	journal_bulk = false;
+	journal_last = -1;
+
+	free(journal_states);
+	journal_states = calloc(journal_blocks > 0 ? journal_blocks : 1, 1);
+	if (journal_states == NULL) {
+		fprintf(stderr, "Out of memory.\n");
+		return -1;
+	}
+
+	char header[256];
+	snprintf(header, sizeof(header), "iceprog-journal 1 image=%016llX size=%ld offset=%d block=%d\n",
+			(unsigned long long)image_hash, size, offset, block_size);
+
+	bool resume = journal_load(header);
+	if (!resume) {
+		memset(journal_states, 0, journal_blocks);
+		journal_bulk = false;
+		journal_last = -1;
+	}
+
+	journal_file = fopen(journal_path, resume ? "a" : "w");
+	if (journal_file == NULL) {
+		fprintf(stderr, "journal: can't open `%s': %s\n", journal_path, strerror(errno));
+		return -1;
+	}
+	if (!resume)
+		fputs(header, journal_file);
+	if (!journal_sync()) {
+		fprintf(stderr, "journal: can't write `%s': %s\n", journal_path, strerror(errno));
+		fclose(journal_file);
+		journal_file = NULL;
+		return -1;
+	}
+
+	int done = 0;
+	for (int i = 0; i < journal_blocks; i++)
+		if (journal_states[i] >= done_state)
+			done++;
+	return done;
+}
+
+bool journal_active(void)
+{
+	return journal_file != NULL;
+}
+
+bool journal_done(int addr)
+{
+	if (journal_file == NULL)
+		return false;
+	int index = block_index(addr);
+	return index >= 0 && journal_states[index] >= journal_done_state;
+}
+
+bool journal_bulk_erased(void)
+{
+	return journal_file != NULL && journal_bulk;
+}
+
+int journal_last_done(void)
+{
+	return journal_file != NULL ? journal_last : -1;
+}
+
+void journal_reset_block(int addr)
+{
+	if (journal_file == NULL || block_index(addr) < 0)
+		return;
+	journal_apply('X', addr);
+	journal_write('X', addr);
+}
+
+void journal_record(int addr, enum journal_state state)
+{
+	static const char types[] = { '?', 'E', 'P', 'V' };
+
+	if (journal_file == NULL || block_index(addr) < 0 || state == JOURNAL_NONE)
+		return;
+	journal_apply(types[state], addr);
+	journal_write(types[state], addr);
+}
+
+void journal_record_bulk_erase(void)
+{
+	if (journal_file == NULL)
+		return;
+	journal_apply('B', -1);
+	journal_write('B', -1);
+}
+
+void journal_close(bool finished)
+{
+	if (journal_file == NULL)
+		return;
+
+	fclose(journal_file);
+	journal_file = NULL;
+	if (finished && remove(journal_path) != 0)
+		fprintf(stderr, "journal: can't remove `%s': %s\n", journal_path, strerror(errno));
+
+	free(journal_states);
+	journal_states = NULL;
+}
@@ -0,0 +1,67 @@
+/*
+ *  iceprog -- simple programming tool for FTDI-based Lattice iCE programmers
+ *
+ *  Permission to use, copy, modify, and/or distribute this software for any
+ *  purpose with or without fee is hereby granted, provided that the above
+ *  copyright notice and this permission notice appear in all copies.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ *  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ *  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ *  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ *  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ *  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* On-disk record of a block-wise programming session, so that a run that
+ * died half way can be picked up again. One text file per programmer and
+ * flash, <dir>/<serial>-<uid>.journal:
+ *
+ *   iceprog-journal 1 image=<hash> size=<n> offset=<n> block=<n>
+ *   B                  bulk erase done
+ *   E <addr>           block erased
+ *   P <addr>           block programmed
+ *   V <addr>           block verified
+ *   X <addr>           block contents no longer trusted
+ *
+ * Every line is synced to disk before the next block is touched. The
+ * journal is only reused if the header matches the current job. */
+
+enum journal_state {
+	JOURNAL_NONE,
+	JOURNAL_ERASED,
+	JOURNAL_PROGRAMMED,
+	JOURNAL_VERIFIED,
+};
+
+/* Open or create the journal. done_state is the state a block needs to
+ * reach to be skipped on resume. Returns the number of blocks that are
+ * already done, or -1 if the journal can't be written. */
+int journal_open(const char *dir, const char *serial, uint64_t uid,
+		uint64_t image_hash, long size, int offset, int block_size,
+		enum journal_state done_state);
+
+bool journal_active(void);
+bool journal_done(int addr);
+bool journal_bulk_erased(void);
+
+/* Address of the block that was completed last, -1 if there is none */
+int journal_last_done(void);
+
+/* Forget that a block was done, e.g. after a failed spot-verify */
+void journal_reset_block(int addr);
+
+void journal_record(int addr, enum journal_state state);
+void journal_record_bulk_erase(void);
+
+/* Close the journal. A finished session removes it. */
+void journal_close(bool finished);
+
+#endif /* JOURNAL_H */
@@ -0,0 +1,195 @@
+/*
+ *  iceprog -- simple programming tool for FTDI-based Lattice iCE programmers
+ *
+ *  Permission to use, copy, modify, and/or distribute this software for any
+ *  purpose with or without fee is hereby granted, provided that the above
+ *  copyright notice and this permission notice appear in all copies.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ *  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ *  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ *  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ *  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ *  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "log.h"
+#include "stats.h"
+
+#define LOG_BUFFER_SIZE (64 * 1024)
+
+/* Space kept free for one record, larger ones cause a flush first */
+#define LOG_RECORD_MAX 1024
+
+#define PROGRESS_INTERVAL_US 100000
+
+enum log_level log_levels[LOG_CATEGORIES] = {
+	LOG_INFO, LOG_INFO, LOG_INFO, LOG_INFO
+};
+
+int log_dump_limit = 32;
+
+static char log_buffer[LOG_BUFFER_SIZE];
+static size_t log_used = 0;
+static bool log_atexit_done = false;
+
+static uint64_t last_progress = 0;
+
+static const char *const level_names[] = {
+	"error", "warn", "info", "debug", "trace"
+};
+
+static const char *const category_names[LOG_CATEGORIES] = {
+	"main", "flash", "wait", "data"
+};
+
+void log_flush(void)
+{
+	if (log_used == 0)
+		return;
+	fwrite(log_buffer, 1, log_used, stderr);
+	log_used = 0;
+}
+
+void log_idle(void)
+{
+	if (log_used)
+		log_flush();
+}
+
+void log_write(enum log_level level, const char *fmt, ...)
+{
+	va_list ap;
+
+	if (level <= LOG_INFO) {
+		log_flush();
+		va_start(ap, fmt);
+		vfprintf(stderr, fmt, ap);
+		va_end(ap);
+		fputc('\n', stderr);
+		return;
+	}
+
+	if (!log_atexit_done) {
+		atexit(log_flush);
+		log_atexit_done = true;
+	}
+
+	if (LOG_BUFFER_SIZE - log_used < LOG_RECORD_MAX)
+		log_flush();
+
+	size_t space = LOG_BUFFER_SIZE - log_used - 1;
+	va_start(ap, fmt);
+	int len = vsnprintf(log_buffer + log_used, space, fmt, ap);
+	va_end(ap);
+	if (len < 0)
+		return;
+	if ((size_t)len >= space)
+		len = space - 1;
+	log_used += len;
+	log_buffer[log_used++] = '\n';
+}
+
+void log_hexdump(enum log_category cat, const uint8_t *data, int n)
+{
+	static const char hex[] = "0123456789abcdef";
+	char line[32 * 3 + 1];
+
+	if (!log_enabled(cat, LOG_DEBUG))
+		return;
+
+	int shown = n;
+	if (log_dump_limit >= 0 && shown > log_dump_limit)
+		shown = log_dump_limit;
+	if (shown == 0)
+		return;
+
+	for (int i = 0; i < shown; i += 32) {
+		int len = 0;
+		for (int k = i; k < shown && k < i + 32; k++) {
+			line[len++] = hex[data[k] >> 4];
+			line[len++] = hex[data[k] & 15];
+			line[len++] = ' ';
+		}
+		line[len - 1] = '\0';
+		log_write(LOG_DEBUG, "%s", line);
+	}
+	if (shown < n)
+		log_write(LOG_DEBUG, "... %d more bytes", n - shown);
+}
+
+void log_set_all(enum log_level level)
+{
+	for (int i = 0; i < LOG_CATEGORIES; i++)
+		log_levels[i] = level;
+}
+
+static int find_name(const char *name, size_t len, const char *const *names, int count)
+{
+	for (int i = 0; i < count; i++)
+		if (strlen(names[i]) == len && !strncmp(name, names[i], len))
+			return i;
+	return -1;
+}
+
+bool log_configure(const char *spec)
+{
+	enum log_level levels[LOG_CATEGORIES];
+	memcpy(levels, log_levels, sizeof(levels));
+
+	while (*spec) {
+		size_t len = strcspn(spec, ",");
+		const char *eq = memchr(spec, '=', len);
+		const char *level_name = eq ? eq + 1 : spec;
+		size_t level_len = len - (level_name - spec);
+
+		int level = find_name(level_name, level_len, level_names, LOG_TRACE + 1);
+		if (level < 0)
+			return false;
+
+		if (eq == NULL || (eq - spec == 3 && !strncmp(spec, "all", 3))) {
+			for (int i = 0; i < LOG_CATEGORIES; i++)
+				levels[i] = level;
+		} else {
+			int cat = find_name(spec, eq - spec, category_names, LOG_CATEGORIES);
+			if (cat < 0)
+				return false;
+			levels[cat] = level;
+		}
+
+		spec += len;
+		if (*spec == ',')
+			spec++;
+	}
+
+	memcpy(log_levels, levels, sizeof(levels));
+	return true;
+}
+
+void log_progress(int addr, int percent)
+{
+	uint64_t now = stats_time_us();
+	if (last_progress != 0 && now - last_progress < PROGRESS_INTERVAL_US)
+		return;
+	last_progress = now;
+
+	log_flush();
+	if (percent >= 0)
+		fprintf(stderr, "                      \raddr 0x%06X %3d%%\r", addr, percent);
+	else
+		fprintf(stderr, "                      \raddr 0x%06X\r", addr);
+}
+
+void log_progress_done(void)
+{
+	last_progress = 0;
+	log_flush();
+	fprintf(stderr, "                      \r");
+}
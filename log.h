@@ -0,0 +1,95 @@
+/*
+ *  iceprog -- simple programming tool for FTDI-based Lattice iCE programmers
+ *
+ *  Permission to use, copy, modify, and/or distribute this software for any
+ *  purpose with or without fee is hereby granted, provided that the above
+ *  copyright notice and this permission notice appear in all copies.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ *  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ *  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ *  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ *  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ *  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#ifndef LOG_H
+#define LOG_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Diagnostics with levels and per-subsystem categories.
+ *
+ * Records at LOG_INFO and above are written to stderr at once, in order
+ * with the rest of the output. LOG_DEBUG and LOG_TRACE records are
+ * formatted into a memory buffer instead, which log_flush() writes out:
+ * from log_idle() while the flash is busy, when the buffer fills up,
+ * before anything that is written directly, and at exit.
+ *
+ * Records are single lines without the trailing newline. Arguments are
+ * only evaluated when the category is enabled at that level.
+ */
+enum log_level {
+	LOG_ERROR,
+	LOG_WARN,
+	LOG_INFO,
+	LOG_DEBUG,
+	LOG_TRACE
+};
+
+enum log_category {
+	LOG_MAIN,   /* iceprog itself */
+	LOG_FLASH,  /* flash commands and status */
+	LOG_WAIT,   /* busy polling in flash_wait() */
+	LOG_DATA,   /* hex dumps of data sent to and read from the flash */
+	LOG_CATEGORIES
+};
+
+extern enum log_level log_levels[LOG_CATEGORIES];
+
+/* Hex dumps show at most this many bytes (default 32, -1 for no limit) */
+extern int log_dump_limit;
+
+#define log_enabled(cat, level) ((level) <= log_levels[cat])
+
+#define log_at(cat, level, ...) \
+	do { \
+		if (log_enabled(cat, level)) \
+			log_write(level, __VA_ARGS__); \
+	} while (0)
+
+#define log_error(cat, ...) log_at(cat, LOG_ERROR, __VA_ARGS__)
+#define log_warn(cat, ...)  log_at(cat, LOG_WARN, __VA_ARGS__)
+#define log_info(cat, ...)  log_at(cat, LOG_INFO, __VA_ARGS__)
+#define log_debug(cat, ...) log_at(cat, LOG_DEBUG, __VA_ARGS__)
+#define log_trace(cat, ...) log_at(cat, LOG_TRACE, __VA_ARGS__)
+
+void log_write(enum log_level level, const char *fmt, ...);
+
+/* Dump data at LOG_DEBUG, 32 bytes per line, cut to log_dump_limit */
+void log_hexdump(enum log_category cat, const uint8_t *data, int n);
+
+/* Set every category to level */
+void log_set_all(enum log_level level);
+
+/* Parse "<level>" or "<category>=<level>[,...]", with category one of
+ * all, main, flash, wait, data and level one of error, warn, info, debug,
+ * trace. Returns false on a malformed spec. */
+bool log_configure(const char *spec);
+
+/* Show "addr 0x...... nn%" on a self-overwriting line, at most ten times
+ * a second. percent < 0 leaves out the percentage. log_progress_done()
+ * clears the line. */
+void log_progress(int addr, int percent);
+void log_progress_done(void);
+
+/* Write out buffered records */
+void log_flush(void);
+
+/* Called while waiting on the flash: a good time to write out records */
+void log_idle(void);
+
+#endif /* LOG_H */
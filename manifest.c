@@ -0,0 +1,163 @@
+/*
+ *  iceprog -- simple programming tool for FTDI-based Lattice iCE programmers
+ *
+ *  Permission to use, copy, modify, and/or distribute this software for any
+ *  purpose with or without fee is hereby granted, provided that the above
+ *  copyright notice and this permission notice appear in all copies.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ *  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ *  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ *  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ *  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ *  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "manifest.h"
+
+struct manifest_entry {
+	int addr;
+	uint64_t hash;
+};
+
+static char manifest_path[1024];
+static int manifest_block_size;
+static struct manifest_entry *entries = NULL;
+static int n_entries = 0;
+
+static struct manifest_entry *find(int addr)
+{
+	for (int i = 0; i < n_entries; i++)
+		if (entries[i].addr == addr)
+			return &entries[i];
+	return NULL;
+}
+
+static int cmp_entry(const void *a, const void *b)
+{
+	const struct manifest_entry *x = a, *y = b;
+	return (x->addr > y->addr) - (x->addr < y->addr);
+}
+
+bool manifest_load(const char *dir, uint64_t uid, int block_size)
+{
+#ifdef _WIN32
+	if (mkdir(dir) != 0 && errno != EEXIST) {
+#else
+	if (mkdir(dir, 0777) != 0 && errno != EEXIST) {
+#endif
+		fprintf(stderr, "manifest: can't create directory `%s': %s\n", dir, strerror(errno));
+		return false;
+	}
+
+	snprintf(manifest_path, sizeof(manifest_path), "%s/%016llX.manifest",
+			dir, (unsigned long long)uid);
+	manifest_block_size = block_size;
+	n_entries = 0;
+
+	FILE *f = fopen(manifest_path, "r");
+	if (f == NULL)
+		return true;
+
+	char line[256];
+	int file_block_size;
+	if (fgets(line, sizeof(line), f) == NULL ||
+			sscanf(line, "iceprog-manifest 1 block=%d", &file_block_size) != 1) {
+		fprintf(stderr, "manifest: `%s' is not a manifest, ignoring it\n", manifest_path);
+		fclose(f);
+		return true;
+	}
+	if (file_block_size != block_size) {
+		fprintf(stderr, "manifest: `%s' uses %d kB blocks, ignoring it\n",
+				manifest_path, file_block_size >> 10);
+		fclose(f);
+		return true;
+	}
+
+	while (fgets(line, sizeof(line), f) != NULL) {
+		unsigned int addr;
+		unsigned long long hash;
+		if (sscanf(line, "%x %llx", &addr, &hash) == 2)
+			manifest_set(addr, hash);
+	}
+
+	fclose(f);
+	return true;
+}
+
+bool manifest_lookup(int addr, uint64_t *hash)
+{
+	struct manifest_entry *e = find(addr);
+	if (e == NULL)
+		return false;
+	*hash = e->hash;
+	return true;
+}
+
+void manifest_set(int addr, uint64_t hash)
+{
+	struct manifest_entry *e = find(addr);
+	if (e == NULL) {
+		struct manifest_entry *grown = realloc(entries, (n_entries + 1) * sizeof(*entries));
+		if (grown == NULL) {
+			/* Not fatal, the block just won't be skipped next time */
+			fprintf(stderr, "Out of memory.\n");
+			return;
+		}
+		entries = grown;
+		e = &entries[n_entries++];
+		e->addr = addr;
+	}
+	e->hash = hash;
+}
+
+void manifest_forget(int addr)
+{
+	struct manifest_entry *e = find(addr);
+	if (e != NULL)
+		*e = entries[--n_entries];
+}
+
+bool manifest_save(void)
+{
+	char tmp_path[sizeof(manifest_path) + 4];
+	snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", manifest_path);
+
+	FILE *f = fopen(tmp_path, "w");
+	if (f == NULL) {
+		fprintf(stderr, "manifest: can't write `%s': %s\n", tmp_path, strerror(errno));
+		return false;
+	}
+
+	qsort(entries, n_entries, sizeof(*entries), cmp_entry);
+	fprintf(f, "iceprog-manifest 1 block=%d\n", manifest_block_size);
+	for (int i = 0; i < n_entries; i++)
+		fprintf(f, "%06X %016llX\n", entries[i].addr, (unsigned long long)entries[i].hash);
+
+	if (fclose(f) != 0) {
+		fprintf(stderr, "manifest: can't write `%s': %s\n", tmp_path, strerror(errno));
+		remove(tmp_path);
+		return false;
+	}
+
+#ifdef _WIN32
+	/* rename() doesn't replace existing files on Windows */
+	remove(manifest_path);
+#endif
+	if (rename(tmp_path, manifest_path) != 0) {
+		fprintf(stderr, "manifest: can't replace `%s': %s\n", manifest_path, strerror(errno));
+		remove(tmp_path);
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,44 @@
+/*
+ *  iceprog -- simple programming tool for FTDI-based Lattice iCE programmers
+ *
+ *  Permission to use, copy, modify, and/or distribute this software for any
+ *  purpose with or without fee is hereby granted, provided that the above
+ *  copyright notice and this permission notice appear in all copies.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ *  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ *  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ *  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ *  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ *  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef MANIFEST_H
+#define MANIFEST_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Host-side record of what is on each flash iceprog has programmed and
+ * verified, one text file per flash unique ID, <dir>/<uid>.manifest:
+ *
+ *   iceprog-manifest 1 block=<n>
+ *   <addr> <hash>      FNV-1a hash of the whole erase block
+ *
+ * Nothing stops other tools from changing the flash, so the entries are
+ * only hints that have to be confirmed by reading some blocks back. */
+
+/* Load the manifest for a flash. A missing file or one written with a
+ * different block size gives an empty manifest. Returns false if the
+ * directory can't be created. */
+bool manifest_load(const char *dir, uint64_t uid, int block_size);
+
+bool manifest_lookup(int addr, uint64_t *hash);
+void manifest_set(int addr, uint64_t hash);
+void manifest_forget(int addr);
+
+/* Write the manifest back, replacing the old file atomically */
+bool manifest_save(void);
+
+#endif /* MANIFEST_H */
@@ -0,0 +1,296 @@
+/*
+ *  iceprog -- simple programming tool for FTDI-based Lattice iCE programmers
+ *
+ *  Permission to use, copy, modify, and/or distribute this software for any
+ *  purpose with or without fee is hereby granted, provided that the above
+ *  copyright notice and this permission notice appear in all copies.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ *  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ *  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ *  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ *  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ *  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "iceprog_fn.h"
+#include "metrics.h"
+#include "mpsse.h"
+#include "stats.h"
+
+struct metrics_sample {
+	char *key;		/* name{labels} */
+	double value;
+};
+
+struct metrics_family {
+	const char *name;
+	const char *type;
+	const char *help;
+};
+
+static const struct metrics_family families[] = {
+	{ "iceprog_jobs_total", "counter", "Runs of iceprog." },
+	{ "iceprog_failures_total", "counter", "Failed runs by exit status." },
+	{ "iceprog_programmed_bytes_total", "counter", "Bytes programmed into flash or SRAM." },
+	{ "iceprog_verified_bytes_total", "counter", "Bytes read back and compared." },
+	{ "iceprog_flash_wait_polls_total", "counter", "Status register reads while the flash was busy." },
+	{ "iceprog_retries_total", "counter", "Erase blocks redone after a failure." },
+	{ "iceprog_phase_duration_seconds", "histogram", "Time spent per phase." },
+};
+
+static const char *duration_buckets[] = { "0.1", "0.25", "0.5", "1", "2.5", "5", "10", "25", "50", "100" };
+
+static const char *metrics_filename = NULL;
+static char metrics_serial[128];
+static unsigned long metrics_retries = 0;
+static bool metrics_finished = false;
+
+static struct metrics_sample *samples = NULL;
+static int n_samples = 0;
+
+static bool add(const char *key, double value)
+{
+	for (int i = 0; i < n_samples; i++) {
+		if (!strcmp(samples[i].key, key)) {
+			samples[i].value += value;
+			return true;
+		}
+	}
+
+	struct metrics_sample *grown = realloc(samples, (n_samples + 1) * sizeof(*samples));
+	if (grown == NULL)
+		return false;
+	samples = grown;
+	samples[n_samples].key = strdup(key);
+	if (samples[n_samples].key == NULL)
+		return false;
+	samples[n_samples++].value = value;
+	return true;
+}
+
+/* Pick up the counters of earlier runs. Only sample lines are read, the
+ * comments are written anew. */
+static bool load(const char *filename)
+{
+	FILE *f = fopen(filename, "r");
+	if (f == NULL)
+		return errno == ENOENT;
+
+	char line[1024];
+	bool ok = true;
+	while (ok && fgets(line, sizeof(line), f) != NULL) {
+		line[strcspn(line, "\r\n")] = '\0';
+		if (strncmp(line, "iceprog_", 8))
+			continue;
+
+		char *space = strrchr(line, ' ');
+		if (space == NULL)
+			continue;
+		*space = '\0';
+		ok = add(line, strtod(space + 1, NULL));
+	}
+
+	fclose(f);
+	return ok;
+}
+
+/* The sample name is the family name, plus a suffix for histograms */
+static bool in_family(const char *key, const struct metrics_family *family)
+{
+	size_t len = strlen(family->name);
+	if (strncmp(key, family->name, len))
+		return false;
+	key += len;
+	if (!strcmp(family->type, "histogram")) {
+		if (!strncmp(key, "_bucket", 7))
+			key += 7;
+		else if (!strncmp(key, "_count", 6))
+			key += 6;
+		else if (!strncmp(key, "_sum", 4))
+			key += 4;
+	}
+	return *key == '{' || *key == '\0';
+}
+
+static bool save(const char *filename)
+{
+	char tmp_path[1024];
+	snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", filename);
+
+	FILE *f = fopen(tmp_path, "w");
+	if (f == NULL) {
+		fprintf(stderr, "metrics: can't write `%s': %s\n", tmp_path, strerror(errno));
+		return false;
+	}
+
+	/* Samples keep the order they were added in, which holds the
+	   buckets of one histogram together */
+	int n_families = sizeof(families) / sizeof(families[0]);
+	for (int i = 0; i < n_families; i++) {
+		bool header = false;
+		for (int j = 0; j < n_samples; j++) {
+			if (!in_family(samples[j].key, &families[i]))
+				continue;
+			if (!header) {
+				fprintf(f, "# HELP %s %s\n", families[i].name, families[i].help);
+				fprintf(f, "# TYPE %s %s\n", families[i].name, families[i].type);
+				header = true;
+			}
+			fprintf(f, "%s %.15g\n", samples[j].key, samples[j].value);
+		}
+	}
+
+	if (fclose(f) != 0) {
+		fprintf(stderr, "metrics: can't write `%s': %s\n", tmp_path, strerror(errno));
+		remove(tmp_path);
+		return false;
+	}
+
+#ifdef _WIN32
+	/* rename() doesn't replace existing files on Windows */
+	remove(filename);
+#endif
+	if (rename(tmp_path, filename) != 0) {
+		fprintf(stderr, "metrics: can't replace `%s': %s\n", filename, strerror(errno));
+		remove(tmp_path);
+		return false;
+	}
+	return true;
+}
+
+/* Label values may hold anything but backslash, quote and newline */
+static void escape(char *out, size_t size, const char *in)
+{
+	size_t n = 0;
+	for (; *in != '\0' && n + 3 < size; in++) {
+		if (*in == '\\' || *in == '"') {
+			out[n++] = '\\';
+			out[n++] = *in;
+		} else if (*in == '\n') {
+			out[n++] = '\\';
+			out[n++] = 'n';
+		} else {
+			out[n++] = *in;
+		}
+	}
+	out[n] = '\0';
+}
+
+static void metrics_write(void)
+{
+	stats_phase(PHASE_NONE);
+
+#ifndef _WIN32
+	/* Station boards finish at about the same time, each one has to see
+	   the counts of the others */
+	char lock_path[1024];
+	snprintf(lock_path, sizeof(lock_path), "%s.lock", metrics_filename);
+	int lock = open(lock_path, O_RDWR | O_CREAT, 0666);
+	struct flock fl = { .l_type = F_WRLCK, .l_whence = SEEK_SET };
+	if (lock < 0 || fcntl(lock, F_SETLKW, &fl) != 0)
+		fprintf(stderr, "metrics: can't lock `%s': %s\n", lock_path, strerror(errno));
+#endif
+
+	if (!load(metrics_filename)) {
+		fprintf(stderr, "metrics: can't read `%s', not updating it\n", metrics_filename);
+		goto out;
+	}
+
+	char serial[256], labels[512], key[1024];
+	escape(serial, sizeof(serial), metrics_serial);
+	if (flash_jedec_id != 0)
+		snprintf(labels, sizeof(labels), "serial=\"%s\",jedec_id=\"%06X\"", serial, flash_jedec_id);
+	else
+		snprintf(labels, sizeof(labels), "serial=\"%s\",jedec_id=\"\"", serial);
+
+	/* Early returns from main() don't go through mpsse_error() */
+	int status = mpsse_exit_status;
+	if (status == 0 && !metrics_finished)
+		status = 1;
+
+	bool ok = true;
+
+#define ADD(value, ...) do { \
+		snprintf(key, sizeof(key), __VA_ARGS__); \
+		ok = ok && add(key, value); \
+	} while (0)
+
+	ADD(1, "iceprog_jobs_total{%s}", labels);
+	for (int code = 1; code <= 3; code++)
+		ADD(status == code, "iceprog_failures_total{%s,code=\"%d\"}", labels, code);
+	ADD(stats[PHASE_PROGRAM].bytes + stats[PHASE_SRAM].bytes, "iceprog_programmed_bytes_total{%s}", labels);
+	ADD(stats[PHASE_VERIFY].bytes, "iceprog_verified_bytes_total{%s}", labels);
+	ADD(flash_wait_polls, "iceprog_flash_wait_polls_total{%s}", labels);
+	ADD(metrics_retries, "iceprog_retries_total{%s}", labels);
+
+	int n_buckets = sizeof(duration_buckets) / sizeof(duration_buckets[0]);
+	for (int i = 0; i < PHASE_COUNT; i++) {
+		if (stats[i].time_us == 0)
+			continue;
+		const char *phase = stats_phase_name(i);
+		double seconds = stats[i].time_us / 1e6;
+		for (int j = 0; j < n_buckets; j++)
+			ADD(seconds <= atof(duration_buckets[j]),
+					"iceprog_phase_duration_seconds_bucket{%s,phase=\"%s\",le=\"%s\"}",
+					labels, phase, duration_buckets[j]);
+		ADD(1, "iceprog_phase_duration_seconds_bucket{%s,phase=\"%s\",le=\"+Inf\"}", labels, phase);
+		ADD(seconds, "iceprog_phase_duration_seconds_sum{%s,phase=\"%s\"}", labels, phase);
+		ADD(1, "iceprog_phase_duration_seconds_count{%s,phase=\"%s\"}", labels, phase);
+	}
+
+#undef ADD
+
+	if (!ok)
+		fprintf(stderr, "metrics: out of memory, not updating `%s'\n", metrics_filename);
+	else
+		save(metrics_filename);
+
+out:
+#ifndef _WIN32
+	if (lock >= 0)
+		close(lock);
+#endif
+	for (int i = 0; i < n_samples; i++)
+		free(samples[i].key);
+	free(samples);
+	samples = NULL;
+	n_samples = 0;
+}
+
+void metrics_enable(const char *filename)
+{
+	metrics_filename = filename;
+	atexit(metrics_write);
+}
+
+void metrics_set_serial(const char *serial)
+{
+	snprintf(metrics_serial, sizeof(metrics_serial), "%s", serial);
+}
+
+void metrics_retry(void)
+{
+	metrics_retries++;
+}
+
+void metrics_done(void)
+{
+	metrics_finished = true;
+}
@@ -0,0 +1,47 @@
+/*
+ *  iceprog -- simple programming tool for FTDI-based Lattice iCE programmers
+ *
+ *  Permission to use, copy, modify, and/or distribute this software for any
+ *  purpose with or without fee is hereby granted, provided that the above
+ *  copyright notice and this permission notice appear in all copies.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ *  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ *  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ *  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ *  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ *  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#ifndef METRICS_H
+#define METRICS_H
+
+/* --metrics-file: counters for node_exporter's textfile collector. Every
+ * run adds itself to the counters already in the file, and the file is
+ * replaced in one rename() so the collector never sees half of it. The
+ * series are labeled with the programmer serial and the flash JEDEC ID:
+ *
+ *   iceprog_jobs_total                  runs
+ *   iceprog_failures_total{code}        failed runs by exit status
+ *   iceprog_programmed_bytes_total
+ *   iceprog_verified_bytes_total
+ *   iceprog_flash_wait_polls_total      status register polls
+ *   iceprog_retries_total               blocks redone (--retries)
+ *   iceprog_phase_duration_seconds      histogram per phase
+ */
+
+/* Update the file when the program exits */
+void metrics_enable(const char *filename);
+
+/* Label the run with the programmer, after mpsse_init() */
+void metrics_set_serial(const char *serial);
+
+void metrics_retry(void);
+
+/* The run got to the end. Without this, exiting counts as a failure
+ * (code 1) unless mpsse_error() gave another code. */
+void metrics_done(void);
+
+#endif /* METRICS_H */
@@ -41,8 +41,13 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "mpsse.h"
+#include "probes.h"
+#include "sim.h"
+#include "stats.h"
+#include "trace.h"
 
 // ---------------------------------------------------------
 // MPSSE / FTDI definitions
@@ -66,89 +71,155 @@ bool mpsse_ftdic_open = false;
 bool mpsse_ftdic_latency_set = false;
 unsigned char mpsse_ftdi_latency;
 
-/* MPSSE engine command definitions */
-enum mpsse_cmd
-{
-	/* Mode commands */
-	MC_SETB_LOW = 0x80, /* Set Data bits LowByte */
-	MC_READB_LOW = 0x81, /* Read Data bits LowByte */
-	MC_SETB_HIGH = 0x82, /* Set Data bits HighByte */
-	MC_READB_HIGH = 0x83, /* Read data bits HighByte */
-	MC_LOOPBACK_EN = 0x84, /* Enable loopback */
-	MC_LOOPBACK_DIS = 0x85, /* Disable loopback */
-	MC_SET_CLK_DIV = 0x86, /* Set clock divisor */
-	MC_FLUSH = 0x87, /* Flush buffer fifos to the PC. */
-	MC_WAIT_H = 0x88, /* Wait on GPIOL1 to go high. */
-	MC_WAIT_L = 0x89, /* Wait on GPIOL1 to go low. */
-	MC_TCK_X5 = 0x8A, /* Disable /5 div, enables 60MHz master clock */
-	MC_TCK_D5 = 0x8B, /* Enable /5 div, backward compat to FT2232D */
-	MC_EN_3PH_CLK = 0x8C, /* Enable 3 phase clk, DDR I2C */
-	MC_DIS_3PH_CLK = 0x8D, /* Disable 3 phase clk */
-	MC_CLK_N = 0x8E, /* Clock every bit, used for JTAG */
-	MC_CLK_N8 = 0x8F, /* Clock every byte, used for JTAG */
-	MC_CLK_TO_H = 0x94, /* Clock until GPIOL1 goes high */
-	MC_CLK_TO_L = 0x95, /* Clock until GPIOL1 goes low */
-	MC_EN_ADPT_CLK = 0x96, /* Enable adaptive clocking */
-	MC_DIS_ADPT_CLK = 0x97, /* Disable adaptive clocking */
-	MC_CLK8_TO_H = 0x9C, /* Clock until GPIOL1 goes high, count bytes */
-	MC_CLK8_TO_L = 0x9D, /* Clock until GPIOL1 goes low, count bytes */
-	MC_TRI = 0x9E, /* Set IO to only drive on 0 and tristate on 1 */
-	/* CPU mode commands */
-	MC_CPU_RS = 0x90, /* CPUMode read short address */
-	MC_CPU_RE = 0x91, /* CPUMode read extended address */
-	MC_CPU_WS = 0x92, /* CPUMode write short address */
-	MC_CPU_WE = 0x93, /* CPUMode write extended address */
+struct mpsse_counters mpsse_counters;
+int mpsse_exit_status = 0;
+
+// ---------------------------------------------------------
+// MPSSE / FTDI function implementations
+// ---------------------------------------------------------
+
+static int ftdi_transport_write(const uint8_t *data, int n)
+{
+	return ftdi_write_data(&mpsse_ftdic, data, n);
+}
+
+static int ftdi_transport_read(uint8_t *data, int n)
+{
+	return ftdi_read_data(&mpsse_ftdic, data, n);
+}
+
+static void ftdi_transport_close(void)
+{
+	ftdi_set_latency_timer(&mpsse_ftdic, mpsse_ftdi_latency);
+	ftdi_disable_bitbang(&mpsse_ftdic);
+	ftdi_usb_close(&mpsse_ftdic);
+	ftdi_deinit(&mpsse_ftdic);
+}
+
+static const struct mpsse_transport ftdi_transport = {
+	ftdi_transport_write,
+	ftdi_transport_read,
+	ftdi_transport_close,
 };
 
-/* Transfer Command bits */
+static const struct mpsse_transport replay_transport = {
+	trace_replay_write,
+	trace_replay_read,
+	trace_replay_close,
+};
 
-/* All byte based commands consist of:
- * - Command byte
- * - Length lsb
- * - Length msb
- *
- * If data out is enabled the data follows after the above command bytes,
- * otherwise no additional data is needed.
- * - Data * n
- *
- * All bit based commands consist of:
- * - Command byte
- * - Length
- *
- * If data out is enabled a byte containing bitst to transfer follows.
- * Otherwise no additional data is needed. Only up to 8 bits can be transferred
- * per transaction when in bit mode.
- */
+static const struct mpsse_transport *mpsse_transport = &ftdi_transport;
 
-/* b 0000 0000
- *   |||| |||`- Data out negative enable. Update DO on negative clock edge.
- *   |||| ||`-- Bit count enable. When reset count represents bytes.
- *   |||| |`--- Data in negative enable. Latch DI on negative clock edge.
- *   |||| `---- LSB enable. When set clock data out LSB first.
- *   ||||
- *   |||`------ Data out enable
- *   ||`------- Data in enable
- *   |`-------- TMS mode enable
- *   `--------- Special command mode enable. See mpsse_cmd enum.
- */
+/* All USB traffic goes through these two so it can be accounted for. */
+static int mpsse_usb_write(const uint8_t *data, int n)
+{
+	mpsse_counters.writes++;
+	PROBE_USB_SUBMIT(0, n);
+	int rc = mpsse_transport->write(data, n);
+	PROBE_USB_COMPLETE(0, rc);
+	if (rc > 0)
+		mpsse_counters.write_bytes += rc;
+	trace_log_write(data, n, rc);
+	return rc;
+}
 
-#define MC_DATA_TMS  (0x40) /* When set use TMS mode */
-#define MC_DATA_IN   (0x20) /* When set read data (Data IN) */
-#define MC_DATA_OUT  (0x10) /* When set write data (Data OUT) */
-#define MC_DATA_LSB  (0x08) /* When set input/output data LSB first. */
-#define MC_DATA_ICN  (0x04) /* When set receive data on negative clock edge */
-#define MC_DATA_BITS (0x02) /* When set count bits not bytes */
-#define MC_DATA_OCN  (0x01) /* When set update data on negative clock edge */
+static int mpsse_usb_read(uint8_t *data, int n)
+{
+	mpsse_counters.reads++;
+	PROBE_USB_SUBMIT(1, n);
+	int rc = mpsse_transport->read(data, n);
+	PROBE_USB_COMPLETE(1, rc);
+	if (rc > 0)
+		mpsse_counters.read_bytes += rc;
+	trace_log_read(data, n, rc);
+	return rc;
+}
 
-// ---------------------------------------------------------
-// MPSSE / FTDI function implementations
-// ---------------------------------------------------------
+/* With mpsse_set_recoverable(true), USB failures don't abort. The first
+ * one is kept in mpsse_status, and until mpsse_clear_error() or
+ * mpsse_reconnect() all further I/O is skipped and reads return zeros,
+ * so the flash functions run to their end and the caller can check
+ * mpsse_get_error(). */
+static bool mpsse_recoverable = false;
+static int mpsse_status = 0;
+
+/* Settings to restore on mpsse_reconnect() */
+static int mpsse_ifnum;
+static const char *mpsse_devstr;
+static bool mpsse_slow_clock;
+static bool mpsse_max_clock = false;
+static int mpsse_latency_ms = 1;
+static int mpsse_read_chunk, mpsse_write_chunk;
+
+/* Low byte pin directions last queued, -1 until the first
+ * mpsse_set_gpio() of a session: after a (re)open the pins are whatever
+ * the device reset them to */
+static int mpsse_gpio_direction = -1;
+
+/* Reads that make no progress for this long count as failed, only
+ * checked in recoverable mode */
+#define MPSSE_READ_TIMEOUT_US 2000000
+
+static void mpsse_io_error(int status)
+{
+	if (!mpsse_recoverable)
+		mpsse_error(status);
+	if (mpsse_status == 0)
+		mpsse_status = status;
+}
+
+/* Commands and payload are collected here and go out as one USB write
+ * when the buffer is full, before anything is read back, or on an
+ * explicit mpsse_flush(). mpsse_wbuf_size follows the libftdi write
+ * chunk size. */
+static uint8_t mpsse_wbuf[65536];
+static int mpsse_wbuf_len = 0;
+static int mpsse_wbuf_size = 4096;
+
+void mpsse_flush(void)
+{
+	if (mpsse_wbuf_len == 0)
+		return;
+
+	int n = mpsse_wbuf_len;
+	mpsse_wbuf_len = 0;
+
+	if (mpsse_status)
+		return;
+
+	int rc = mpsse_usb_write(mpsse_wbuf, n);
+	if (rc != n) {
+		fprintf(stderr, "Write error (chunk, rc=%d, expected %d).\n", rc, n);
+		mpsse_io_error(2);
+	}
+}
+
+static void mpsse_queue(const uint8_t *data, int n)
+{
+	while (n > 0) {
+		int len = mpsse_wbuf_size - mpsse_wbuf_len;
+		if (len > n)
+			len = n;
+		memcpy(mpsse_wbuf + mpsse_wbuf_len, data, len);
+		mpsse_wbuf_len += len;
+		data += len;
+		n -= len;
+		if (mpsse_wbuf_len == mpsse_wbuf_size)
+			mpsse_flush();
+	}
+}
+
+static bool mpsse_is_hispeed(void)
+{
+	return mpsse_ftdic.type == TYPE_2232H || mpsse_ftdic.type == TYPE_4232H || mpsse_ftdic.type == TYPE_232H;
+}
 
 void mpsse_check_rx()
 {
+	mpsse_flush();
 	while (1) {
 		uint8_t data;
-		int rc = ftdi_read_data(&mpsse_ftdic, &data, 1);
+		int rc = mpsse_usb_read(&data, 1);
 		if (rc <= 0)
 			break;
 		fprintf(stderr, "unexpected rx byte: %02X\n", data);
@@ -157,8 +228,25 @@ void mpsse_check_rx()
 
 void mpsse_error(int status)
 {
-	mpsse_check_rx();
+	mpsse_exit_status = status;
+
+	/* Get queued commands (e.g. releasing reset) out, ignoring errors
+	 * since we may be here because writing failed */
+	if (mpsse_wbuf_len > 0) {
+		int n = mpsse_wbuf_len;
+		mpsse_wbuf_len = 0;
+		mpsse_usb_write(mpsse_wbuf, n);
+	}
+
+	/* Draining a replayed trace would just eat the remaining recording */
+	if (mpsse_transport != &replay_transport)
+		mpsse_check_rx();
 	fprintf(stderr, "ABORT.\n");
+	trace_record_close();
+	if (mpsse_transport != &ftdi_transport) {
+		mpsse_transport->close();
+		exit(status);
+	}
 	if (mpsse_ftdic_open) {
 		if (mpsse_ftdic_latency_set)
 			ftdi_set_latency_timer(&mpsse_ftdic, mpsse_ftdi_latency);
@@ -170,27 +258,50 @@ void mpsse_error(int status)
 
 uint8_t mpsse_recv_byte()
 {
-	uint8_t data;
-	while (1) {
-		int rc = ftdi_read_data(&mpsse_ftdic, &data, 1);
-		if (rc < 0) {
-			fprintf(stderr, "Read error.\n");
-			mpsse_error(2);
-		}
-		if (rc == 1)
-			break;
-		usleep(100);
-	}
+	uint8_t data = 0;
+	mpsse_recv_queued(&data, 1);
 	return data;
 }
 
 void mpsse_send_byte(uint8_t data)
 {
-	int rc = ftdi_write_data(&mpsse_ftdic, &data, 1);
-	if (rc != 1) {
-		fprintf(stderr, "Write error (single byte, rc=%d, expected %d).\n", rc, 1);
-		mpsse_error(2);
+	mpsse_queue(&data, 1);
+}
+
+/* Collect n bytes of already requested MPSSE input. */
+void mpsse_recv_queued(uint8_t *data, int n)
+{
+	uint64_t last_data = 0;
+
+	mpsse_flush();
+	while (n > 0 && !mpsse_status) {
+		int rc = mpsse_usb_read(data, n);
+		if (rc < 0) {
+			fprintf(stderr, "Read error.\n");
+			mpsse_io_error(2);
+			break;
+		}
+		if (rc == 0) {
+			if (mpsse_recoverable) {
+				uint64_t now = stats_time_us();
+				if (last_data == 0)
+					last_data = now;
+				else if (now - last_data > MPSSE_READ_TIMEOUT_US) {
+					fprintf(stderr, "Read timeout.\n");
+					mpsse_io_error(2);
+					break;
+				}
+			}
+			usleep(100);
+			continue;
+		}
+		last_data = 0;
+		data += rc;
+		n -= rc;
 	}
+
+	if (n > 0)
+		memset(data, 0, n);
 }
 
 void mpsse_send_spi(uint8_t *data, int n)
@@ -203,14 +314,13 @@ void mpsse_send_spi(uint8_t *data, int n)
 	mpsse_send_byte(n - 1);
 	mpsse_send_byte((n - 1) >> 8);
 
-	int rc = ftdi_write_data(&mpsse_ftdic, data, n);
-	if (rc != n) {
-		fprintf(stderr, "Write error (chunk, rc=%d, expected %d).\n", rc, n);
-		mpsse_error(2);
-	}
+	mpsse_queue(data, n);
 }
 
-void mpsse_xfer_spi(uint8_t *data, int n)
+/* The _queue variants only request the transfer, the answer is picked up
+ * later with mpsse_recv_queued(). This allows several transfers to share
+ * one USB round trip. */
+void mpsse_xfer_spi_queue(const uint8_t *data, int n)
 {
 	if (n < 1)
 		return;
@@ -220,14 +330,49 @@ void mpsse_xfer_spi(uint8_t *data, int n)
 	mpsse_send_byte(n - 1);
 	mpsse_send_byte((n - 1) >> 8);
 
-	int rc = ftdi_write_data(&mpsse_ftdic, data, n);
-	if (rc != n) {
-		fprintf(stderr, "Write error (chunk, rc=%d, expected %d).\n", rc, n);
-		mpsse_error(2);
-	}
+	mpsse_queue(data, n);
+
+	/* Have the answer sent right away instead of at the latency timer */
+	mpsse_send_byte(MC_FLUSH);
+}
+
+void mpsse_recv_spi_queue(int n)
+{
+	if (n < 1)
+		return;
+
+	/* Input only, read data on positive clock edge. */
+	mpsse_send_byte(MC_DATA_IN);
+	mpsse_send_byte(n - 1);
+	mpsse_send_byte((n - 1) >> 8);
+	mpsse_send_byte(MC_FLUSH);
+}
 
-	for (int i = 0; i < n; i++)
-		data[i] = mpsse_recv_byte();
+void mpsse_xfer_spi(uint8_t *data, int n)
+{
+	mpsse_xfer_spi_queue(data, n);
+	if (n > 0)
+		mpsse_recv_queued(data, n);
+}
+
+void mpsse_recv_spi(uint8_t *data, int n)
+{
+	if (n < 1)
+		return;
+
+	/* A single command can clock at most 64 kB. The command for the next
+	 * chunk is queued before the current one is collected so the MPSSE
+	 * keeps clocking while the host drains the FIFO. */
+	int len = n > 0x10000 ? 0x10000 : n;
+	mpsse_recv_spi_queue(len);
+
+	for (int pos = 0; pos < n; pos += len) {
+		len = n - pos > 0x10000 ? 0x10000 : n - pos;
+		int next = n - pos - len > 0x10000 ? 0x10000 : n - pos - len;
+		if (next > 0)
+			mpsse_recv_spi_queue(next);
+		mpsse_recv_queued(data + pos, len);
+	}
 }
 
 uint8_t mpsse_xfer_spi_bits(uint8_t data, int n)
@@ -239,6 +384,7 @@ uint8_t mpsse_xfer_spi_bits(uint8_t data, int n)
 	mpsse_send_byte(MC_DATA_IN | MC_DATA_OUT | MC_DATA_OCN | MC_DATA_BITS);
 	mpsse_send_byte(n - 1);
 	mpsse_send_byte(data);
+	mpsse_send_byte(MC_FLUSH);
 
 	return mpsse_recv_byte();
 }
@@ -248,12 +394,19 @@ void mpsse_set_gpio(uint8_t gpio, uint8_t direction)
 	mpsse_send_byte(MC_SETB_LOW);
 	mpsse_send_byte(gpio); /* Value */
 	mpsse_send_byte(direction); /* Direction */
+	mpsse_gpio_direction = direction;
+}
+
+int mpsse_get_gpio_direction(void)
+{
+	return mpsse_gpio_direction;
 }
 
 int mpsse_readb_low(void)
 {
 	uint8_t data;
 	mpsse_send_byte(MC_READB_LOW);
+	mpsse_send_byte(MC_FLUSH);
 	data = mpsse_recv_byte();
 	return data;
 }
@@ -262,6 +415,7 @@ int mpsse_readb_high(void)
 {
 	uint8_t data;
 	mpsse_send_byte(MC_READB_HIGH);
+	mpsse_send_byte(MC_FLUSH);
 	data = mpsse_recv_byte();
 	return data;
 }
@@ -282,7 +436,100 @@ void mpsse_send_dummy_bit(void)
 	mpsse_send_byte(0x00);
 }
 
-void mpsse_init(int ifnum, const char *devstr, bool slow_clock)
+int mpsse_set_max_clock(void)
+{
+	/* Only the hi-speed parts have the 60 MHz master clock, the older
+	 * ones would answer MC_TCK_X5 with a bad command response. */
+	if (!mpsse_is_hispeed())
+		return 6000;
+
+	mpsse_max_clock = true;
+
+	// disable clock divide by 5 and set 30 MHz clock
+	mpsse_send_byte(MC_TCK_X5);
+	mpsse_send_byte(MC_SET_CLK_DIV);
+	mpsse_send_byte(0x00);
+	mpsse_send_byte(0x00);
+
+	return 30000;
+}
+
+/* The tunables below only apply to libftdi, the other transports have no
+ * USB latency timer or transfer chunks. The write chunk size also sets how
+ * much is coalesced into one write, for all transports. */
+void mpsse_set_latency(int latency_ms)
+{
+	mpsse_latency_ms = latency_ms;
+
+	if (mpsse_transport != &ftdi_transport)
+		return;
+
+	if (ftdi_set_latency_timer(&mpsse_ftdic, latency_ms) < 0) {
+		fprintf(stderr, "Failed to set latency timer (%s).\n", ftdi_get_error_string(&mpsse_ftdic));
+		mpsse_io_error(2);
+	}
+}
+
+void mpsse_set_chunksize(int read_chunk, int write_chunk)
+{
+	if (read_chunk > 0)
+		mpsse_read_chunk = read_chunk;
+	if (write_chunk > 0) {
+		mpsse_write_chunk = write_chunk;
+		mpsse_flush();
+		mpsse_wbuf_size = write_chunk < (int)sizeof(mpsse_wbuf) ? write_chunk : (int)sizeof(mpsse_wbuf);
+	}
+
+	if (mpsse_transport != &ftdi_transport)
+		return;
+
+	if ((read_chunk > 0 && ftdi_read_data_set_chunksize(&mpsse_ftdic, read_chunk) < 0) ||
+			(write_chunk > 0 && ftdi_write_data_set_chunksize(&mpsse_ftdic, write_chunk) < 0)) {
+		fprintf(stderr, "Failed to set USB chunk size (%s).\n", ftdi_get_error_string(&mpsse_ftdic));
+		mpsse_io_error(2);
+	}
+}
+
+void mpsse_get_chunksize(int *read_chunk, int *write_chunk)
+{
+	unsigned int rd = 0, wr = 0;
+
+	if (mpsse_transport == &ftdi_transport) {
+		ftdi_read_data_get_chunksize(&mpsse_ftdic, &rd);
+		ftdi_write_data_get_chunksize(&mpsse_ftdic, &wr);
+	}
+	*read_chunk = rd;
+	*write_chunk = wr;
+}
+
+/* USB serial number of the open programmer, "sim" / "replay" for the
+ * other transports and "" if the device has none. */
+const char *mpsse_get_serial(void)
+{
+	static char serial[128];
+
+	if (mpsse_transport == &sim_transport)
+		return "sim";
+	if (mpsse_transport == &replay_transport)
+		return "replay";
+
+	serial[0] = '\0';
+#ifdef LIBUSB_API_VERSION
+	/* libftdi1 on libusb-1.0; the libusb-0.1 based libftdi has no serial
+	 * lookup here. Read the descriptor through the handle that is already
+	 * open: ftdi_usb_get_strings() closes ftdic->usb_dev when it's done. */
+	struct libusb_device_descriptor desc;
+	if (mpsse_ftdic.usb_dev == NULL ||
+			libusb_get_device_descriptor(libusb_get_device(mpsse_ftdic.usb_dev), &desc) < 0 ||
+			desc.iSerialNumber == 0 ||
+			libusb_get_string_descriptor_ascii(mpsse_ftdic.usb_dev, desc.iSerialNumber,
+				(unsigned char *)serial, sizeof(serial)) < 0)
+		serial[0] = '\0';
+#endif
+	return serial;
+}
+
+static void mpsse_open_ftdi(int ifnum, const char *devstr)
 {
 	enum ftdi_interface ftdi_ifnum = INTERFACE_A;
 
@@ -310,12 +557,14 @@ void mpsse_init(int ifnum, const char *devstr, bool slow_clock)
 	if (devstr != NULL) {
 		if (ftdi_usb_open_string(&mpsse_ftdic, devstr)) {
 			fprintf(stderr, "Can't find iCE FTDI USB device (device string %s).\n", devstr);
-			mpsse_error(2);
+			mpsse_io_error(2);
+			return;
 		}
 	} else {
 		if (ftdi_usb_open(&mpsse_ftdic, 0x0403, 0x6010) && ftdi_usb_open(&mpsse_ftdic, 0x0403, 0x6014)) {
 			fprintf(stderr, "Can't find iCE FTDI USB device (vendor_id 0x0403, device_id 0x6010 or 0x6014).\n");
-			mpsse_error(2);
+			mpsse_io_error(2);
+			return;
 		}
 	}
 
@@ -323,23 +572,29 @@ void mpsse_init(int ifnum, const char *devstr, bool slow_clock)
 
 	if (ftdi_usb_reset(&mpsse_ftdic)) {
 		fprintf(stderr, "Failed to reset iCE FTDI USB device.\n");
-		mpsse_error(2);
+		mpsse_io_error(2);
+		return;
 	}
 
 	if (ftdi_usb_purge_buffers(&mpsse_ftdic)) {
 		fprintf(stderr, "Failed to purge buffers on iCE FTDI USB device.\n");
-		mpsse_error(2);
+		mpsse_io_error(2);
+		return;
 	}
 
-	if (ftdi_get_latency_timer(&mpsse_ftdic, &mpsse_ftdi_latency) < 0) {
+	/* On a reconnect the timer still has our setting, keep the original
+	 * value for mpsse_close() */
+	if (!mpsse_ftdic_latency_set && ftdi_get_latency_timer(&mpsse_ftdic, &mpsse_ftdi_latency) < 0) {
 		fprintf(stderr, "Failed to get latency timer (%s).\n", ftdi_get_error_string(&mpsse_ftdic));
-		mpsse_error(2);
+		mpsse_io_error(2);
+		return;
 	}
 
 	/* 1 is the fastest polling, it means 1 kHz polling */
-	if (ftdi_set_latency_timer(&mpsse_ftdic, 1) < 0) {
+	if (ftdi_set_latency_timer(&mpsse_ftdic, mpsse_latency_ms) < 0) {
 		fprintf(stderr, "Failed to set latency timer (%s).\n", ftdi_get_error_string(&mpsse_ftdic));
-		mpsse_error(2);
+		mpsse_io_error(2);
+		return;
 	}
 
 	mpsse_ftdic_latency_set = true;
@@ -347,9 +602,37 @@ void mpsse_init(int ifnum, const char *devstr, bool slow_clock)
 	/* Enter MPSSE (Multi-Protocol Synchronous Serial Engine) mode. Set all pins to output. */
 	if (ftdi_set_bitmode(&mpsse_ftdic, 0xff, BITMODE_MPSSE) < 0) {
 		fprintf(stderr, "Failed to set BITMODE_MPSSE on iCE FTDI USB device.\n");
-		mpsse_error(2);
+		mpsse_io_error(2);
+		return;
+	}
+
+	trace_set_chip_type(mpsse_ftdic.type);
+}
+
+static void mpsse_open_replay(const char *filename)
+{
+	int chip_type;
+
+	if (!trace_replay_open(filename, &chip_type)) {
+		fprintf(stderr, "Can't open trace '%s' for replay.\n", filename);
+		exit(2);
 	}
 
+	mpsse_transport = &replay_transport;
+	mpsse_ftdic.type = chip_type;
+}
+
+static void mpsse_open_sim(const char *spec)
+{
+	if (!sim_open(spec))
+		exit(2);
+
+	mpsse_transport = &sim_transport;
+	mpsse_ftdic.type = TYPE_2232H;
+}
+
+static void mpsse_set_clock(bool slow_clock)
+{
 	// enable clock divide by 5
 	mpsse_send_byte(MC_TCK_D5);
 
@@ -366,10 +649,85 @@ void mpsse_init(int ifnum, const char *devstr, bool slow_clock)
 	}
 }
 
+void mpsse_init(int ifnum, const char *devstr, bool slow_clock)
+{
+	mpsse_ifnum = ifnum;
+	mpsse_devstr = devstr;
+	mpsse_slow_clock = slow_clock;
+	mpsse_gpio_direction = -1;
+
+	if (devstr != NULL && !strncmp(devstr, "replay:", 7))
+		mpsse_open_replay(devstr + 7);
+	else if (devstr != NULL && !strncmp(devstr, "sim:", 4))
+		mpsse_open_sim(devstr + 4);
+	else
+		mpsse_open_ftdi(ifnum, devstr);
+
+	/* The hi-speed parts take 512 byte packets and have 4 kB FIFOs. Large
+	 * writes keep the TX FIFO topped up; reads are collected in chunks a
+	 * few times the FIFO so the device isn't polled per packet. The
+	 * full-speed parts do fine with the libftdi defaults. */
+	if (mpsse_is_hispeed())
+		mpsse_set_chunksize(16384, 65536);
+	else
+		mpsse_set_chunksize(4096, 4096);
+
+	mpsse_set_clock(slow_clock);
+}
+
+void mpsse_set_recoverable(bool recoverable)
+{
+	mpsse_recoverable = recoverable;
+}
+
+int mpsse_get_error(void)
+{
+	return mpsse_status;
+}
+
+void mpsse_clear_error(void)
+{
+	mpsse_status = 0;
+	mpsse_wbuf_len = 0;
+}
+
+/* Start over after a USB failure: reopen the FTDI device and restore the
+ * clock, latency timer and chunk sizes. The simulator keeps its flash,
+ * only stale input is dropped. A replay has nothing to drop: the
+ * recording already holds the reads after the reconnect, in order.
+ * Returns false (with the error kept) if the device can't be brought
+ * back. */
+bool mpsse_reconnect(void)
+{
+	mpsse_clear_error();
+	mpsse_gpio_direction = -1;
+
+	if (mpsse_transport == &ftdi_transport) {
+		if (mpsse_ftdic_open)
+			ftdi_usb_close(&mpsse_ftdic);
+		ftdi_deinit(&mpsse_ftdic);
+		mpsse_ftdic_open = false;
+
+		mpsse_open_ftdi(mpsse_ifnum, mpsse_devstr);
+		if (mpsse_status)
+			return false;
+		mpsse_set_chunksize(mpsse_read_chunk, mpsse_write_chunk);
+	} else if (mpsse_transport == &sim_transport) {
+		sim_purge();
+	}
+
+	mpsse_set_clock(mpsse_slow_clock);
+	if (mpsse_max_clock)
+		mpsse_set_max_clock();
+	mpsse_flush();
+
+	return mpsse_status == 0;
+}
+
 void mpsse_close(void)
 {
-	ftdi_set_latency_timer(&mpsse_ftdic, mpsse_ftdi_latency);
-	ftdi_disable_bitbang(&mpsse_ftdic);
-	ftdi_usb_close(&mpsse_ftdic);
-	ftdi_deinit(&mpsse_ftdic);
+	mpsse_flush();
+	trace_record_close();
+	mpsse_transport->close();
+	mpsse_transport = &ftdi_transport;
 }
@@ -0,0 +1,354 @@
+/*
+ *  iceprog -- simple programming tool for FTDI-based Lattice iCE programmers
+ *
+ *  Permission to use, copy, modify, and/or distribute this software for any
+ *  purpose with or without fee is hereby granted, provided that the above
+ *  copyright notice and this permission notice appear in all copies.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ *  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ *  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ *  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ *  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ *  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+
+#include "patch.h"
+
+enum patch_source {
+	PATCH_BYTES,	/* hex:, str: and the CSV sources once resolved */
+	PATCH_UID,
+	PATCH_COUNTER,
+};
+
+struct patch {
+	long offset;
+	enum patch_source source;
+	char *spec;		/* as given, for messages */
+	char *file;		/* counter: and csv: */
+	char *column;		/* csv: */
+	bool csv_text;
+	uint8_t data[256];
+	int len;
+	unsigned long long counter;
+	bool written;		/* programmed in this session */
+};
+
+static struct patch *patches = NULL;
+static int n_patches = 0;
+static int csv_row = 0;
+
+/* Hex bytes with optional ':', '-' or ' ' between them. Returns the
+   number of bytes or -1. */
+static int parse_hex(const char *text, uint8_t *data, int max)
+{
+	int len = 0;
+	while (*text) {
+		if (*text == ':' || *text == '-' || *text == ' ') {
+			text++;
+			continue;
+		}
+		if (!isxdigit((unsigned char)text[0]) || !isxdigit((unsigned char)text[1]) || len == max)
+			return -1;
+		char byte[3] = { text[0], text[1], '\0' };
+		data[len++] = strtoul(byte, NULL, 16);
+		text += 2;
+	}
+	return len;
+}
+
+static bool set_text(struct patch *p, const char *text)
+{
+	size_t len = strlen(text);
+	if (len > sizeof(p->data))
+		return false;
+	memcpy(p->data, text, len);
+	p->len = len;
+	return true;
+}
+
+bool patch_add(const char *spec)
+{
+	char *end;
+	long offset = strtol(spec, &end, 0);
+	if (end == spec || *end != '=' || offset < 0) {
+		fprintf(stderr, "patch `%s': expected <offset>=<source>\n", spec);
+		return false;
+	}
+	const char *source = end + 1;
+
+	struct patch p = { .offset = offset, .source = PATCH_BYTES };
+	bool ok = true;
+
+	if (!strncmp(source, "hex:", 4)) {
+		p.len = parse_hex(source + 4, p.data, sizeof(p.data));
+		ok = p.len > 0;
+	} else if (!strncmp(source, "str:", 4)) {
+		ok = set_text(&p, source + 4) && p.len > 0;
+	} else if (!strcmp(source, "uid")) {
+		p.source = PATCH_UID;
+		p.len = 8;
+	} else if (!strncmp(source, "counter:", 8)) {
+		p.source = PATCH_COUNTER;
+		p.file = strdup(source + 8);
+		p.len = 4;
+		char *comma = strrchr(p.file, ',');
+		if (comma != NULL) {
+			*comma = '\0';
+			p.len = strtol(comma + 1, &end, 0);
+			ok = *end == '\0' && p.len >= 1 && p.len <= 8;
+		}
+	} else if (!strncmp(source, "csv:", 4) || !strncmp(source, "csvstr:", 7)) {
+		p.csv_text = source[3] == 's';
+		p.file = strdup(source + (p.csv_text ? 7 : 4));
+		char *comma = strrchr(p.file, ',');
+		ok = comma != NULL && comma[1] != '\0';
+		if (ok) {
+			*comma = '\0';
+			p.column = strdup(comma + 1);
+		}
+	} else {
+		ok = false;
+	}
+
+	if (!ok) {
+		fprintf(stderr, "patch `%s': invalid source\n", spec);
+		free(p.file);
+		return false;
+	}
+
+	struct patch *grown = realloc(patches, (n_patches + 1) * sizeof(*patches));
+	if (grown == NULL) {
+		fprintf(stderr, "Out of memory.\n");
+		return false;
+	}
+	patches = grown;
+	p.spec = strdup(spec);
+	patches[n_patches++] = p;
+	return true;
+}
+
+void patch_set_csv_row(int row)
+{
+	csv_row = row;
+}
+
+bool patch_active(void)
+{
+	return n_patches > 0;
+}
+
+bool patch_needs_uid(void)
+{
+	for (int i = 0; i < n_patches; i++)
+		if (patches[i].source == PATCH_UID)
+			return true;
+	return false;
+}
+
+/* Split a CSV line in place, dropping surrounding blanks and quotes */
+static int split_csv(char *line, char **fields, int max)
+{
+	int n = 0;
+	line[strcspn(line, "\r\n")] = '\0';
+	for (char *p = line; n < max; ) {
+		char *next = strchr(p, ',');
+		if (next != NULL)
+			*next = '\0';
+		while (*p == ' ' || *p == '\t')
+			p++;
+		char *e = p + strlen(p);
+		while (e > p && (e[-1] == ' ' || e[-1] == '\t'))
+			*--e = '\0';
+		if (e - p >= 2 && *p == '"' && e[-1] == '"') {
+			e[-1] = '\0';
+			p++;
+		}
+		fields[n++] = p;
+		if (next == NULL)
+			break;
+		p = next + 1;
+	}
+	return n;
+}
+
+static bool resolve_csv(struct patch *p)
+{
+	if (csv_row <= 0) {
+		fprintf(stderr, "patch `%s': needs `--csv-row'\n", p->spec);
+		return false;
+	}
+
+	FILE *f = fopen(p->file, "r");
+	if (f == NULL) {
+		fprintf(stderr, "patch `%s': can't open `%s': %s\n", p->spec, p->file, strerror(errno));
+		return false;
+	}
+
+	char header[1024], line[1024];
+	char *names[64], *fields[64];
+	bool found = false;
+	int n_names = 0;
+	if (fgets(header, sizeof(header), f) != NULL) {
+		n_names = split_csv(header, names, 64);
+		for (int row = 1; fgets(line, sizeof(line), f) != NULL; row++) {
+			if (row == csv_row) {
+				found = true;
+				break;
+			}
+		}
+	}
+	fclose(f);
+
+	if (!found) {
+		fprintf(stderr, "patch `%s': `%s' has no row %d\n", p->spec, p->file, csv_row);
+		return false;
+	}
+
+	int n_fields = split_csv(line, fields, 64);
+	char *end;
+	int column = strtol(p->column, &end, 10) - 1;
+	if (*end != '\0') {
+		column = -1;
+		for (int i = 0; i < n_names; i++)
+			if (!strcmp(names[i], p->column))
+				column = i;
+	}
+	if (column < 0 || column >= n_fields) {
+		fprintf(stderr, "patch `%s': no column `%s' in row %d\n", p->spec, p->column, csv_row);
+		return false;
+	}
+
+	bool ok = p->csv_text ? set_text(p, fields[column]) :
+			(p->len = parse_hex(fields[column], p->data, sizeof(p->data))) > 0;
+	if (!ok) {
+		fprintf(stderr, "patch `%s': bad value `%s'\n", p->spec, fields[column]);
+		return false;
+	}
+	p->source = PATCH_BYTES;
+	return true;
+}
+
+static bool resolve_counter(struct patch *p)
+{
+	p->counter = 0;
+	FILE *f = fopen(p->file, "r");
+	if (f == NULL) {
+		if (errno != ENOENT) {
+			fprintf(stderr, "patch `%s': can't open `%s': %s\n", p->spec, p->file, strerror(errno));
+			return false;
+		}
+		fprintf(stderr, "patch `%s': `%s' doesn't exist, starting at 0\n", p->spec, p->file);
+		return true;
+	}
+	bool ok = fscanf(f, "%llu", &p->counter) == 1;
+	fclose(f);
+	if (!ok) {
+		fprintf(stderr, "patch `%s': `%s' doesn't hold a number\n", p->spec, p->file);
+		return false;
+	}
+	for (int i = 0; i < p->len; i++)
+		p->data[i] = p->counter >> (8 * (p->len - 1 - i));
+	return true;
+}
+
+bool patch_prepare(void)
+{
+	for (int i = 0; i < n_patches; i++) {
+		struct patch *p = &patches[i];
+		if (p->column != NULL && !resolve_csv(p))
+			return false;
+		if (p->source == PATCH_COUNTER && !resolve_counter(p))
+			return false;
+	}
+	return true;
+}
+
+bool patch_apply(uint8_t **image, long *size, uint64_t uid, long max_size)
+{
+	for (int i = 0; i < n_patches; i++) {
+		struct patch *p = &patches[i];
+
+		if (max_size > 0 && p->offset + p->len > max_size) {
+			fprintf(stderr, "patch `%s': ends at 0x%06lX, past the end of the flash at 0x%06lX\n",
+					p->spec, p->offset + p->len, max_size);
+			return false;
+		}
+
+		if (p->source == PATCH_UID)
+			for (int k = 0; k < 8; k++)
+				p->data[k] = uid >> (56 - 8 * k);
+
+		if (p->offset + p->len > *size) {
+			uint8_t *grown = realloc(*image, p->offset + p->len);
+			if (grown == NULL) {
+				fprintf(stderr, "Out of memory.\n");
+				return false;
+			}
+			memset(grown + *size, 0xff, p->offset + p->len - *size);
+			*image = grown;
+			*size = p->offset + p->len;
+		}
+		memcpy(*image + p->offset, p->data, p->len);
+
+		fprintf(stderr, "patch 0x%06lX:", p->offset);
+		for (int k = 0; k < p->len && k < 16; k++)
+			fprintf(stderr, " %02X", p->data[k]);
+		fprintf(stderr, "%s (%s)\n", p->len > 16 ? " .." : "", p->spec + strcspn(p->spec, "=") + 1);
+	}
+	return true;
+}
+
+void patch_written(long begin, long end)
+{
+	for (int i = 0; i < n_patches; i++)
+		if (patches[i].offset < end && patches[i].offset + patches[i].len > begin)
+			patches[i].written = true;
+}
+
+bool patch_commit(void)
+{
+	bool ok = true;
+	for (int i = 0; i < n_patches; i++) {
+		struct patch *p = &patches[i];
+		if (p->source != PATCH_COUNTER)
+			continue;
+
+		/* The board held the value already, it isn't used up twice */
+		if (!p->written) {
+			fprintf(stderr, "patch `%s': not programmed, `%s' stays at %llu\n", p->spec, p->file, p->counter);
+			continue;
+		}
+
+		/* Written next to the old file and renamed over it, so a crash
+		   can't lose the count */
+		char tmp[1024];
+		snprintf(tmp, sizeof(tmp), "%s.tmp", p->file);
+		FILE *f = fopen(tmp, "w");
+		if (f != NULL) {
+			fprintf(f, "%llu\n", p->counter + 1);
+			if (fclose(f) == 0) {
+#ifdef _WIN32
+				remove(p->file);
+#endif
+				if (rename(tmp, p->file) == 0)
+					continue;
+			}
+		}
+		fprintf(stderr, "patch `%s': can't update `%s': %s\n", p->spec, p->file, strerror(errno));
+		remove(tmp);
+		ok = false;
+	}
+	return ok;
+}
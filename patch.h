@@ -0,0 +1,64 @@
+/*
+ *  iceprog -- simple programming tool for FTDI-based Lattice iCE programmers
+ *
+ *  Permission to use, copy, modify, and/or distribute this software for any
+ *  purpose with or without fee is hereby granted, provided that the above
+ *  copyright notice and this permission notice appear in all copies.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ *  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ *  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ *  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ *  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ *  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef PATCH_H
+#define PATCH_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Per-board data written into the image at program time, given as
+ * <offset>=<source> with the offset relative to the start of the image:
+ *
+ *   hex:<bytes>                  literal bytes, e.g. hex:DEADBEEF
+ *   str:<text>                   the text, without a terminating NUL
+ *   uid                          the 8 byte flash unique ID
+ *   counter:<file>[,<bytes>]     decimal number kept in file (default 4
+ *                                bytes), incremented once it has been
+ *                                programmed
+ *   csv:<file>,<column>          field of the --csv-row row as hex bytes
+ *                                (':' and '-' separators are allowed)
+ *   csvstr:<file>,<column>       field of the --csv-row row as text
+ *
+ * CSV files start with a header line; columns are given by name or by
+ * number, counting from 1. Numbers (uid, counter) are written big endian,
+ * most significant byte first, the order the flash returns the unique ID
+ * in. */
+
+bool patch_add(const char *spec);
+void patch_set_csv_row(int row);
+bool patch_active(void);
+
+/* True if a patch writes the flash unique ID */
+bool patch_needs_uid(void);
+
+/* Read counters and CSV files, before the programmer is opened */
+bool patch_prepare(void);
+
+/* Apply all patches to the image, growing it (with 0xFF) if a patch
+ * ends after it. max_size is the room on the flash from the start of the
+ * image, 0 if unknown. Returns false (with a message) if a patch doesn't
+ * fit or out of memory. */
+bool patch_apply(uint8_t **image, long *size, uint64_t uid, long max_size);
+
+/* Note that image bytes begin..end-1 were programmed and verified */
+void patch_written(long begin, long end);
+
+/* Advance the counters that were written, once the patched image is on
+ * the board */
+bool patch_commit(void);
+
+#endif /* PATCH_H */
@@ -0,0 +1,618 @@
+/*
+ *  iceprog -- simple programming tool for FTDI-based Lattice iCE programmers
+ *
+ *  Permission to use, copy, modify, and/or distribute this software for any
+ *  purpose with or without fee is hereby granted, provided that the above
+ *  copyright notice and this permission notice appear in all copies.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ *  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ *  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ *  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ *  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ *  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "iceprog_fn.h"
+#include "plan.h"
+
+/* What the flash functions in iceprog_fn.c do on the wire, see
+ * flash_wait() and flash_wait_read() */
+#define PLAN_WAIT_SLEEP_US 1000
+#define PLAN_WAIT_READ_SLEEP_US 250
+#define PLAN_COMPARE_CHUNK (256 * 1024)
+#define PLAN_MAX_CMD 0x10000
+
+static const struct flash_part plan_parts[] = {
+	{ "W25Q128JV", 0xEF4018, 16L << 20, 400, 45000, 120000, 150000, 40000000 },
+	{ "W25Q32JV", 0xEF4016, 4L << 20, 400, 45000, 120000, 150000, 10000000 },
+	{ "W25Q80DV", 0xEF4014, 1L << 20, 700, 30000, 120000, 150000, 2000000 },
+	{ "N25Q032A", 0x20BA16, 4L << 20, 500, 250000, 0, 700000, 30000000 },
+};
+
+/* Time and USB traffic of one phase */
+struct plan_cost {
+	double us;
+	long writes;
+	long reads;
+};
+
+struct plan_model {
+	struct flash_part part;
+	const uint8_t *base;
+	long base_size;
+	int rtt_us;
+	double byte_us;
+	int read_chunk;
+	int write_chunk;
+	long queued;		/* bytes collected for the next USB write */
+};
+
+struct plan_result {
+	struct plan_cost erase, program, verify;
+	long erased_blocks;
+	bool bulk;
+	long pages;
+	long blank_pages;
+	long unchanged_blocks;
+};
+
+// ---------------------------------------------------------
+// Flash part
+// ---------------------------------------------------------
+
+static long plan_parse_size(const char *s, bool *ok)
+{
+	char *end;
+	long value = strtol(s, &end, 0);
+	if (!strcmp(end, "k"))
+		value *= 1024;
+	else if (!strcmp(end, "M"))
+		value *= 1024 * 1024;
+	else if (*end != '\0')
+		*ok = false;
+	return value;
+}
+
+static bool plan_load_part(const char *filename, struct flash_part *part, const char *my_name)
+{
+	FILE *f = fopen(filename, "r");
+	if (f == NULL) {
+		fprintf(stderr, "%s: `%s' is neither a known flash nor a readable file\n", my_name, filename);
+		return false;
+	}
+
+	memset(part, 0, sizeof(*part));
+	snprintf(part->name, sizeof(part->name), "%s", filename);
+
+	char line[256];
+	int lineno = 0;
+	bool ok = true;
+	while (ok && fgets(line, sizeof(line), f) != NULL) {
+		lineno++;
+		line[strcspn(line, "#\r\n")] = '\0';
+		line[strcspn(line, " \t")] = '\0';
+		if (line[0] == '\0')
+			continue;
+
+		char *value = strchr(line, '=');
+		if (value == NULL) {
+			fprintf(stderr, "%s:%d: expected key=value\n", filename, lineno);
+			ok = false;
+			break;
+		}
+		*value++ = '\0';
+
+		if (!strcmp(line, "name"))
+			snprintf(part->name, sizeof(part->name), "%s", value);
+		else if (!strcmp(line, "id"))
+			part->jedec_id = strtoul(value, NULL, 16);
+		else if (!strcmp(line, "size"))
+			part->size = plan_parse_size(value, &ok);
+		else if (!strcmp(line, "page_program"))
+			part->page_program = atoi(value);
+		else if (!strcmp(line, "erase_4k"))
+			part->erase_4k = atoi(value);
+		else if (!strcmp(line, "erase_32k"))
+			part->erase_32k = atoi(value);
+		else if (!strcmp(line, "erase_64k"))
+			part->erase_64k = atoi(value);
+		else if (!strcmp(line, "chip_erase"))
+			part->chip_erase = atol(value);
+		else
+			fprintf(stderr, "%s:%d: ignoring unknown key `%s'\n", filename, lineno, line);
+		if (!ok)
+			fprintf(stderr, "%s:%d: `%s' is not a valid size\n", filename, lineno, value);
+	}
+	fclose(f);
+
+	if (ok && (part->size <= 0 || part->page_program <= 0 || part->chip_erase <= 0)) {
+		fprintf(stderr, "%s: needs at least size, page_program and chip_erase\n", filename);
+		ok = false;
+	}
+	return ok;
+}
+
+static bool plan_find_part(const char *name, struct flash_part *part, const char *my_name)
+{
+	int n_parts = sizeof(plan_parts) / sizeof(plan_parts[0]);
+
+	if (name[0] == '\0') {
+		*part = plan_parts[0];
+		return true;
+	}
+
+	char *end;
+	unsigned long id = strtoul(name, &end, 16);
+	for (int i = 0; i < n_parts; i++) {
+		if (!strcasecmp(name, plan_parts[i].name) || (*end == '\0' && id == plan_parts[i].jedec_id)) {
+			*part = plan_parts[i];
+			return true;
+		}
+	}
+
+	return plan_load_part(name, part, my_name);
+}
+
+bool plan_part_by_id(uint32_t jedec_id, struct flash_part *part)
+{
+	int n_parts = sizeof(plan_parts) / sizeof(plan_parts[0]);
+	for (int i = 0; i < n_parts; i++) {
+		if (plan_parts[i].jedec_id == jedec_id) {
+			*part = plan_parts[i];
+			return true;
+		}
+	}
+	return false;
+}
+
+static int plan_erase_time(const struct flash_part *part, int block_size)
+{
+	switch (block_size >> 10) {
+		case 4:
+			return part->erase_4k;
+		case 32:
+			return part->erase_32k;
+		case 64:
+			return part->erase_64k;
+	}
+	return 0;
+}
+
+// ---------------------------------------------------------
+// Wire model
+// ---------------------------------------------------------
+
+/* n bytes clocked out to the flash; they go into the MPSSE write buffer,
+ * which is sent whenever it fills up */
+static void model_send(struct plan_model *m, struct plan_cost *c, int n)
+{
+	c->us += n * m->byte_us;
+	m->queued += n + 3;
+	while (m->queued >= m->write_chunk) {
+		c->writes++;
+		m->queued -= m->write_chunk;
+	}
+}
+
+/* Collecting n bytes of answer flushes the write buffer first */
+static void model_recv(struct plan_model *m, struct plan_cost *c, int n)
+{
+	if (m->queued > 0) {
+		c->writes++;
+		m->queued = 0;
+	}
+	c->reads += (n + m->read_chunk - 1) / m->read_chunk;
+	c->us += m->rtt_us;
+}
+
+static void model_xfer(struct plan_model *m, struct plan_cost *c, int n)
+{
+	model_send(m, c, n);
+	model_recv(m, c, n);
+}
+
+static void model_write_enable(struct plan_model *m, struct plan_cost *c)
+{
+	model_xfer(m, c, 1);
+}
+
+/* flash_wait(): status polls a millisecond apart until three in a row
+ * see the flash ready */
+static void model_wait(struct plan_model *m, struct plan_cost *c, double busy_us)
+{
+	double t = 0;
+	for (int ready = 0; ready < 3; ) {
+		double before = c->us;
+		model_xfer(m, c, 2);
+		t += c->us - before;
+		ready = t >= busy_us ? ready + 1 : 0;
+		if (ready < 3) {
+			c->us += PLAN_WAIT_SLEEP_US;
+			t += PLAN_WAIT_SLEEP_US;
+		}
+	}
+}
+
+/* flash_wait_read(): a status poll with the page read queued behind it,
+ * until three in a row see the flash ready */
+static void model_wait_read(struct plan_model *m, struct plan_cost *c, double busy_us, int n)
+{
+	double t = 0;
+	for (int ready = 0; ready < 3; ) {
+		double before = c->us;
+		model_send(m, c, 2);
+		model_send(m, c, 5 + n);
+		model_recv(m, c, 2 + n);
+		t += c->us - before;
+		ready = t >= busy_us ? ready + 1 : 0;
+		if (ready < 3) {
+			c->us += PLAN_WAIT_READ_SLEEP_US;
+			t += PLAN_WAIT_READ_SLEEP_US;
+		}
+	}
+}
+
+/* flash_fast_read(): the command for the next 64 kB goes out before the
+ * current one is collected, so there is one round trip in total */
+static void model_fast_read(struct plan_model *m, struct plan_cost *c, long n)
+{
+	model_send(m, c, 5);
+	for (long pos = 0; pos < n; pos += PLAN_MAX_CMD) {
+		long len = n - pos > PLAN_MAX_CMD ? PLAN_MAX_CMD : n - pos;
+		c->writes++;
+		c->reads += (len + m->read_chunk - 1) / m->read_chunk;
+		c->us += len * m->byte_us;
+	}
+	m->queued = 0;
+	c->us += m->rtt_us;
+}
+
+static void model_erase(struct plan_model *m, struct plan_cost *c, int block_size)
+{
+	model_write_enable(m, c);
+	model_send(m, c, 4);
+	model_wait(m, c, plan_erase_time(&m->part, block_size));
+}
+
+static void model_bulk_erase(struct plan_model *m, struct plan_cost *c)
+{
+	model_write_enable(m, c);
+	model_send(m, c, 1);
+	model_wait(m, c, m->part.chip_erase);
+}
+
+/* Program the part of the image inside [begin, end) page by page */
+static void model_program(struct plan_model *m, struct plan_result *r, const uint8_t *image,
+		const struct plan_settings *s, int begin, int end)
+{
+	for (int n, addr = begin; addr < end; addr += n) {
+		const uint8_t *data = image + (addr - s->offset);
+		n = 256 - addr % 256;
+		if (n > end - addr)
+			n = end - addr;
+
+		bool blank = flash_page_blank(data, n);
+		r->pages++;
+		if (blank)
+			r->blank_pages++;
+		else {
+			model_write_enable(m, &r->program);
+			model_send(m, &r->program, 4 + n);
+		}
+
+		if (s->inline_verify)
+			model_wait_read(m, &r->program, blank ? 0 : m->part.page_program, n);
+		else if (!blank)
+			model_wait(m, &r->program, m->part.page_program);
+	}
+}
+
+static bool block_unchanged(const struct plan_model *m, const uint8_t *image,
+		const struct plan_settings *s, int begin, int end)
+{
+	if (m->base == NULL || end > m->base_size)
+		return false;
+	for (int addr = begin; addr < end; addr++) {
+		uint8_t expected = image != NULL ? image[addr - s->offset] : 0xff;
+		if (m->base[addr] != expected)
+			return false;
+	}
+	return true;
+}
+
+/* Walk through the run the way main() would do it. erased[] gets one
+ * flag per erase block if not NULL. */
+static void plan_estimate(struct plan_model *m, const uint8_t *image, long size,
+		const struct plan_settings *s, struct plan_result *r, bool *erased)
+{
+	memset(r, 0, sizeof(*r));
+	m->queued = 0;
+
+	int block_mask = s->block_size - 1;
+	int begin_addr = s->offset & ~block_mask;
+	int end_addr = (s->offset + size + block_mask) & ~block_mask;
+	int n_blocks = (end_addr - begin_addr) / s->block_size;
+	int end = s->offset + size;
+
+	if (!s->block_mode) {
+		if (s->dont_erase)
+			/* nothing */;
+		else if (s->bulk_erase) {
+			model_bulk_erase(m, &r->erase);
+			r->bulk = true;
+		} else {
+			for (int i = 0; i < n_blocks; i++) {
+				model_erase(m, &r->erase, s->block_size);
+				r->erased_blocks++;
+				if (erased != NULL)
+					erased[i] = true;
+			}
+		}
+
+		if (image != NULL)
+			model_program(m, r, image, s, s->offset, end);
+
+		if (image != NULL && s->verify && !s->inline_verify) {
+			int chunk = PLAN_COMPARE_CHUNK - s->offset % s->block_size;
+			for (long pos = 0; pos < size; pos += chunk, chunk = PLAN_COMPARE_CHUNK)
+				model_fast_read(m, &r->verify, size - pos > chunk ? chunk : size - pos);
+		}
+		return;
+	}
+
+	/* One block at a time, like program_block() */
+	bool keep_blocks = s->delta;
+	if (s->bulk_erase && !s->dont_erase && !keep_blocks) {
+		model_bulk_erase(m, &r->erase);
+		r->bulk = true;
+	}
+
+	for (int i = 0; i < n_blocks; i++) {
+		int addr = begin_addr + i * s->block_size;
+		int begin = addr > s->offset ? addr : s->offset;
+		int stop = addr + s->block_size < end ? addr + s->block_size : end;
+
+		if (s->delta) {
+			model_fast_read(m, &r->verify, image != NULL ? stop - begin : s->block_size);
+			if (block_unchanged(m, image, s, begin, stop)) {
+				r->unchanged_blocks++;
+				continue;
+			}
+		}
+
+		if (!s->dont_erase && (!s->bulk_erase || keep_blocks)) {
+			model_erase(m, &r->erase, s->block_size);
+			r->erased_blocks++;
+			if (erased != NULL)
+				erased[i] = true;
+		}
+
+		if (image == NULL)
+			continue;
+		model_program(m, r, image, s, begin, stop);
+		if (s->verify && !s->inline_verify && stop > begin)
+			model_fast_read(m, &r->verify, stop - begin);
+	}
+}
+
+// ---------------------------------------------------------
+// Report
+// ---------------------------------------------------------
+
+static double plan_total(const struct plan_result *r)
+{
+	return r->erase.us + r->program.us + r->verify.us;
+}
+
+static void print_phase(const char *name, const struct plan_cost *c)
+{
+	printf("  %-8s  %9.2f s  %8ld  %8ld\n", name, c->us / 1e6, c->writes, c->reads);
+}
+
+static void print_erase_plan(const struct plan_settings *s, const struct plan_result *r,
+		const bool *erased, int begin_addr, int n_blocks)
+{
+	if (r->bulk) {
+		printf("erase plan: bulk erase\n");
+		return;
+	}
+	if (r->erased_blocks == 0) {
+		printf("erase plan: none\n");
+		return;
+	}
+
+	printf("erase plan: %ld x %d kB\n", r->erased_blocks, s->block_size >> 10);
+	for (int i = 0; i < n_blocks; ) {
+		if (!erased[i]) {
+			i++;
+			continue;
+		}
+		int first = i;
+		while (i < n_blocks && erased[i])
+			i++;
+		printf("  0x%06X-0x%06X  %d x %d kB\n", begin_addr + first * s->block_size,
+				begin_addr + i * s->block_size - 1, i - first, s->block_size >> 10);
+	}
+}
+
+static void print_alternative(struct plan_model *m, const uint8_t *image, long size,
+		const struct plan_settings *s, const char *label, double current)
+{
+	if (!s->bulk_erase && !s->dont_erase && plan_erase_time(&m->part, s->block_size) == 0) {
+		printf("  %-10s  not supported by %s\n", label, m->part.name);
+		return;
+	}
+
+	struct plan_result r;
+	plan_estimate(m, image, size, s, &r, NULL);
+	printf("  %-10s  %9.2f s  %+9.2f s\n", label, plan_total(&r) / 1e6, (plan_total(&r) - current) / 1e6);
+}
+
+bool plan_run(const char *spec, const uint8_t *image, long size,
+		const struct plan_settings *settings, const char *my_name)
+{
+	struct plan_model m = {
+		.rtt_us = 250,
+		.read_chunk = settings->read_chunk > 0 ? settings->read_chunk : 16384,
+		.write_chunk = settings->write_chunk > 0 ? settings->write_chunk : 65536,
+	};
+	const char *base_filename = NULL;
+	bool ok = true;
+
+	char *copy = strdup(spec);
+	if (copy == NULL) {
+		fprintf(stderr, "%s: out of memory\n", my_name);
+		return false;
+	}
+	char *name = copy, *opt = strchr(copy, ',');
+	if (opt != NULL)
+		*opt++ = '\0';
+	if (strchr(name, '=') != NULL) {
+		/* Only options, the default flash */
+		if (opt != NULL)
+			opt[-1] = ',';
+		opt = copy;
+		name = "";
+	}
+	while (ok && opt != NULL) {
+		char *next = strchr(opt, ',');
+		if (next != NULL)
+			*next++ = '\0';
+		if (!strncmp(opt, "base=", 5))
+			base_filename = spec + (opt + 5 - copy);
+		else if (!strncmp(opt, "rtt=", 4) && (m.rtt_us = atoi(opt + 4)) > 0)
+			/* ok */;
+		else {
+			fprintf(stderr, "%s: `%s' is not a valid plan option\n", my_name, opt);
+			ok = false;
+		}
+		opt = next;
+	}
+	ok = ok && plan_find_part(name, &m.part, my_name);
+	free(copy);
+	if (!ok)
+		return false;
+
+	/* The file name ends at the next comma */
+	uint8_t *base = NULL;
+	if (base_filename != NULL) {
+		char path[4096];
+		snprintf(path, sizeof(path), "%.*s", (int)strcspn(base_filename, ","), base_filename);
+		FILE *f = fopen(path, "rb");
+		if (f == NULL) {
+			fprintf(stderr, "%s: can't open '%s' for reading: ", my_name, path);
+			perror(0);
+			return false;
+		}
+		long cap = 0;
+		while (true) {
+			if (m.base_size == cap) {
+				cap = cap ? 2 * cap : 65536;
+				uint8_t *grown = realloc(base, cap);
+				if (grown == NULL) {
+					fprintf(stderr, "%s: out of memory\n", my_name);
+					free(base);
+					fclose(f);
+					return false;
+				}
+				base = grown;
+			}
+			size_t rc = fread(base + m.base_size, 1, cap - m.base_size, f);
+			if (rc == 0)
+				break;
+			m.base_size += rc;
+		}
+		fclose(f);
+		m.base = base;
+	}
+
+	struct plan_settings s = *settings;
+	m.byte_us = 8e6 / (s.slow_clock ? 50e3 : 6e6);
+
+	if (s.offset + size > m.part.size) {
+		fprintf(stderr, "%s: %ld bytes at 0x%06X don't fit into the %ld kB of %s\n", my_name,
+				size, s.offset, m.part.size >> 10, m.part.name);
+		free(base);
+		return false;
+	}
+	if (!s.bulk_erase && !s.dont_erase && plan_erase_time(&m.part, s.block_size) == 0) {
+		fprintf(stderr, "%s: %s has no %d kB erase, try another `-i'\n", my_name, m.part.name, s.block_size >> 10);
+		free(base);
+		return false;
+	}
+
+	int block_mask = s.block_size - 1;
+	int begin_addr = s.offset & ~block_mask;
+	int n_blocks = ((s.offset + size + block_mask) & ~block_mask) / s.block_size - begin_addr / s.block_size;
+	bool *erased = calloc(n_blocks + 1, sizeof(bool));
+	if (erased == NULL) {
+		fprintf(stderr, "%s: out of memory\n", my_name);
+		free(base);
+		return false;
+	}
+
+	struct plan_result r;
+	plan_estimate(&m, image, size, &s, &r, erased);
+
+	printf("flash:      %s (%06X), %ld kB\n", m.part.name, m.part.jedec_id, m.part.size >> 10);
+	printf("%s      %ld bytes at 0x%06X\n", image != NULL ? "image:" : "erase:", size, s.offset);
+	printf("clock:      %s, USB round trip %d us, read chunk %d, write chunk %d\n",
+			s.slow_clock ? "50 kHz" : "6 MHz", m.rtt_us, m.read_chunk, m.write_chunk);
+	print_erase_plan(&s, &r, erased, begin_addr, n_blocks);
+	if (s.delta)
+		printf("delta:      %ld of %d blocks unchanged%s\n", r.unchanged_blocks, n_blocks,
+				m.base == NULL ? " (no base given, all assumed changed)" : "");
+	if (image != NULL)
+		printf("pages:      %ld, %ld all 0xFF and skipped, %ld programmed\n",
+				r.pages, r.blank_pages, r.pages - r.blank_pages);
+
+	printf("\n  %-8s  %11s  %8s  %8s\n", "phase", "time", "writes", "reads");
+	print_phase("erase", &r.erase);
+	print_phase("program", &r.program);
+	print_phase("verify", &r.verify);
+	struct plan_cost total = {
+		plan_total(&r),
+		r.erase.writes + r.program.writes + r.verify.writes,
+		r.erase.reads + r.program.reads + r.verify.reads,
+	};
+	print_phase("total", &total);
+
+	/* Same run with other erase and clock settings */
+	printf("\nother settings:\n");
+	static const int sizes[] = { 4, 32, 64 };
+	for (int i = 0; i < 3; i++) {
+		struct plan_settings alt = s;
+		alt.block_size = sizes[i] << 10;
+		alt.bulk_erase = false;
+		alt.dont_erase = false;
+		if (alt.block_size == s.block_size && !s.bulk_erase && !s.dont_erase)
+			continue;
+		char label[16];
+		snprintf(label, sizeof(label), "-i %d", sizes[i]);
+		print_alternative(&m, image, size, &alt, label, total.us);
+	}
+	if (!s.bulk_erase && !s.delta) {
+		struct plan_settings alt = s;
+		alt.bulk_erase = true;
+		alt.dont_erase = false;
+		print_alternative(&m, image, size, &alt, "-b", total.us);
+	}
+	m.byte_us = 8e6 / (s.slow_clock ? 6e6 : 50e3);
+	print_alternative(&m, image, size, &s, s.slow_clock ? "without -s" : "-s", total.us);
+
+	free(erased);
+	free(base);
+	return true;
+}
@@ -0,0 +1,83 @@
+/*
+ *  iceprog -- simple programming tool for FTDI-based Lattice iCE programmers
+ *
+ *  Permission to use, copy, modify, and/or distribute this software for any
+ *  purpose with or without fee is hereby granted, provided that the above
+ *  copyright notice and this permission notice appear in all copies.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ *  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ *  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ *  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ *  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ *  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#ifndef PLAN_H
+#define PLAN_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* --plan: estimate what a programming or erase run would do and how long
+ * it would take, without a programmer. The spec is
+ *
+ *   [<flash>][,base=<file>][,rtt=<us>]
+ *
+ * flash  a part name or JEDEC ID from the built-in table (W25Q128JV if
+ *        left out), or a file with the part's timings:
+ *
+ *          name=MX25R1635F
+ *          id=0xC22815
+ *          size=2M
+ *          page_program=850     # typical busy times in microseconds,
+ *          erase_4k=40000       # 0 if the part lacks that erase
+ *          erase_32k=200000
+ *          erase_64k=400000
+ *          chip_erase=16000000  # whole chip
+ *
+ * base   what the flash holds now, to see which blocks a delta run
+ *        (--warmboot, --patch) leaves alone; without it every block is
+ *        assumed to change
+ * rtt    USB round trip in microseconds, 250 if left out
+ */
+
+/* Typical busy times from the datasheets, in microseconds */
+struct flash_part {
+	char name[32];
+	uint32_t jedec_id;
+	long size;
+	int page_program;
+	int erase_4k;
+	int erase_32k;	/* 0 if the part has no such erase */
+	int erase_64k;
+	long chip_erase;
+};
+
+/* Look up a part of the built-in table */
+bool plan_part_by_id(uint32_t jedec_id, struct flash_part *part);
+
+struct plan_settings {
+	int offset;
+	int block_size;		/* -i, in bytes */
+	bool bulk_erase;
+	bool dont_erase;
+	bool verify;
+	bool inline_verify;
+	bool block_mode;	/* one erase block at a time, verified as it goes */
+	bool delta;		/* blocks are read back and skipped if unchanged */
+	bool slow_clock;
+	int read_chunk;		/* 0 for the hi-speed defaults */
+	int write_chunk;
+};
+
+/* Print the erase plan, page and USB transfer counts and the estimated
+ * time per phase for programming the image (NULL to only erase size
+ * bytes), followed by the totals for other -i, -b and -s settings.
+ * Returns false after printing an error. */
+bool plan_run(const char *spec, const uint8_t *image, long size,
+		const struct plan_settings *settings, const char *my_name);
+
+#endif /* PLAN_H */
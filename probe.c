@@ -0,0 +1,276 @@
+/*
+ *  iceprog -- simple programming tool for FTDI-based Lattice iCE programmers
+ *
+ *  Permission to use, copy, modify, and/or distribute this software for any
+ *  purpose with or without fee is hereby granted, provided that the above
+ *  copyright notice and this permission notice appear in all copies.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ *  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ *  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ *  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ *  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ *  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mpsse.h"
+#include "probe.h"
+#include "stats.h"
+
+/* All measurements run with MPSSE loopback enabled, so MOSI comes back on
+ * MISO without involving the flash or the FPGA. */
+
+#define PROBE_ROUND_TRIPS 200
+#define PROBE_TOTAL (1024 * 1024)
+
+static const int latencies[] = { 1, 2, 4, 8, 16 };
+static const int xfer_sizes[] = { 256, 1024, 4096, 16384, 65536 };
+static const int chunk_sizes[] = { 512, 4096, 16384, 65536 };
+
+#define ARRAY_SIZE(a) ((int)(sizeof(a) / sizeof((a)[0])))
+
+enum probe_dir {
+	PROBE_WRITE,
+	PROBE_READ,
+	PROBE_DUPLEX,
+};
+
+static unsigned long loopback_errors;
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+	return x < y ? -1 : x > y;
+}
+
+/* Median time of a one byte loopback transfer in microseconds */
+static uint64_t probe_round_trip(void)
+{
+	uint64_t t[PROBE_ROUND_TRIPS];
+
+	for (int i = 0; i < PROBE_ROUND_TRIPS; i++) {
+		uint8_t data = i;
+		uint64_t start = stats_time_us();
+		mpsse_xfer_spi(&data, 1);
+		t[i] = stats_time_us() - start;
+		if (data != (uint8_t)i)
+			loopback_errors++;
+	}
+
+	qsort(t, PROBE_ROUND_TRIPS, sizeof(t[0]), cmp_u64);
+	return t[PROBE_ROUND_TRIPS / 2];
+}
+
+/* Throughput in KiB/s when moving PROBE_TOTAL bytes in transfers of
+ * xfer_size bytes */
+static double probe_throughput(enum probe_dir dir, int xfer_size)
+{
+	static uint8_t pattern[65536], buf[65536];
+
+	for (int i = 0; i < xfer_size; i++)
+		pattern[i] = i * 7 + (i >> 8);
+
+	uint64_t start = stats_time_us();
+
+	for (int done = 0; done < PROBE_TOTAL; done += xfer_size) {
+		switch (dir) {
+		case PROBE_WRITE:
+			mpsse_send_spi(pattern, xfer_size);
+			break;
+		case PROBE_READ:
+			mpsse_recv_spi(buf, xfer_size);
+			break;
+		case PROBE_DUPLEX:
+			memcpy(buf, pattern, xfer_size);
+			mpsse_xfer_spi(buf, xfer_size);
+			if (memcmp(buf, pattern, xfer_size))
+				loopback_errors++;
+			break;
+		}
+	}
+
+	/* Writes are only done once the MPSSE answers a later command */
+	mpsse_readb_low();
+
+	uint64_t elapsed = stats_time_us() - start;
+	return elapsed ? PROBE_TOTAL * 1e6 / 1024.0 / elapsed : 0.0;
+}
+
+/* Index of the best value, later (larger) settings have to win by more
+ * than 5% to be preferred */
+static int pick_max(const double *v, int n)
+{
+	int best = 0;
+	for (int i = 1; i < n; i++)
+		if (v[i] > v[best] * 1.05)
+			best = i;
+	return best;
+}
+
+void probe_run(FILE *out, struct probe_profile *best)
+{
+	int read_chunk, write_chunk;
+	mpsse_get_chunksize(&read_chunk, &write_chunk);
+	bool usb = read_chunk > 0;
+
+	memset(best, 0, sizeof(*best));
+	snprintf(best->serial, sizeof(best->serial), "%s", mpsse_get_serial());
+	best->latency_ms = 1;
+
+	int clock_khz = mpsse_set_max_clock();
+	mpsse_send_byte(MC_LOOPBACK_EN);
+	loopback_errors = 0;
+
+	fprintf(out, "probe: programmer '%s', SPI clock %d kHz, %d kB per measurement\n",
+			best->serial, clock_khz, PROBE_TOTAL / 1024);
+
+	/* Latency timer: matters for every status poll and short read */
+
+	fprintf(out, "\nround trip (1 byte loopback, median of %d):\n", PROBE_ROUND_TRIPS);
+	uint64_t rt[ARRAY_SIZE(latencies)];
+	int n_latencies = usb ? ARRAY_SIZE(latencies) : 1;
+	int best_latency = 0;
+	for (int i = 0; i < n_latencies; i++) {
+		mpsse_set_latency(latencies[i]);
+		rt[i] = probe_round_trip();
+		if (usb)
+			fprintf(out, "  latency timer %2d ms: %8.3f ms\n", latencies[i], rt[i] / 1000.0);
+		else
+			fprintf(out, "  %.3f ms (no latency timer)\n", rt[i] / 1000.0);
+		if (rt[i] * 1.05 < rt[best_latency])
+			best_latency = i;
+	}
+	best->latency_ms = latencies[best_latency];
+	mpsse_set_latency(best->latency_ms);
+
+	/* Transfer size: how much per-call overhead the USB stack adds */
+
+	fprintf(out, "\nthroughput by transfer size [KiB/s]:\n");
+	fprintf(out, "  %8s %10s %10s %10s\n", "size", "write", "read", "duplex");
+	double wr[ARRAY_SIZE(xfer_sizes)], rd[ARRAY_SIZE(xfer_sizes)];
+	for (int i = 0; i < ARRAY_SIZE(xfer_sizes); i++) {
+		wr[i] = probe_throughput(PROBE_WRITE, xfer_sizes[i]);
+		rd[i] = probe_throughput(PROBE_READ, xfer_sizes[i]);
+		double dx = probe_throughput(PROBE_DUPLEX, xfer_sizes[i]);
+		fprintf(out, "  %8d %10.1f %10.1f %10.1f\n", xfer_sizes[i], wr[i], rd[i], dx);
+	}
+
+	/* Smallest transfer that gets within 10% of the best rates */
+	double wr_max = wr[pick_max(wr, ARRAY_SIZE(xfer_sizes))];
+	double rd_max = rd[pick_max(rd, ARRAY_SIZE(xfer_sizes))];
+	best->xfer_size = xfer_sizes[ARRAY_SIZE(xfer_sizes) - 1];
+	for (int i = 0; i < ARRAY_SIZE(xfer_sizes); i++) {
+		if (wr[i] >= 0.9 * wr_max && rd[i] >= 0.9 * rd_max) {
+			best->xfer_size = xfer_sizes[i];
+			break;
+		}
+	}
+
+	/* libftdi chunk sizes, measured with 64 kB transfers */
+
+	if (usb) {
+		fprintf(out, "\nthroughput by libftdi chunk size [KiB/s]:\n");
+		fprintf(out, "  %8s %10s %10s\n", "chunk", "write", "read");
+		double cwr[ARRAY_SIZE(chunk_sizes)], crd[ARRAY_SIZE(chunk_sizes)];
+		for (int i = 0; i < ARRAY_SIZE(chunk_sizes); i++) {
+			mpsse_set_chunksize(chunk_sizes[i], chunk_sizes[i]);
+			cwr[i] = probe_throughput(PROBE_WRITE, 65536);
+			crd[i] = probe_throughput(PROBE_READ, 65536);
+			fprintf(out, "  %8d %10.1f %10.1f\n", chunk_sizes[i], cwr[i], crd[i]);
+		}
+		best->read_chunk = chunk_sizes[pick_max(crd, ARRAY_SIZE(chunk_sizes))];
+		best->write_chunk = chunk_sizes[pick_max(cwr, ARRAY_SIZE(chunk_sizes))];
+		mpsse_set_chunksize(best->read_chunk, best->write_chunk);
+	}
+
+	mpsse_send_byte(MC_LOOPBACK_DIS);
+
+	if (loopback_errors)
+		fprintf(out, "\nWARNING: %lu loopback transfers returned wrong data, results are unreliable\n",
+				loopback_errors);
+
+	fprintf(out, "\nrecommended: latency timer %d ms", best->latency_ms);
+	if (usb)
+		fprintf(out, ", read chunk %d, write chunk %d", best->read_chunk, best->write_chunk);
+	fprintf(out, ", transfers of %d bytes or more\n", best->xfer_size);
+}
+
+bool probe_profile_save(const char *filename, const struct probe_profile *profile)
+{
+	FILE *f = fopen(filename, "w");
+	if (f == NULL)
+		return false;
+
+	fprintf(f, "# iceprog USB profile, written by --probe-save\n");
+	fprintf(f, "serial=%s\n", profile->serial);
+	fprintf(f, "latency=%d\n", profile->latency_ms);
+	fprintf(f, "read_chunk=%d\n", profile->read_chunk);
+	fprintf(f, "write_chunk=%d\n", profile->write_chunk);
+	fprintf(f, "xfer_size=%d\n", profile->xfer_size);
+
+	return fclose(f) == 0;
+}
+
+bool probe_profile_load(const char *filename, struct probe_profile *profile)
+{
+	FILE *f = fopen(filename, "r");
+	if (f == NULL)
+		return false;
+
+	memset(profile, 0, sizeof(*profile));
+
+	char line[256];
+	int lineno = 0;
+	while (fgets(line, sizeof(line), f) != NULL) {
+		lineno++;
+		line[strcspn(line, "\r\n")] = '\0';
+		if (line[0] == '#' || line[0] == '\0')
+			continue;
+
+		char *value = strchr(line, '=');
+		if (value == NULL) {
+			fprintf(stderr, "%s:%d: expected key=value\n", filename, lineno);
+			fclose(f);
+			return false;
+		}
+		*value++ = '\0';
+
+		if (!strcmp(line, "serial"))
+			snprintf(profile->serial, sizeof(profile->serial), "%s", value);
+		else if (!strcmp(line, "latency"))
+			profile->latency_ms = atoi(value);
+		else if (!strcmp(line, "read_chunk"))
+			profile->read_chunk = atoi(value);
+		else if (!strcmp(line, "write_chunk"))
+			profile->write_chunk = atoi(value);
+		else if (!strcmp(line, "xfer_size"))
+			profile->xfer_size = atoi(value);
+		else
+			fprintf(stderr, "%s:%d: ignoring unknown key `%s'\n", filename, lineno, line);
+	}
+
+	fclose(f);
+	return true;
+}
+
+void probe_profile_apply(const struct probe_profile *profile)
+{
+	const char *serial = mpsse_get_serial();
+
+	if (profile->serial[0] != '\0' && strcmp(profile->serial, serial))
+		fprintf(stderr, "warning: profile was measured on programmer '%s', this is '%s'\n",
+				profile->serial, serial);
+
+	if (profile->latency_ms > 0 && profile->latency_ms < 256)
+		mpsse_set_latency(profile->latency_ms);
+	mpsse_set_chunksize(profile->read_chunk, profile->write_chunk);
+}
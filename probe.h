@@ -0,0 +1,40 @@
+/*
+ *  iceprog -- simple programming tool for FTDI-based Lattice iCE programmers
+ *
+ *  Permission to use, copy, modify, and/or distribute this software for any
+ *  purpose with or without fee is hereby granted, provided that the above
+ *  copyright notice and this permission notice appear in all copies.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ *  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ *  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ *  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ *  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ *  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef PROBE_H
+#define PROBE_H
+
+#include <stdio.h>
+#include <stdbool.h>
+
+/* USB settings for one programmer, as found by --probe */
+struct probe_profile {
+	char serial[128];
+	int latency_ms;
+	int read_chunk;
+	int write_chunk;
+	int xfer_size;
+};
+
+/* Measure the programmer through MPSSE loopback and fill in the best
+ * settings. Needs an initialized MPSSE with the flash deselected. */
+void probe_run(FILE *out, struct probe_profile *best);
+
+bool probe_profile_save(const char *filename, const struct probe_profile *profile);
+bool probe_profile_load(const char *filename, struct probe_profile *profile);
+void probe_profile_apply(const struct probe_profile *profile);
+
+#endif /* PROBE_H */
@@ -0,0 +1,61 @@
+/*
+ *  iceprog -- simple programming tool for FTDI-based Lattice iCE programmers
+ *
+ *  Permission to use, copy, modify, and/or distribute this software for any
+ *  purpose with or without fee is hereby granted, provided that the above
+ *  copyright notice and this permission notice appear in all copies.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ *  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ *  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ *  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ *  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ *  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#ifndef PROBES_H
+#define PROBES_H
+
+/* USDT probes for bpftrace, perf and SystemTap, provider "iceprog". They
+ * are only built with `make USDT=1' (cmake -DUSE_USDT=ON), which needs
+ * <sys/sdt.h> from systemtap-sdt-dev; otherwise they compile to nothing.
+ * An unused probe is a single nop. For example
+ *
+ *   bpftrace -e 'usdt:./iceprog:iceprog:wait_done { @us = hist(arg1); }'
+ *
+ * usb_submit(is_read, len)          libftdi call about to be made
+ * usb_complete(is_read, rc)         libftdi call returned
+ * cs_assert(), cs_deassert()        chip select queued; it changes on the
+ *                                   wire with the next USB write
+ * flash_cmd(opcode, addr)           flash command queued, addr -1 if the
+ *                                   command takes none
+ * wait_start(opcode, addr)          flash_wait() for that command
+ * wait_done(polls, busy_us)         flash ready, with the busy time seen
+ * phase(phase, name)                stats phase started, see stats.h
+ */
+
+#ifdef ICEPROG_USDT
+#include <sys/sdt.h>
+
+#define PROBE_USB_SUBMIT(is_read, len) DTRACE_PROBE2(iceprog, usb_submit, is_read, len)
+#define PROBE_USB_COMPLETE(is_read, rc) DTRACE_PROBE2(iceprog, usb_complete, is_read, rc)
+#define PROBE_CS_ASSERT() DTRACE_PROBE(iceprog, cs_assert)
+#define PROBE_CS_DEASSERT() DTRACE_PROBE(iceprog, cs_deassert)
+#define PROBE_FLASH_CMD(opcode, addr) DTRACE_PROBE2(iceprog, flash_cmd, opcode, addr)
+#define PROBE_WAIT_START(opcode, addr) DTRACE_PROBE2(iceprog, wait_start, opcode, addr)
+#define PROBE_WAIT_DONE(polls, busy_us) DTRACE_PROBE2(iceprog, wait_done, polls, busy_us)
+#define PROBE_PHASE(phase, name) DTRACE_PROBE2(iceprog, phase, phase, name)
+#else
+#define PROBE_USB_SUBMIT(is_read, len) do { } while (0)
+#define PROBE_USB_COMPLETE(is_read, rc) do { } while (0)
+#define PROBE_CS_ASSERT() do { } while (0)
+#define PROBE_CS_DEASSERT() do { } while (0)
+#define PROBE_FLASH_CMD(opcode, addr) do { } while (0)
+#define PROBE_WAIT_START(opcode, addr) do { } while (0)
+#define PROBE_WAIT_DONE(polls, busy_us) do { } while (0)
+#define PROBE_PHASE(phase, name) do { } while (0)
+#endif
+
+#endif /* PROBES_H */
@@ -0,0 +1,165 @@
+/*
+ *  iceprog -- simple programming tool for FTDI-based Lattice iCE programmers
+ *
+ *  Permission to use, copy, modify, and/or distribute this software for any
+ *  purpose with or without fee is hereby granted, provided that the above
+ *  copyright notice and this permission notice appear in all copies.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ *  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ *  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ *  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ *  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ *  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SCAN_SSE2
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define SCAN_NEON
+#endif
+
+#include "iceprog_fn.h"
+#include "log.h"
+#include "scan.h"
+
+/* Amount of flash read per SPI transaction. Large enough that the USB
+ * round trip between two reads doesn't matter. */
+#define SCAN_CHUNK_SIZE (1024 * 1024)
+
+/* Sectors per line of the occupancy map, 256 kB */
+#define SCAN_MAP_WIDTH 64
+
+// ---------------------------------------------------------
+// Sector classifier
+// ---------------------------------------------------------
+
+enum sector_class classify_sector(const uint8_t *data, int n)
+{
+	/* Fold the whole sector with AND and OR. The sector is blank if the
+	 * AND of all bytes is still 0xFF and all-zero if the OR is still 0. */
+	uint8_t and_acc = 0xff, or_acc = 0x00;
+	int i = 0;
+
+#if defined(SCAN_SSE2)
+	__m128i vand = _mm_set1_epi8(-1), vor = _mm_setzero_si128();
+	for (; i + 16 <= n; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(data + i));
+		vand = _mm_and_si128(vand, v);
+		vor = _mm_or_si128(vor, v);
+	}
+	if (_mm_movemask_epi8(_mm_cmpeq_epi8(vand, _mm_set1_epi8(-1))) != 0xffff)
+		and_acc = 0x00;
+	if (_mm_movemask_epi8(_mm_cmpeq_epi8(vor, _mm_setzero_si128())) != 0xffff)
+		or_acc = 0xff;
+#elif defined(SCAN_NEON)
+	uint8x16_t vand = vdupq_n_u8(0xff), vor = vdupq_n_u8(0x00);
+	for (; i + 16 <= n; i += 16) {
+		uint8x16_t v = vld1q_u8(data + i);
+		vand = vandq_u8(vand, v);
+		vor = vorrq_u8(vor, v);
+	}
+	and_acc = vminvq_u8(vand) == 0xff ? 0xff : 0x00;
+	or_acc = vmaxvq_u8(vor);
+#else
+	uint64_t wand = ~(uint64_t)0, wor = 0;
+	for (; i + 8 <= n; i += 8) {
+		uint64_t w;
+		memcpy(&w, data + i, 8);
+		wand &= w;
+		wor |= w;
+	}
+	if (wand != ~(uint64_t)0)
+		and_acc = 0x00;
+	if (wor != 0)
+		or_acc = 0xff;
+#endif
+
+	for (; i < n; i++) {
+		and_acc &= data[i];
+		or_acc |= data[i];
+	}
+
+	if (and_acc == 0xff)
+		return SECTOR_BLANK;
+	if (or_acc == 0x00)
+		return SECTOR_ZERO;
+	return SECTOR_DATA;
+}
+
+// ---------------------------------------------------------
+// Whole-chip occupancy scan
+// ---------------------------------------------------------
+
+static void print_range(FILE *out, int begin, int end)
+{
+	fprintf(out, "  0x%06X-0x%06X %6d kB\n", begin, end - 1, (end - begin) >> 10);
+}
+
+void flash_scan(int offset, int size, FILE *out)
+{
+	static const char map_char[] = { '.', '0', '#' };
+
+	int num_sectors = (size + SCAN_SECTOR_SIZE - 1) / SCAN_SECTOR_SIZE;
+	uint8_t *buffer = malloc(SCAN_CHUNK_SIZE);
+	char *map = malloc(num_sectors + 1);
+	if (buffer == NULL || map == NULL) {
+		fprintf(stderr, "Out of memory.\n");
+		mpsse_error(1);
+	}
+
+	fprintf(stderr, "scanning..\n");
+
+	int count[3] = { 0, 0, 0 };
+
+	for (int addr = 0; addr < size; addr += SCAN_CHUNK_SIZE) {
+		int len = size - addr > SCAN_CHUNK_SIZE ? SCAN_CHUNK_SIZE : size - addr;
+		log_progress(offset + addr, (int)(100LL * addr / size));
+		flash_fast_read(offset + addr, buffer, len);
+
+		for (int pos = 0; pos < len; pos += SCAN_SECTOR_SIZE) {
+			int n = len - pos > SCAN_SECTOR_SIZE ? SCAN_SECTOR_SIZE : len - pos;
+			enum sector_class c = classify_sector(buffer + pos, n);
+			map[(addr + pos) / SCAN_SECTOR_SIZE] = map_char[c];
+			count[c]++;
+		}
+	}
+	map[num_sectors] = '\0';
+
+	log_progress_done();
+	fprintf(stderr, "done.\n");
+
+	fprintf(out, "occupancy map (4 kB sectors, '.' blank, '0' all-zero, '#' data):\n");
+	for (int i = 0; i < num_sectors; i += SCAN_MAP_WIDTH)
+		fprintf(out, "0x%06X %.*s\n", offset + i * SCAN_SECTOR_SIZE, SCAN_MAP_WIDTH, map + i);
+
+	fprintf(out, "used ranges:\n");
+	int begin = -1;
+	for (int i = 0; i <= num_sectors; i++) {
+		bool used = i < num_sectors && map[i] != '.';
+		if (used && begin < 0)
+			begin = i;
+		if (!used && begin >= 0) {
+			int end = i * SCAN_SECTOR_SIZE > size ? size : i * SCAN_SECTOR_SIZE;
+			print_range(out, offset + begin * SCAN_SECTOR_SIZE, offset + end);
+			begin = -1;
+		}
+	}
+
+	fprintf(out, "sectors: %d data, %d all-zero, %d blank\n",
+			count[SECTOR_DATA], count[SECTOR_ZERO], count[SECTOR_BLANK]);
+
+	free(map);
+	free(buffer);
+}
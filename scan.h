@@ -0,0 +1,34 @@
+/*
+ *  iceprog -- simple programming tool for FTDI-based Lattice iCE programmers
+ *
+ *  Permission to use, copy, modify, and/or distribute this software for any
+ *  purpose with or without fee is hereby granted, provided that the above
+ *  copyright notice and this permission notice appear in all copies.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ *  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ *  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ *  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ *  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ *  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define SCAN_SECTOR_SIZE 4096
+
+enum sector_class {
+	SECTOR_BLANK, /* all bytes 0xFF (erased) */
+	SECTOR_ZERO, /* all bytes 0x00 */
+	SECTOR_DATA, /* anything else */
+};
+
+enum sector_class classify_sector(const uint8_t *data, int n);
+void flash_scan(int offset, int size, FILE *out);
+
+#endif /* SCAN_H */
@@ -0,0 +1,647 @@
+/*
+ *  iceprog -- simple programming tool for FTDI-based Lattice iCE programmers
+ *
+ *  Permission to use, copy, modify, and/or distribute this software for any
+ *  purpose with or without fee is hereby granted, provided that the above
+ *  copyright notice and this permission notice appear in all copies.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ *  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ *  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ *  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ *  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ *  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ *  Relevant Documents:
+ *  -------------------
+ *  http://www.ftdichip.com/Support/Documents/AppNotes/AN_108_Command_Processor_for_MPSSE_and_MCU_Host_Bus_Emulation_Modes.pdf
+ *  https://www.winbond.com/resource-files/w25q128jv%20revf%2003272018%20plus.pdf
+ */
+
+#define _GNU_SOURCE
+
+#ifdef _WIN32
+#include <windows.h>
+#define usleep(x) Sleep((x)/1000)
+#else
+#include <unistd.h>
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sim.h"
+#include "stats.h"
+
+/* Typical busy times of a W25Q128JV in microseconds */
+#define SIM_T_PP 400
+#define SIM_T_SE 45000
+#define SIM_T_BE32 120000
+#define SIM_T_BE64 150000
+#define SIM_T_CE_PER_MB 2500000
+#define SIM_T_W 10000
+
+/* Flash command being decoded, SIM_OP_IGNORE if the flash doesn't accept
+ * the current command (busy, powered down, unknown) */
+#define SIM_OP_IGNORE 0x00
+
+static struct {
+	/* configuration */
+	int size;
+	double time_scale;
+	int latency_us;
+	int fail_every;
+	char *filename;
+
+	/* MPSSE command stream, possibly split across writes */
+	uint8_t *cmd_buf;
+	int cmd_len, cmd_cap;
+
+	/* bytes waiting to be read by the host */
+	uint8_t *rx_buf;
+	int rx_start, rx_end, rx_cap;
+
+	unsigned long reads;
+	bool loopback;
+	uint8_t gpio_value;
+	bool cs;
+	bool creset;
+
+	/* iCE40 */
+	bool fpga_slave;
+	bool fpga_done;
+	bool fpga_synced;
+	uint32_t fpga_shift;
+
+	/* SPI flash */
+	uint8_t *mem;
+	uint8_t sr1, sr2, sr3;
+	uint8_t uid[8];
+	bool powered_down;
+	bool reset_enabled;
+	bool volatile_we;
+	uint64_t busy_until;
+
+	uint8_t op;
+	int pos;
+	uint32_t addr;
+	uint8_t arg[2];
+	uint8_t page[256];
+} sim;
+
+// ---------------------------------------------------------
+// SPI flash model
+// ---------------------------------------------------------
+
+static bool flash_busy(void)
+{
+	return stats_time_us() < sim.busy_until;
+}
+
+static uint8_t flash_sr1(void)
+{
+	return (sim.sr1 & ~0x01) | (flash_busy() ? 0x01 : 0x00);
+}
+
+static int log2_size(void)
+{
+	int n = 0;
+	while ((1 << n) < sim.size)
+		n++;
+	return n;
+}
+
+/* Block protection as selected by SR1 BP[2:0] and TB (SEC and CMP are
+ * not modelled) */
+static bool flash_protected(uint32_t addr, uint32_t len)
+{
+	int bp = (sim.sr1 >> 2) & 7;
+	if (bp == 0)
+		return false;
+
+	uint32_t prot = bp == 7 ? (uint32_t)sim.size : (uint32_t)sim.size >> (7 - bp);
+	uint32_t lo = (sim.sr1 & 0x20) ? 0 : sim.size - prot;
+	return addr < lo + prot && addr + len > lo;
+}
+
+static void flash_start_op(uint64_t busy_us)
+{
+	sim.busy_until = stats_time_us() + (uint64_t)(busy_us * sim.time_scale);
+	sim.sr1 &= ~0x02;
+	sim.volatile_we = false;
+}
+
+static void flash_erase(uint32_t block, uint64_t busy_us)
+{
+	uint32_t addr = sim.addr & (sim.size - 1) & ~(block - 1);
+
+	if (!(sim.sr1 & 0x02) || sim.pos != 4 || flash_protected(addr, block))
+		return;
+
+	memset(sim.mem + addr, 0xff, block);
+	flash_start_op(busy_us);
+}
+
+static void flash_select(void)
+{
+	sim.pos = 0;
+	sim.addr = 0;
+	memset(sim.page, 0xff, sizeof(sim.page));
+}
+
+/* Commands that change state take effect when CS goes high */
+static void flash_deselect(void)
+{
+	uint8_t op = sim.pos > 0 ? sim.op : SIM_OP_IGNORE;
+	bool wel = (sim.sr1 & 0x02) != 0;
+
+	if (op != 0x66 && op != SIM_OP_IGNORE)
+		sim.reset_enabled = false;
+
+	switch (op) {
+	case 0x06: /* Write Enable */
+		sim.sr1 |= 0x02;
+		break;
+	case 0x04: /* Write Disable */
+		sim.sr1 &= ~0x02;
+		break;
+	case 0x50: /* Volatile SR Write Enable */
+		sim.volatile_we = true;
+		break;
+	case 0x02: /* Page Program */
+		if (wel && sim.pos > 4) {
+			uint32_t page = sim.addr & (sim.size - 1) & ~0xff;
+			if (!flash_protected(page, 256)) {
+				for (int i = 0; i < 256; i++)
+					sim.mem[page + i] &= sim.page[i];
+				flash_start_op(SIM_T_PP);
+			}
+		}
+		break;
+	case 0x20: /* Sector Erase 4kb */
+		flash_erase(4096, SIM_T_SE);
+		break;
+	case 0x52: /* Block Erase 32kb */
+		flash_erase(32768, SIM_T_BE32);
+		break;
+	case 0xD8: /* Block Erase 64kb */
+		flash_erase(65536, SIM_T_BE64);
+		break;
+	case 0xC7: /* Chip Erase */
+	case 0x60:
+		if (wel && sim.pos == 1 && ((sim.sr1 >> 2) & 7) == 0) {
+			memset(sim.mem, 0xff, sim.size);
+			flash_start_op((uint64_t)SIM_T_CE_PER_MB * (sim.size >> 20));
+		}
+		break;
+	case 0x01: /* Write Status Register 1 (and 2) */
+		if ((wel || sim.volatile_we) && sim.pos >= 2) {
+			sim.sr1 = (sim.arg[0] & 0xfc) | (sim.sr1 & 0x03);
+			if (sim.pos >= 3)
+				sim.sr2 = sim.arg[1];
+			flash_start_op(SIM_T_W);
+		}
+		break;
+	case 0x31: /* Write Status Register 2 */
+		if ((wel || sim.volatile_we) && sim.pos >= 2) {
+			sim.sr2 = sim.arg[0];
+			flash_start_op(SIM_T_W);
+		}
+		break;
+	case 0x11: /* Write Status Register 3 */
+		if ((wel || sim.volatile_we) && sim.pos >= 2) {
+			sim.sr3 = sim.arg[0];
+			flash_start_op(SIM_T_W);
+		}
+		break;
+	case 0xB9: /* Power-down */
+		if (sim.pos == 1)
+			sim.powered_down = true;
+		break;
+	case 0xAB: /* Release Power-Down */
+		sim.powered_down = false;
+		break;
+	case 0x66: /* Enable Reset */
+		sim.reset_enabled = sim.pos == 1;
+		break;
+	case 0x99: /* Reset Device */
+		if (sim.reset_enabled && sim.pos == 1) {
+			sim.sr1 &= ~0x02;
+			sim.volatile_we = false;
+			sim.powered_down = false;
+		}
+		sim.reset_enabled = false;
+		break;
+	}
+}
+
+static uint8_t flash_xfer(uint8_t mosi)
+{
+	int pos = sim.pos++;
+
+	if (pos == 0) {
+		sim.op = mosi;
+		if (sim.powered_down && mosi != 0xAB)
+			sim.op = SIM_OP_IGNORE;
+		if (flash_busy() && mosi != 0x05 && mosi != 0x35 && mosi != 0x15)
+			sim.op = SIM_OP_IGNORE;
+		return 0xff;
+	}
+
+	/* 24 bit address for commands that take one */
+	if (pos <= 3 && (sim.op == 0x03 || sim.op == 0x0B || sim.op == 0x02 || sim.op == 0x20 ||
+			sim.op == 0x52 || sim.op == 0xD8 || sim.op == 0x5A)) {
+		sim.addr = (sim.addr << 8) | mosi;
+		return 0xff;
+	}
+
+	switch (sim.op) {
+	case 0x9F: /* Read JEDEC ID */
+		if (pos == 1)
+			return 0xEF;
+		if (pos == 2)
+			return 0x40;
+		if (pos == 3)
+			return log2_size();
+		return 0x00;
+	case 0x4B: /* Read Unique ID, 4 dummy bytes first */
+		return pos >= 5 && pos < 13 ? sim.uid[pos - 5] : 0xff;
+	case 0xAB: /* Release Power-Down / Device ID */
+		return pos >= 4 ? log2_size() - 1 : 0xff;
+	case 0x05:
+		return flash_sr1();
+	case 0x35:
+		return sim.sr2;
+	case 0x15:
+		return sim.sr3;
+	case 0x03: /* Read Data */
+		return sim.mem[(sim.addr + pos - 4) & (sim.size - 1)];
+	case 0x0B: /* Fast Read, one dummy byte */
+		return pos >= 5 ? sim.mem[(sim.addr + pos - 5) & (sim.size - 1)] : 0xff;
+	case 0x02: /* Page Program, data wraps within the page */
+		sim.page[(sim.addr + pos - 4) & 0xff] = mosi;
+		return 0xff;
+	case 0x01:
+	case 0x31:
+	case 0x11:
+		if (pos <= 2)
+			sim.arg[pos - 1] = mosi;
+		return 0xff;
+	default:
+		return 0xff;
+	}
+}
+
+// ---------------------------------------------------------
+// iCE40 model
+// ---------------------------------------------------------
+
+/* The FPGA only boots if there is a sync word near the start of flash */
+static bool fpga_flash_valid(void)
+{
+	for (int i = 0; i + 4 <= 256 && i + 4 <= sim.size; i++)
+		if (sim.mem[i] == 0x7E && sim.mem[i + 1] == 0xAA && sim.mem[i + 2] == 0x99 && sim.mem[i + 3] == 0x7E)
+			return true;
+	return false;
+}
+
+/* SRAM configuration: CDONE goes high after the sync word was followed
+ * by a wakeup command */
+static void fpga_byte(uint8_t b)
+{
+	sim.fpga_shift = (sim.fpga_shift << 8) | b;
+	if (sim.fpga_shift == 0x7EAA997E)
+		sim.fpga_synced = true;
+	else if (sim.fpga_synced && (sim.fpga_shift & 0xffff) == 0x0106)
+		sim.fpga_done = true;
+}
+
+// ---------------------------------------------------------
+// MPSSE model
+// ---------------------------------------------------------
+
+static void rx_push(uint8_t b)
+{
+	if (sim.rx_end == sim.rx_cap) {
+		if (sim.rx_start > 0) {
+			memmove(sim.rx_buf, sim.rx_buf + sim.rx_start, sim.rx_end - sim.rx_start);
+			sim.rx_end -= sim.rx_start;
+			sim.rx_start = 0;
+		} else {
+			sim.rx_cap = sim.rx_cap ? 2 * sim.rx_cap : 65536;
+			sim.rx_buf = realloc(sim.rx_buf, sim.rx_cap);
+			if (sim.rx_buf == NULL) {
+				fprintf(stderr, "sim: out of memory\n");
+				exit(1);
+			}
+		}
+	}
+	sim.rx_buf[sim.rx_end++] = b;
+}
+
+static void sim_set_gpio(uint8_t value, uint8_t direction)
+{
+	/* Both lines are pulled up and only driven low */
+	bool cs = (direction & 0x10) && !(value & 0x10);
+	bool creset = (direction & 0x80) && !(value & 0x80);
+
+	if (creset) {
+		sim.fpga_slave = false;
+		sim.fpga_done = false;
+	} else if (sim.creset) {
+		/* Reset released: the iCE40 samples CS to pick SPI slave (SRAM)
+		 * or master (boot from flash) mode */
+		sim.fpga_slave = cs;
+		sim.fpga_synced = false;
+		sim.fpga_shift = 0;
+		sim.fpga_done = !cs && fpga_flash_valid();
+	}
+
+	if (cs != sim.cs && !sim.fpga_slave) {
+		if (cs)
+			flash_select();
+		else
+			flash_deselect();
+	}
+
+	sim.gpio_value = value;
+	sim.cs = cs;
+	sim.creset = creset;
+}
+
+static uint8_t sim_spi_byte(uint8_t mosi)
+{
+	if (sim.loopback)
+		return mosi;
+	if (!sim.cs)
+		return 0xff;
+	if (sim.fpga_slave) {
+		fpga_byte(mosi);
+		return 0xff;
+	}
+	return flash_xfer(mosi);
+}
+
+/* Length of the command at p, or 0 if it is incomplete */
+static int sim_cmd_length(const uint8_t *p, int avail)
+{
+	uint8_t cmd = p[0];
+
+	if (cmd < 0x80) {
+		if (cmd & (MC_DATA_TMS | MC_DATA_BITS))
+			return avail >= 2 && (!(cmd & MC_DATA_OUT) || avail >= 3) ? ((cmd & MC_DATA_OUT) ? 3 : 2) : 0;
+		if (avail < 3)
+			return 0;
+		int len = 3 + ((cmd & MC_DATA_OUT) ? (p[1] | (p[2] << 8)) + 1 : 0);
+		return avail >= len ? len : 0;
+	}
+
+	int len;
+	switch (cmd) {
+	case MC_SETB_LOW:
+	case MC_SETB_HIGH:
+	case MC_SET_CLK_DIV:
+	case MC_CLK_N8:
+	case MC_CLK8_TO_H:
+	case MC_CLK8_TO_L:
+	case MC_TRI:
+		len = 3;
+		break;
+	case MC_CLK_N:
+		len = 2;
+		break;
+	default:
+		len = 1;
+		break;
+	}
+	return avail >= len ? len : 0;
+}
+
+static void sim_execute(const uint8_t *p)
+{
+	uint8_t cmd = p[0];
+
+	if (cmd < 0x80) {
+		if (cmd & MC_DATA_TMS) {
+			rx_push(0xFA);
+			rx_push(cmd);
+			return;
+		}
+		if (cmd & MC_DATA_BITS) {
+			/* Partial bytes only occur in flash_reset() to leave QPI
+			 * mode, which the model doesn't have */
+			if (cmd & MC_DATA_IN)
+				rx_push(0xff);
+			return;
+		}
+		int len = (p[1] | (p[2] << 8)) + 1;
+		for (int i = 0; i < len; i++) {
+			uint8_t miso = sim_spi_byte((cmd & MC_DATA_OUT) ? p[3 + i] : 0xff);
+			if (cmd & MC_DATA_IN)
+				rx_push(miso);
+		}
+		return;
+	}
+
+	switch (cmd) {
+	case MC_SETB_LOW:
+		sim_set_gpio(p[1], p[2]);
+		break;
+	case MC_READB_LOW:
+		rx_push((sim.gpio_value & ~0x40) | (sim.fpga_done ? 0x40 : 0x00));
+		break;
+	case MC_READB_HIGH:
+		rx_push(0x00);
+		break;
+	case MC_LOOPBACK_EN:
+		sim.loopback = true;
+		break;
+	case MC_LOOPBACK_DIS:
+		sim.loopback = false;
+		break;
+	case MC_SETB_HIGH:
+	case MC_SET_CLK_DIV:
+	case MC_FLUSH:
+	case MC_TCK_X5:
+	case MC_TCK_D5:
+	case MC_EN_3PH_CLK:
+	case MC_DIS_3PH_CLK:
+	case MC_CLK_N:
+	case MC_CLK_N8:
+	case MC_EN_ADPT_CLK:
+	case MC_DIS_ADPT_CLK:
+	case MC_TRI:
+		break;
+	default:
+		/* Same answer as the real MPSSE to an unknown opcode */
+		rx_push(0xFA);
+		rx_push(cmd);
+		break;
+	}
+}
+
+static int sim_write(const uint8_t *data, int n)
+{
+	if (sim.latency_us)
+		usleep(sim.latency_us);
+
+	if (sim.cmd_len + n > sim.cmd_cap) {
+		sim.cmd_cap = sim.cmd_len + n + 65536;
+		sim.cmd_buf = realloc(sim.cmd_buf, sim.cmd_cap);
+		if (sim.cmd_buf == NULL) {
+			fprintf(stderr, "sim: out of memory\n");
+			exit(1);
+		}
+	}
+	memcpy(sim.cmd_buf + sim.cmd_len, data, n);
+	sim.cmd_len += n;
+
+	int pos = 0, len;
+	while (pos < sim.cmd_len && (len = sim_cmd_length(sim.cmd_buf + pos, sim.cmd_len - pos)) > 0) {
+		sim_execute(sim.cmd_buf + pos);
+		pos += len;
+	}
+	memmove(sim.cmd_buf, sim.cmd_buf + pos, sim.cmd_len - pos);
+	sim.cmd_len -= pos;
+
+	return n;
+}
+
+static int sim_read(uint8_t *data, int n)
+{
+	if (sim.latency_us)
+		usleep(sim.latency_us);
+
+	/* Injected USB failure, the data stays queued like on a real FTDI */
+	if (sim.fail_every && ++sim.reads % sim.fail_every == 0)
+		return -1;
+
+	int len = sim.rx_end - sim.rx_start;
+	if (len > n)
+		len = n;
+	memcpy(data, sim.rx_buf + sim.rx_start, len);
+	sim.rx_start += len;
+	if (sim.rx_start == sim.rx_end)
+		sim.rx_start = sim.rx_end = 0;
+	return len;
+}
+
+void sim_purge(void)
+{
+	sim.rx_start = sim.rx_end = 0;
+	sim.cmd_len = 0;
+}
+
+static void sim_close(void)
+{
+	if (sim.filename != NULL) {
+		FILE *f = fopen(sim.filename, "wb");
+		if (f == NULL || fwrite(sim.mem, 1, sim.size, f) != (size_t)sim.size)
+			fprintf(stderr, "sim: can't save flash contents to '%s'\n", sim.filename);
+		if (f != NULL)
+			fclose(f);
+	}
+
+	free(sim.mem);
+	free(sim.cmd_buf);
+	free(sim.rx_buf);
+	free(sim.filename);
+	memset(&sim, 0, sizeof(sim));
+}
+
+const struct mpsse_transport sim_transport = {
+	sim_write,
+	sim_read,
+	sim_close,
+};
+
+// ---------------------------------------------------------
+// Setup
+// ---------------------------------------------------------
+
+static bool parse_size(const char *p, char **endptr, int *size)
+{
+	long v = strtol(p, endptr, 0);
+	if (**endptr == 'k') {
+		v *= 1024;
+		(*endptr)++;
+	} else if (**endptr == 'M') {
+		v *= 1024 * 1024;
+		(*endptr)++;
+	}
+	*size = v;
+	return *endptr != p;
+}
+
+bool sim_open(const char *spec)
+{
+	char *p;
+
+	memset(&sim, 0, sizeof(sim));
+	sim.time_scale = 1.0;
+	memcpy(sim.uid, "iceprog\x01", 8);
+
+	if (!parse_size(spec, &p, &sim.size) || sim.size < 65536 || sim.size > 16 * 1024 * 1024 ||
+			(sim.size & (sim.size - 1)) != 0) {
+		fprintf(stderr, "sim: flash size must be a power of two from 64k to 16M\n");
+		return false;
+	}
+
+	while (*p == ',') {
+		p++;
+		size_t keylen = strcspn(p, "=");
+		const char *value = p + keylen + 1;
+		size_t valuelen = strcspn(value, ",");
+
+		if (p[keylen] != '=') {
+			fprintf(stderr, "sim: option `%s' needs a value\n", p);
+			return false;
+		} else if (keylen == 4 && !strncmp(p, "time", 4)) {
+			sim.time_scale = strtod(value, NULL);
+		} else if (keylen == 7 && !strncmp(p, "latency", 7)) {
+			sim.latency_us = strtol(value, NULL, 0);
+		} else if (keylen == 4 && !strncmp(p, "fail", 4)) {
+			sim.fail_every = strtol(value, NULL, 0);
+		} else if (keylen == 3 && !strncmp(p, "sr1", 3)) {
+			sim.sr1 = strtol(value, NULL, 0) & 0xfc;
+		} else if (keylen == 3 && !strncmp(p, "uid", 3)) {
+			for (int i = 0; i < 8 && 2 * i + 1 < (int)valuelen; i++)
+				sscanf(value + 2 * i, "%2hhx", &sim.uid[i]);
+		} else if (keylen == 4 && !strncmp(p, "file", 4)) {
+			sim.filename = malloc(valuelen + 1);
+			memcpy(sim.filename, value, valuelen);
+			sim.filename[valuelen] = '\0';
+		} else {
+			fprintf(stderr, "sim: unknown option `%.*s'\n", (int)keylen, p);
+			return false;
+		}
+		p = (char *)value + valuelen;
+	}
+
+	sim.mem = malloc(sim.size);
+	if (sim.mem == NULL) {
+		fprintf(stderr, "sim: out of memory\n");
+		return false;
+	}
+	memset(sim.mem, 0xff, sim.size);
+
+	if (sim.filename != NULL) {
+		FILE *f = fopen(sim.filename, "rb");
+		if (f != NULL) {
+			if (fread(sim.mem, 1, sim.size, f) == 0)
+				fprintf(stderr, "sim: '%s' is empty, starting erased\n", sim.filename);
+			fclose(f);
+		}
+	}
+
+	/* Lines float high until driven */
+	sim.cs = false;
+	sim.creset = false;
+
+	fprintf(stderr, "sim: %d kB W25Q-style flash, time scale %g\n", sim.size >> 10, sim.time_scale);
+	return true;
+}
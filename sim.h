@@ -0,0 +1,45 @@
+/*
+ *  iceprog -- simple programming tool for FTDI-based Lattice iCE programmers
+ *
+ *  Permission to use, copy, modify, and/or distribute this software for any
+ *  purpose with or without fee is hereby granted, provided that the above
+ *  copyright notice and this permission notice appear in all copies.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ *  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ *  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ *  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ *  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ *  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef SIM_H
+#define SIM_H
+
+#include <stdbool.h>
+#include "mpsse.h"
+
+/* Software model of an FTDI MPSSE wired to a W25Q-style SPI flash and an
+ * iCE40, selected with the device string
+ *
+ *   sim:<size>[,time=<scale>][,latency=<us>][,file=<path>][,sr1=<value>][,uid=<hex>]
+ *       [,fail=<n>]
+ *
+ * time    scales the modelled busy times (0 makes them instant)
+ * latency is added to every USB read and write call
+ * file    holds the flash contents across runs
+ * sr1     is the status register 1 value at power up (e.g. 0x1C to start
+ *         with the whole array protected)
+ * uid     is the 64 bit unique ID returned by command 0x4B
+ * fail    makes every n-th USB read fail, to exercise error recovery
+ */
+bool sim_open(const char *spec);
+
+/* Drop queued replies and half received commands, what reopening a real
+ * FTDI does on mpsse_reconnect() */
+void sim_purge(void);
+
+extern const struct mpsse_transport sim_transport;
+
+#endif /* SIM_H */
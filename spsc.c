@@ -0,0 +1,236 @@
+/*
+ *  iceprog -- simple programming tool for FTDI-based Lattice iCE programmers
+ *
+ *  Permission to use, copy, modify, and/or distribute this software for any
+ *  purpose with or without fee is hereby granted, provided that the above
+ *  copyright notice and this permission notice appear in all copies.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ *  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ *  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ *  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ *  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ *  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+#include "spsc.h"
+#include "stats.h"
+#include "thread.h"
+
+#define SPSC_CACHE_LINE 64
+
+/* Checks before a waiting side goes to sleep */
+#define SPSC_SPINS 1000
+
+/* Each slot descriptor has a cache line of its own, so the two threads
+ * don't share lines while working on neighbouring slots */
+union spsc_line {
+	struct spsc_slot slot;
+	char pad[SPSC_CACHE_LINE];
+};
+
+struct spsc {
+	/* Written by the producer only */
+	uint64_t head;
+	uint64_t cached_tail;
+	int closed;
+	int producer_waiting;
+	uint64_t items;
+	uint64_t full_stalls;
+	uint64_t full_us;
+	char pad0[SPSC_CACHE_LINE];
+
+	/* Written by the consumer only */
+	uint64_t tail;
+	uint64_t cached_head;
+	int consumer_waiting;
+	uint64_t empty_stalls;
+	uint64_t empty_us;
+	char pad1[SPSC_CACHE_LINE];
+
+	uint64_t mask;
+	union spsc_line *slots;
+	uint8_t *buffer;
+
+	/* Only used by a side about to sleep and by the other one waking
+	   it */
+	struct thread_cond cond;
+};
+
+static void *alloc_aligned(size_t n)
+{
+#ifdef _WIN32
+	return _aligned_malloc(n, SPSC_CACHE_LINE);
+#else
+	void *p;
+	return posix_memalign(&p, SPSC_CACHE_LINE, n) == 0 ? p : NULL;
+#endif
+}
+
+static void free_aligned(void *p)
+{
+#ifdef _WIN32
+	_aligned_free(p);
+#else
+	free(p);
+#endif
+}
+
+static bool ring_full(struct spsc *q)
+{
+	q->cached_tail = __atomic_load_n(&q->tail, __ATOMIC_SEQ_CST);
+	return q->head - q->cached_tail > q->mask;
+}
+
+/* False once closed, the caller tells the two apart */
+static bool ring_empty(struct spsc *q)
+{
+	q->cached_head = __atomic_load_n(&q->head, __ATOMIC_SEQ_CST);
+	return q->cached_head == q->tail && !__atomic_load_n(&q->closed, __ATOMIC_SEQ_CST);
+}
+
+/* Busy-wait a little, the other side is usually just about done, then
+ * sleep so a stalled pipeline doesn't burn a core. The flag is set
+ * before the ring is checked again, and the other side checks the flag
+ * after it moved: either this side sees the move or the other side sees
+ * the flag, and it can only signal once this side is in the wait. */
+static void wait_while(struct spsc *q, int *waiting, bool (*blocked)(struct spsc *q))
+{
+	for (int spins = 0; spins < SPSC_SPINS; spins++)
+		if (!blocked(q))
+			return;
+
+	thread_cond_lock(&q->cond);
+	__atomic_store_n(waiting, 1, __ATOMIC_SEQ_CST);
+	while (blocked(q))
+		thread_cond_wait(&q->cond);
+	__atomic_store_n(waiting, 0, __ATOMIC_RELAXED);
+	thread_cond_unlock(&q->cond);
+}
+
+static void wake(struct spsc *q, int *waiting)
+{
+	if (!__atomic_load_n(waiting, __ATOMIC_SEQ_CST))
+		return;
+	thread_cond_lock(&q->cond);
+	thread_cond_signal(&q->cond);
+	thread_cond_unlock(&q->cond);
+}
+
+struct spsc *spsc_new(int n_slots, int slot_size)
+{
+	uint64_t n = 1;
+	while (n < (uint64_t)n_slots)
+		n <<= 1;
+	size_t stride = (slot_size + SPSC_CACHE_LINE - 1) & ~(SPSC_CACHE_LINE - 1);
+
+	struct spsc *q = alloc_aligned(sizeof(*q));
+	if (q == NULL)
+		return NULL;
+	memset(q, 0, sizeof(*q));
+	if (!thread_cond_init(&q->cond)) {
+		free_aligned(q);
+		return NULL;
+	}
+	q->mask = n - 1;
+	q->slots = alloc_aligned(n * sizeof(union spsc_line));
+	q->buffer = alloc_aligned(n * stride);
+	if (q->slots == NULL || q->buffer == NULL) {
+		spsc_free(q);
+		return NULL;
+	}
+
+	for (uint64_t i = 0; i < n; i++) {
+		memset(&q->slots[i], 0, sizeof(q->slots[i]));
+		q->slots[i].slot.data = q->buffer + i * stride;
+	}
+	return q;
+}
+
+void spsc_free(struct spsc *q)
+{
+	if (q == NULL)
+		return;
+	if (q->slots != NULL)
+		free_aligned(q->slots);
+	if (q->buffer != NULL)
+		free_aligned(q->buffer);
+	thread_cond_destroy(&q->cond);
+	free_aligned(q);
+}
+
+struct spsc_slot *spsc_acquire(struct spsc *q)
+{
+	if (q->head - q->cached_tail > q->mask && ring_full(q)) {
+		uint64_t start = stats_time_us();
+		q->full_stalls++;
+		wait_while(q, &q->producer_waiting, ring_full);
+		q->full_us += stats_time_us() - start;
+	}
+
+	struct spsc_slot *slot = &q->slots[q->head & q->mask].slot;
+	slot->len = 0;
+	return slot;
+}
+
+void spsc_publish(struct spsc *q)
+{
+	q->items++;
+	__atomic_store_n(&q->head, q->head + 1, __ATOMIC_SEQ_CST);
+	wake(q, &q->consumer_waiting);
+}
+
+void spsc_close(struct spsc *q)
+{
+	__atomic_store_n(&q->closed, 1, __ATOMIC_SEQ_CST);
+	wake(q, &q->consumer_waiting);
+}
+
+struct spsc_slot *spsc_peek(struct spsc *q)
+{
+	if (q->cached_head == q->tail && ring_empty(q)) {
+		uint64_t start = stats_time_us();
+		q->empty_stalls++;
+		wait_while(q, &q->consumer_waiting, ring_empty);
+		q->empty_us += stats_time_us() - start;
+	}
+
+	/* Closed. The head is read again after seeing the close, the last
+	   slot may have been published just before it. */
+	if (q->cached_head == q->tail) {
+		q->cached_head = __atomic_load_n(&q->head, __ATOMIC_ACQUIRE);
+		if (q->cached_head == q->tail)
+			return NULL;
+	}
+
+	return &q->slots[q->tail & q->mask].slot;
+}
+
+void spsc_release(struct spsc *q)
+{
+	__atomic_store_n(&q->tail, q->tail + 1, __ATOMIC_SEQ_CST);
+	wake(q, &q->producer_waiting);
+}
+
+void spsc_get_stats(const struct spsc *q, struct spsc_stats *stats)
+{
+	stats->items = q->items;
+	stats->producer_stalls = q->full_stalls;
+	stats->producer_stall_us = q->full_us;
+	stats->consumer_stalls = q->empty_stalls;
+	stats->consumer_stall_us = q->empty_us;
+}
@@ -0,0 +1,65 @@
+/*
+ *  iceprog -- simple programming tool for FTDI-based Lattice iCE programmers
+ *
+ *  Permission to use, copy, modify, and/or distribute this software for any
+ *  purpose with or without fee is hereby granted, provided that the above
+ *  copyright notice and this permission notice appear in all copies.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ *  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ *  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ *  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ *  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ *  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#ifndef SPSC_H
+#define SPSC_H
+
+#include <stdint.h>
+
+/* Lock-free ring of preallocated buffers between exactly one producer
+ * and one consumer thread. The producer fills the slot it gets from
+ * spsc_acquire() and hands it over with spsc_publish(), the consumer
+ * works on the slot from spsc_peek() and gives it back with
+ * spsc_release(). Both sides wait when the ring is full or empty, which
+ * is the backpressure between them: they spin briefly, then sleep until
+ * the other side moves. How often and how long they waited is counted. */
+
+struct spsc_slot {
+	uint8_t *data;		/* slot_size bytes, 64 byte aligned */
+	int len;
+	int addr;		/* for the caller */
+};
+
+struct spsc_stats {
+	uint64_t items;
+	uint64_t producer_stalls;	/* times the ring was full */
+	uint64_t producer_stall_us;
+	uint64_t consumer_stalls;	/* times it was empty */
+	uint64_t consumer_stall_us;
+};
+
+struct spsc;
+
+/* n_slots is rounded up to a power of two. Returns NULL if out of
+ * memory. */
+struct spsc *spsc_new(int n_slots, int slot_size);
+void spsc_free(struct spsc *q);
+
+/* Producer side. spsc_acquire() waits for a free slot. */
+struct spsc_slot *spsc_acquire(struct spsc *q);
+void spsc_publish(struct spsc *q);
+void spsc_close(struct spsc *q);
+
+/* Consumer side. spsc_peek() waits for a slot, NULL once the producer
+ * has closed the ring and everything has been consumed. */
+struct spsc_slot *spsc_peek(struct spsc *q);
+void spsc_release(struct spsc *q);
+
+/* Only meaningful once both sides are done */
+void spsc_get_stats(const struct spsc *q, struct spsc_stats *stats);
+
+#endif /* SPSC_H */
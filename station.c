@@ -0,0 +1,445 @@
+/*
+ *  iceprog -- simple programming tool for FTDI-based Lattice iCE programmers
+ *
+ *  Permission to use, copy, modify, and/or distribute this software for any
+ *  purpose with or without fee is hereby granted, provided that the above
+ *  copyright notice and this permission notice appear in all copies.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ *  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ *  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ *  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ *  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ *  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#endif
+
+#include <ftdi.h>
+
+#include "station.h"
+#include "stats.h"
+
+/* Needs fork() and the libusb-1.0 device API, i.e. libftdi1 */
+#if !defined(_WIN32) && defined(LIBUSB_API_VERSION)
+
+#define STATION_MAX_BOARDS 64
+
+/* How often the device list is polled without hotplug support, and how
+   long libusb event handling waits at most */
+#define STATION_POLL_US 250000
+
+/* A programmer that just appeared is left alone for this long, so that
+   udev can set up the device node permissions */
+#define STATION_SETTLE_US 500000
+
+enum board_state {
+	BOARD_NEW,      /* attached, not programmed yet */
+	BOARD_RUNNING,  /* a child is programming it */
+	BOARD_DONE      /* finished, waiting for it to be unplugged */
+};
+
+struct board {
+	int bus, address;
+	enum board_state state;
+	bool present;
+	uint64_t seen_us;
+	uint64_t start_us;
+};
+
+/* libusb state doesn't survive fork(), so the boards aren't forked from
+   the process watching for them. The original process stays the
+   spawner: it forks the monitor before libusb is touched, then forks a
+   child for every board the monitor asks for and reports back when it
+   exits. */
+struct station_msg {
+	int bus, address;
+	bool started;   /* false if the child couldn't be forked */
+	int status;     /* waitpid() status of the child */
+};
+
+static struct board boards[STATION_MAX_BOARDS];
+static int n_boards = 0;
+static int n_running = 0;
+static int n_passed = 0, n_failed = 0;
+
+static int match_vendor, match_product;
+
+/* Monitor side of the pipes to the spawner */
+static int request_fd = -1, done_fd = -1;
+
+static volatile sig_atomic_t stop_requested = 0;
+
+static void on_signal(int sig)
+{
+	(void)sig;
+	stop_requested = 1;
+}
+
+static bool device_matches(libusb_device *dev)
+{
+	struct libusb_device_descriptor desc;
+
+	if (libusb_get_device_descriptor(dev, &desc) < 0)
+		return false;
+	if (match_vendor)
+		return desc.idVendor == match_vendor && desc.idProduct == match_product;
+	return desc.idVendor == 0x0403 && (desc.idProduct == 0x6010 || desc.idProduct == 0x6014);
+}
+
+static struct board *find_board(int bus, int address)
+{
+	for (int i = 0; i < n_boards; i++)
+		if (boards[i].bus == bus && boards[i].address == address)
+			return &boards[i];
+	return NULL;
+}
+
+static void remove_board(struct board *b)
+{
+	*b = boards[--n_boards];
+}
+
+static void device_arrived(libusb_device *dev)
+{
+	int bus = libusb_get_bus_number(dev);
+	int address = libusb_get_device_address(dev);
+
+	struct board *b = find_board(bus, address);
+	if (b != NULL) {
+		b->present = true;
+		return;
+	}
+
+	if (n_boards == STATION_MAX_BOARDS) {
+		fprintf(stderr, "station: too many programmers, ignoring %03d/%03d\n", bus, address);
+		return;
+	}
+
+	b = &boards[n_boards++];
+	memset(b, 0, sizeof(*b));
+	b->bus = bus;
+	b->address = address;
+	b->state = BOARD_NEW;
+	b->present = true;
+	b->seen_us = stats_time_us();
+	fprintf(stderr, "station: %03d/%03d attached\n", bus, address);
+}
+
+/* A running board stays in the list until its child has been reaped */
+static void board_gone(struct board *b)
+{
+	fprintf(stderr, "station: %03d/%03d removed\n", b->bus, b->address);
+	if (b->state == BOARD_RUNNING)
+		b->present = false;
+	else
+		remove_board(b);
+}
+
+#if LIBUSB_API_VERSION >= 0x01000102
+static int LIBUSB_CALL hotplug_event(libusb_context *ctx, libusb_device *dev,
+		libusb_hotplug_event event, void *user_data)
+{
+	(void)ctx;
+	(void)user_data;
+
+	if (!device_matches(dev))
+		return 0;
+
+	if (event == LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED) {
+		device_arrived(dev);
+	} else {
+		struct board *b = find_board(libusb_get_bus_number(dev), libusb_get_device_address(dev));
+		if (b != NULL)
+			board_gone(b);
+	}
+	return 0;
+}
+#endif
+
+static void poll_devices(libusb_context *ctx)
+{
+	libusb_device **list;
+	ssize_t n = libusb_get_device_list(ctx, &list);
+	if (n < 0)
+		return;
+
+	for (int i = 0; i < n_boards; i++)
+		boards[i].present = false;
+	for (ssize_t i = 0; i < n; i++)
+		if (device_matches(list[i]))
+			device_arrived(list[i]);
+	libusb_free_device_list(list, 1);
+
+	for (int i = n_boards - 1; i >= 0; i--)
+		if (!boards[i].present && boards[i].state != BOARD_RUNNING)
+			board_gone(&boards[i]);
+}
+
+static void reap_boards(void)
+{
+	struct station_msg msg;
+
+	while (read(done_fd, &msg, sizeof(msg)) == sizeof(msg)) {
+		struct board *b = find_board(msg.bus, msg.address);
+		if (b == NULL || b->state != BOARD_RUNNING)
+			continue;
+
+		double seconds = (stats_time_us() - b->start_us) / 1e6;
+		if (!msg.started) {
+			/* the spawner said why */
+			n_failed++;
+		} else if (WIFEXITED(msg.status) && WEXITSTATUS(msg.status) == 0) {
+			fprintf(stderr, "station: %03d/%03d PASS (%.1f s)\n", b->bus, b->address, seconds);
+			n_passed++;
+		} else if (WIFEXITED(msg.status)) {
+			fprintf(stderr, "station: %03d/%03d FAIL, exit status %d (%.1f s)\n",
+					b->bus, b->address, WEXITSTATUS(msg.status), seconds);
+			n_failed++;
+		} else {
+			fprintf(stderr, "station: %03d/%03d FAIL, killed by signal %d\n",
+					b->bus, b->address, WTERMSIG(msg.status));
+			n_failed++;
+		}
+
+		n_running--;
+		b->state = BOARD_DONE;
+		if (!b->present)
+			remove_board(b);
+	}
+}
+
+/* Ask the spawner for a child for a board */
+static void start_board(struct board *b)
+{
+	struct station_msg msg = { .bus = b->bus, .address = b->address };
+
+	if (write(request_fd, &msg, sizeof(msg)) != sizeof(msg)) {
+		fprintf(stderr, "station: can't start job for %03d/%03d: %s\n", b->bus, b->address, strerror(errno));
+		b->state = BOARD_DONE;
+		n_failed++;
+		return;
+	}
+
+	b->state = BOARD_RUNNING;
+	b->start_us = stats_time_us();
+	n_running++;
+	fprintf(stderr, "station: %03d/%03d programming\n", b->bus, b->address);
+}
+
+/* Watch for programmers, exits when told to stop and the last board is
+   done */
+static void run_monitor(int vendor, int product, int max_ports, const char *my_name)
+{
+	libusb_context *ctx;
+	bool hotplug = false;
+
+	match_vendor = vendor;
+	match_product = product;
+
+	if (libusb_init(&ctx) < 0) {
+		fprintf(stderr, "%s: can't initialize libusb\n", my_name);
+		exit(EXIT_FAILURE);
+	}
+
+#if LIBUSB_API_VERSION >= 0x01000102
+	libusb_hotplug_callback_handle handle;
+	if (libusb_has_capability(LIBUSB_CAP_HAS_HOTPLUG) &&
+			libusb_hotplug_register_callback(ctx,
+				LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED | LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT,
+				LIBUSB_HOTPLUG_ENUMERATE, vendor ? vendor : 0x0403,
+				LIBUSB_HOTPLUG_MATCH_ANY, LIBUSB_HOTPLUG_MATCH_ANY,
+				hotplug_event, NULL, &handle) == LIBUSB_SUCCESS)
+		hotplug = true;
+#endif
+
+	fprintf(stderr, "station: waiting for programmers (%s, %d at a time), Ctrl-C to stop\n",
+			hotplug ? "hotplug" : "polling", max_ports);
+
+	while (!stop_requested || n_running > 0) {
+		if (hotplug) {
+			struct timeval tv = { 0, STATION_POLL_US };
+			libusb_handle_events_timeout_completed(ctx, &tv, NULL);
+		} else {
+			poll_devices(ctx);
+			usleep(STATION_POLL_US);
+		}
+
+		reap_boards();
+		if (stop_requested)
+			continue;
+
+		uint64_t now = stats_time_us();
+		for (int i = 0; i < n_boards && n_running < max_ports; i++) {
+			struct board *b = &boards[i];
+			if (b->state == BOARD_NEW && b->present && now - b->seen_us >= STATION_SETTLE_US)
+				start_board(b);
+		}
+	}
+
+#if LIBUSB_API_VERSION >= 0x01000102
+	if (hotplug)
+		libusb_hotplug_deregister_callback(ctx, handle);
+#endif
+	libusb_exit(ctx);
+
+	fprintf(stderr, "station: %d board%s passed, %d failed\n",
+			n_passed, n_passed == 1 ? "" : "s", n_failed);
+	exit(n_failed ? EXIT_FAILURE : EXIT_SUCCESS);
+}
+
+/* Tell the monitor about a board, nobody is left to tell if it's gone */
+static void report_board(int fd, const struct station_msg *msg)
+{
+	ssize_t n = write(fd, msg, sizeof(*msg));
+	(void)n;
+}
+
+/* Fork the child for a board. Returns its device string in the child
+   and NULL in the spawner. */
+static const char *fork_board(const struct station_msg *req, pid_t *pid, int req_fd, int reply_fd,
+		const char *my_name)
+{
+	static char devstr[32];
+
+	fflush(stdout);
+	fflush(stderr);
+
+	*pid = fork();
+	if (*pid < 0) {
+		fprintf(stderr, "%s: can't start job for %03d/%03d: %s\n", my_name, req->bus, req->address,
+				strerror(errno));
+		return NULL;
+	}
+	if (*pid > 0)
+		return NULL;
+
+	/* Ctrl-C stops the station, boards being programmed are finished */
+	close(req_fd);
+	close(reply_fd);
+	signal(SIGINT, SIG_IGN);
+	signal(SIGTERM, SIG_DFL);
+	snprintf(devstr, sizeof(devstr), "d:%03d/%03d", req->bus, req->address);
+	return devstr;
+}
+
+const char *station_run(int vendor, int product, int max_ports, const char *my_name)
+{
+	int req[2], done[2];
+
+	if (pipe(req) < 0 || pipe(done) < 0) {
+		fprintf(stderr, "%s: can't create pipe: %s\n", my_name, strerror(errno));
+		return NULL;
+	}
+
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = on_signal;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	fflush(stdout);
+	fflush(stderr);
+
+	pid_t monitor = fork();
+	if (monitor < 0) {
+		fprintf(stderr, "%s: can't fork: %s\n", my_name, strerror(errno));
+		return NULL;
+	}
+	if (monitor == 0) {
+		close(req[0]);
+		close(done[1]);
+		request_fd = req[1];
+		done_fd = done[0];
+		fcntl(done_fd, F_SETFL, O_NONBLOCK);
+		run_monitor(vendor, product, max_ports, my_name);
+	}
+
+	close(req[1]);
+	close(done[0]);
+
+	struct { pid_t pid; int bus, address; } children[STATION_MAX_BOARDS];
+	int n_children = 0;
+	bool stop_sent = false;
+
+	/* Runs until the monitor exits and closes its end of the pipe */
+	while (true) {
+		/* kill <pid> only reaches the spawner */
+		if (stop_requested && !stop_sent) {
+			kill(monitor, SIGTERM);
+			stop_sent = true;
+		}
+
+		struct pollfd pfd = { .fd = req[0], .events = POLLIN };
+		if (poll(&pfd, 1, STATION_POLL_US / 1000) > 0) {
+			struct station_msg msg;
+			ssize_t n = read(req[0], &msg, sizeof(msg));
+			if (n == 0)
+				break;
+			if (n == sizeof(msg)) {
+				pid_t pid;
+				const char *devstr = fork_board(&msg, &pid, req[0], done[1], my_name);
+				if (devstr != NULL)
+					return devstr;
+				if (pid > 0 && n_children < STATION_MAX_BOARDS) {
+					children[n_children].pid = pid;
+					children[n_children].bus = msg.bus;
+					children[n_children].address = msg.address;
+					n_children++;
+				} else if (pid < 0) {
+					report_board(done[1], &msg);
+				}
+			}
+		}
+
+		for (int i = n_children - 1; i >= 0; i--) {
+			int status;
+			if (waitpid(children[i].pid, &status, WNOHANG) != children[i].pid)
+				continue;
+			struct station_msg msg = {
+				.bus = children[i].bus,
+				.address = children[i].address,
+				.started = true,
+				.status = status,
+			};
+			report_board(done[1], &msg);
+			children[i] = children[--n_children];
+		}
+	}
+
+	int status;
+	while (waitpid(monitor, &status, 0) < 0 && errno == EINTR)
+		;
+	exit(WIFEXITED(status) ? WEXITSTATUS(status) : EXIT_FAILURE);
+}
+
+#else
+
+const char *station_run(int vendor, int product, int max_ports, const char *my_name)
+{
+	(void)vendor;
+	(void)product;
+	(void)max_ports;
+	fprintf(stderr, "%s: station mode needs libftdi1 and fork(), not available in this build\n", my_name);
+	return NULL;
+}
+
+#endif
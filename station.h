@@ -0,0 +1,42 @@
+/*
+ *  iceprog -- simple programming tool for FTDI-based Lattice iCE programmers
+ *
+ *  Permission to use, copy, modify, and/or distribute this software for any
+ *  purpose with or without fee is hereby granted, provided that the above
+ *  copyright notice and this permission notice appear in all copies.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ *  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ *  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ *  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ *  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ *  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#ifndef STATION_H
+#define STATION_H
+
+/* Production line station mode: wait for programmers to be plugged in
+ * and program every board as it appears, without starting iceprog again.
+ *
+ * Devices are found with libusb hotplug callbacks where the platform
+ * has them and by polling the device list otherwise, in a separate
+ * monitor process. Each board is handled by a child process, so up to
+ * max_ports boards are programmed at the same time. The children are
+ * forked from the calling process, which never initializes libusb: the
+ * image and everything else set up before the call is inherited, the
+ * monitor's libusb context is not.
+ *
+ * vendor and product select the programmers to watch for, 0 for the
+ * usual 0x0403:0x6010 and 0x0403:0x6014.
+ *
+ * Returns in the child, with the libftdi device string of its board
+ * ("d:<bus>/<address>"). The parent keeps watching until it gets
+ * SIGINT or SIGTERM, waits for the boards still running, prints a
+ * summary and exits: with 0 if every board passed. Returns NULL if
+ * station mode isn't available. */
+const char *station_run(int vendor, int product, int max_ports, const char *my_name);
+
+#endif /* STATION_H */
@@ -0,0 +1,177 @@
+/*
+ *  iceprog -- simple programming tool for FTDI-based Lattice iCE programmers
+ *
+ *  Permission to use, copy, modify, and/or distribute this software for any
+ *  purpose with or without fee is hereby granted, provided that the above
+ *  copyright notice and this permission notice appear in all copies.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ *  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ *  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ *  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ *  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ *  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <inttypes.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+#include "iceprog_fn.h"
+#include "probes.h"
+#include "stats.h"
+
+static const char *phase_names[PHASE_COUNT] = {
+	"init",
+	"reset",
+	"id",
+	"erase",
+	"program",
+	"verify",
+	"read",
+	"sram",
+	"shutdown",
+};
+
+struct phase_stats stats[PHASE_COUNT];
+
+/* State at the start of the current phase */
+static enum stats_phase current_phase = PHASE_NONE;
+static uint64_t start_time;
+static struct mpsse_counters start_counters;
+static unsigned long start_polls;
+
+uint64_t stats_time_us(void)
+{
+#ifdef _WIN32
+	static LARGE_INTEGER freq;
+	LARGE_INTEGER now;
+	if (freq.QuadPart == 0)
+		QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&now);
+	return (uint64_t)(now.QuadPart / freq.QuadPart) * 1000000 +
+		(uint64_t)(now.QuadPart % freq.QuadPart) * 1000000 / freq.QuadPart;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
+}
+
+const char *stats_phase_name(enum stats_phase phase)
+{
+	return phase < PHASE_COUNT ? phase_names[phase] : "none";
+}
+
+/* Close the current phase and start accounting to the given one.
+ * Passing PHASE_NONE only closes the current phase. */
+void stats_phase(enum stats_phase phase)
+{
+	/* Account buffered commands to the phase that queued them */
+	mpsse_flush();
+
+	uint64_t now = stats_time_us();
+
+	if (current_phase != PHASE_NONE) {
+		struct phase_stats *p = &stats[current_phase];
+		p->time_us += now - start_time;
+		p->usb_writes += mpsse_counters.writes - start_counters.writes;
+		p->usb_write_bytes += mpsse_counters.write_bytes - start_counters.write_bytes;
+		p->usb_reads += mpsse_counters.reads - start_counters.reads;
+		p->usb_read_bytes += mpsse_counters.read_bytes - start_counters.read_bytes;
+		p->wait_polls += flash_wait_polls - start_polls;
+	}
+
+	current_phase = phase;
+	start_time = now;
+	PROBE_PHASE((int)phase, stats_phase_name(phase));
+	start_counters = mpsse_counters;
+	start_polls = flash_wait_polls;
+}
+
+/* Account payload bytes (flash or SRAM data, not protocol overhead)
+ * to the current phase */
+void stats_add_bytes(uint64_t n)
+{
+	if (current_phase != PHASE_NONE)
+		stats[current_phase].bytes += n;
+}
+
+static void stats_total(struct phase_stats *total)
+{
+	*total = (struct phase_stats){ 0 };
+	for (int i = 0; i < PHASE_COUNT; i++) {
+		total->time_us += stats[i].time_us;
+		total->bytes += stats[i].bytes;
+		total->usb_writes += stats[i].usb_writes;
+		total->usb_write_bytes += stats[i].usb_write_bytes;
+		total->usb_reads += stats[i].usb_reads;
+		total->usb_read_bytes += stats[i].usb_read_bytes;
+		total->wait_polls += stats[i].wait_polls;
+	}
+}
+
+static double throughput_kib(const struct phase_stats *p)
+{
+	if (p->time_us == 0)
+		return 0.0;
+	return p->bytes * 1e6 / 1024.0 / p->time_us;
+}
+
+static void print_row(FILE *f, const char *name, const struct phase_stats *p)
+{
+	fprintf(f, "%-9s %10.1f %10" PRIu64 " %9.1f %8" PRIu64 " %10" PRIu64 " %8" PRIu64 " %10" PRIu64 " %7" PRIu64 "\n",
+			name, p->time_us / 1000.0, p->bytes, throughput_kib(p),
+			p->usb_writes, p->usb_write_bytes, p->usb_reads, p->usb_read_bytes, p->wait_polls);
+}
+
+void stats_print(FILE *f)
+{
+	struct phase_stats total;
+	stats_total(&total);
+
+	fprintf(f, "%-9s %10s %10s %9s %8s %10s %8s %10s %7s\n",
+			"phase", "time [ms]", "bytes", "KiB/s", "usb wr", "wr bytes", "usb rd", "rd bytes", "polls");
+	for (int i = 0; i < PHASE_COUNT; i++)
+		if (stats[i].time_us != 0)
+			print_row(f, phase_names[i], &stats[i]);
+	print_row(f, "total", &total);
+}
+
+static void print_json_object(FILE *f, const struct phase_stats *p)
+{
+	fprintf(f, "{\"time_us\": %" PRIu64 ", \"bytes\": %" PRIu64 ", \"bytes_per_s\": %.0f, "
+			"\"usb_writes\": %" PRIu64 ", \"usb_write_bytes\": %" PRIu64 ", "
+			"\"usb_reads\": %" PRIu64 ", \"usb_read_bytes\": %" PRIu64 ", \"wait_polls\": %" PRIu64 "}",
+			p->time_us, p->bytes, throughput_kib(p) * 1024.0,
+			p->usb_writes, p->usb_write_bytes, p->usb_reads, p->usb_read_bytes, p->wait_polls);
+}
+
+void stats_print_json(FILE *f)
+{
+	struct phase_stats total;
+	stats_total(&total);
+
+	fprintf(f, "{\n  \"phases\": {\n");
+	bool first = true;
+	for (int i = 0; i < PHASE_COUNT; i++) {
+		if (stats[i].time_us == 0)
+			continue;
+		fprintf(f, "%s    \"%s\": ", first ? "" : ",\n", phase_names[i]);
+		print_json_object(f, &stats[i]);
+		first = false;
+	}
+	fprintf(f, "\n  },\n  \"total\": ");
+	print_json_object(f, &total);
+	fprintf(f, "\n}\n");
+}
@@ -0,0 +1,56 @@
+/*
+ *  iceprog -- simple programming tool for FTDI-based Lattice iCE programmers
+ *
+ *  Permission to use, copy, modify, and/or distribute this software for any
+ *  purpose with or without fee is hereby granted, provided that the above
+ *  copyright notice and this permission notice appear in all copies.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ *  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ *  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ *  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ *  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ *  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+enum stats_phase {
+	PHASE_INIT,
+	PHASE_RESET,
+	PHASE_ID,
+	PHASE_ERASE,
+	PHASE_PROGRAM,
+	PHASE_VERIFY,
+	PHASE_READ,
+	PHASE_SRAM,
+	PHASE_SHUTDOWN,
+	PHASE_COUNT,
+	PHASE_NONE = PHASE_COUNT,
+};
+
+struct phase_stats {
+	uint64_t time_us;
+	uint64_t bytes;
+	uint64_t usb_writes;
+	uint64_t usb_write_bytes;
+	uint64_t usb_reads;
+	uint64_t usb_read_bytes;
+	uint64_t wait_polls;
+};
+
+extern struct phase_stats stats[PHASE_COUNT];
+
+uint64_t stats_time_us(void);
+const char *stats_phase_name(enum stats_phase phase);
+void stats_phase(enum stats_phase phase);
+void stats_add_bytes(uint64_t n);
+void stats_print(FILE *f);
+void stats_print_json(FILE *f);
+
+#endif /* STATS_H */
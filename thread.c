@@ -0,0 +1,129 @@
+/*
+ *  iceprog -- simple programming tool for FTDI-based Lattice iCE programmers
+ *
+ *  Permission to use, copy, modify, and/or distribute this software for any
+ *  purpose with or without fee is hereby granted, provided that the above
+ *  copyright notice and this permission notice appear in all copies.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ *  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ *  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ *  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ *  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ *  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#include "thread.h"
+
+#ifdef _WIN32
+static DWORD WINAPI thread_main(LPVOID arg)
+{
+	struct thread *t = arg;
+	t->fn(t->arg);
+	return 0;
+}
+
+bool thread_start(struct thread *t, void (*fn)(void *arg), void *arg)
+{
+	t->fn = fn;
+	t->arg = arg;
+	t->handle = CreateThread(NULL, 0, thread_main, t, 0, NULL);
+	return t->handle != NULL;
+}
+
+void thread_join(struct thread *t)
+{
+	WaitForSingleObject(t->handle, INFINITE);
+	CloseHandle(t->handle);
+}
+
+bool thread_cond_init(struct thread_cond *c)
+{
+	InitializeCriticalSection(&c->lock);
+	InitializeConditionVariable(&c->cond);
+	return true;
+}
+
+void thread_cond_destroy(struct thread_cond *c)
+{
+	DeleteCriticalSection(&c->lock);
+}
+
+void thread_cond_lock(struct thread_cond *c)
+{
+	EnterCriticalSection(&c->lock);
+}
+
+void thread_cond_unlock(struct thread_cond *c)
+{
+	LeaveCriticalSection(&c->lock);
+}
+
+void thread_cond_wait(struct thread_cond *c)
+{
+	SleepConditionVariableCS(&c->cond, &c->lock, INFINITE);
+}
+
+void thread_cond_signal(struct thread_cond *c)
+{
+	WakeConditionVariable(&c->cond);
+}
+#else
+static void *thread_main(void *arg)
+{
+	struct thread *t = arg;
+	t->fn(t->arg);
+	return NULL;
+}
+
+bool thread_start(struct thread *t, void (*fn)(void *arg), void *arg)
+{
+	t->fn = fn;
+	t->arg = arg;
+	return pthread_create(&t->handle, NULL, thread_main, t) == 0;
+}
+
+void thread_join(struct thread *t)
+{
+	pthread_join(t->handle, NULL);
+}
+
+bool thread_cond_init(struct thread_cond *c)
+{
+	if (pthread_mutex_init(&c->lock, NULL) != 0)
+		return false;
+	if (pthread_cond_init(&c->cond, NULL) != 0) {
+		pthread_mutex_destroy(&c->lock);
+		return false;
+	}
+	return true;
+}
+
+void thread_cond_destroy(struct thread_cond *c)
+{
+	pthread_cond_destroy(&c->cond);
+	pthread_mutex_destroy(&c->lock);
+}
+
+void thread_cond_lock(struct thread_cond *c)
+{
+	pthread_mutex_lock(&c->lock);
+}
+
+void thread_cond_unlock(struct thread_cond *c)
+{
+	pthread_mutex_unlock(&c->lock);
+}
+
+void thread_cond_wait(struct thread_cond *c)
+{
+	pthread_cond_wait(&c->cond, &c->lock);
+}
+
+void thread_cond_signal(struct thread_cond *c)
+{
+	pthread_cond_signal(&c->cond);
+}
+#endif
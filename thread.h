@@ -0,0 +1,64 @@
+/*
+ *  iceprog -- simple programming tool for FTDI-based Lattice iCE programmers
+ *
+ *  Permission to use, copy, modify, and/or distribute this software for any
+ *  purpose with or without fee is hereby granted, provided that the above
+ *  copyright notice and this permission notice appear in all copies.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ *  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ *  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ *  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ *  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ *  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#ifndef THREAD_H
+#define THREAD_H
+
+#include <stdbool.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+/* Just enough of a thread API for the helper threads of the command line
+ * tool: start a function, wait for it to return, and let a thread sleep
+ * until another one wakes it */
+struct thread {
+#ifdef _WIN32
+	HANDLE handle;
+#else
+	pthread_t handle;
+#endif
+	void (*fn)(void *arg);
+	void *arg;
+};
+
+bool thread_start(struct thread *t, void (*fn)(void *arg), void *arg);
+void thread_join(struct thread *t);
+
+/* A lock with a condition variable. thread_cond_wait() is called with the
+ * lock held and may return spuriously. */
+struct thread_cond {
+#ifdef _WIN32
+	CRITICAL_SECTION lock;
+	CONDITION_VARIABLE cond;
+#else
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+#endif
+};
+
+bool thread_cond_init(struct thread_cond *c);
+void thread_cond_destroy(struct thread_cond *c);
+void thread_cond_lock(struct thread_cond *c);
+void thread_cond_unlock(struct thread_cond *c);
+void thread_cond_wait(struct thread_cond *c);
+void thread_cond_signal(struct thread_cond *c);
+
+#endif /* THREAD_H */
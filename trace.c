@@ -0,0 +1,383 @@
+/*
+ *  iceprog -- simple programming tool for FTDI-based Lattice iCE programmers
+ *
+ *  Permission to use, copy, modify, and/or distribute this software for any
+ *  purpose with or without fee is hereby granted, provided that the above
+ *  copyright notice and this permission notice appear in all copies.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ *  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ *  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ *  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ *  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ *  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "stats.h"
+#include "trace.h"
+
+/* Trace file layout (all integers little endian):
+ *
+ * Header:
+ *   char[8]  "ICETRACE"
+ *   u32      format version (1)
+ *   u32      libftdi chip type of the recorded device
+ *
+ * Records:
+ *   u8       type: 'W' write with data, 'w' write with hash, 'R' read
+ *   u32      microseconds since the trace was started
+ *   u32      number of bytes requested by the caller
+ *   i32      libftdi return code
+ *   payload  'W': the requested bytes
+ *            'w': u32 FNV-1a hash of the requested bytes
+ *            'R': the bytes returned (rc if rc > 0, else nothing)
+ */
+
+#define TRACE_MAGIC "ICETRACE"
+#define TRACE_VERSION 1
+#define TRACE_HEADER_SIZE 16
+
+struct trace_record {
+	uint8_t type;
+	uint32_t time_us;
+	uint32_t n;
+	int32_t rc;
+	uint32_t hash;
+	uint8_t *data;
+	uint32_t data_len;
+};
+
+static uint32_t fnv1a32(const uint8_t *data, int n)
+{
+	uint32_t h = 0x811c9dc5;
+	for (int i = 0; i < n; i++) {
+		h ^= data[i];
+		h *= 0x01000193;
+	}
+	return h;
+}
+
+static void put_u32(FILE *f, uint32_t v)
+{
+	uint8_t b[4] = { (uint8_t)v, (uint8_t)(v >> 8), (uint8_t)(v >> 16), (uint8_t)(v >> 24) };
+	fwrite(b, 4, 1, f);
+}
+
+static bool get_u32(FILE *f, uint32_t *v)
+{
+	uint8_t b[4];
+	if (fread(b, 4, 1, f) != 1)
+		return false;
+	*v = b[0] | (b[1] << 8) | (b[2] << 16) | ((uint32_t)b[3] << 24);
+	return true;
+}
+
+// ---------------------------------------------------------
+// Recording
+// ---------------------------------------------------------
+
+static FILE *record_file = NULL;
+static bool record_hash_writes;
+static uint64_t record_start;
+
+bool trace_record_open(const char *filename, bool hash_writes)
+{
+	record_file = fopen(filename, "wb");
+	if (record_file == NULL)
+		return false;
+
+	record_hash_writes = hash_writes;
+	record_start = stats_time_us();
+
+	fwrite(TRACE_MAGIC, 8, 1, record_file);
+	put_u32(record_file, TRACE_VERSION);
+	put_u32(record_file, 0);
+	return true;
+}
+
+void trace_record_close(void)
+{
+	if (record_file == NULL)
+		return;
+
+	fclose(record_file);
+	record_file = NULL;
+}
+
+/* The chip type is only known once the device is open, patch it into the
+ * header afterwards. */
+void trace_set_chip_type(int chip_type)
+{
+	if (record_file == NULL)
+		return;
+
+	long pos = ftell(record_file);
+	fseek(record_file, 12, SEEK_SET);
+	put_u32(record_file, chip_type);
+	fseek(record_file, pos, SEEK_SET);
+}
+
+static void log_record(uint8_t type, int n, int rc)
+{
+	fputc(type, record_file);
+	put_u32(record_file, (uint32_t)(stats_time_us() - record_start));
+	put_u32(record_file, n);
+	put_u32(record_file, (uint32_t)rc);
+}
+
+void trace_log_write(const uint8_t *data, int n, int rc)
+{
+	if (record_file == NULL)
+		return;
+
+	if (record_hash_writes) {
+		log_record('w', n, rc);
+		put_u32(record_file, fnv1a32(data, n));
+	} else {
+		log_record('W', n, rc);
+		fwrite(data, 1, n, record_file);
+	}
+}
+
+void trace_log_read(const uint8_t *data, int n, int rc)
+{
+	if (record_file == NULL)
+		return;
+
+	log_record('R', n, rc);
+	if (rc > 0)
+		fwrite(data, 1, rc, record_file);
+}
+
+// ---------------------------------------------------------
+// Replay
+// ---------------------------------------------------------
+
+/* Writes and reads are consumed independently through two handles on the
+ * same file. Read data is served as a byte stream, so a build that reads
+ * with a different granularity still gets the recorded bytes in order. */
+static FILE *replay_wfile = NULL;
+static FILE *replay_rfile = NULL;
+
+static struct trace_record replay_write_rec;
+static struct trace_record replay_read_rec;
+static uint32_t replay_read_pos;
+static int replay_read_error;	/* recorded failure, returned by the next read */
+
+static struct {
+	uint64_t rec_writes, rec_write_bytes;
+	uint64_t rec_reads, rec_read_bytes;
+	uint64_t writes, write_bytes;
+	uint64_t reads, read_bytes;
+	uint64_t write_mismatches;
+	uint64_t first_mismatch;
+	bool writes_exhausted;
+	bool reads_exhausted;
+} replay;
+
+static bool read_record(FILE *f, struct trace_record *rec)
+{
+	int type = fgetc(f);
+	uint32_t rc;
+
+	if (type == EOF)
+		return false;
+	rec->type = type;
+	if (!get_u32(f, &rec->time_us) || !get_u32(f, &rec->n) || !get_u32(f, &rc))
+		return false;
+	rec->rc = (int32_t)rc;
+
+	switch (rec->type) {
+	case 'W':
+		rec->data_len = rec->n;
+		break;
+	case 'w':
+		rec->data_len = 0;
+		return get_u32(f, &rec->hash);
+	case 'R':
+		rec->data_len = rec->rc > 0 ? rec->rc : 0;
+		break;
+	default:
+		fprintf(stderr, "replay: corrupt trace record (type 0x%02X)\n", rec->type);
+		return false;
+	}
+
+	free(rec->data);
+	rec->data = NULL;
+	if (rec->data_len == 0)
+		return true;
+	rec->data = malloc(rec->data_len);
+	return rec->data != NULL && fread(rec->data, 1, rec->data_len, f) == rec->data_len;
+}
+
+/* Fetch the next record of one of the given types */
+static bool next_record(FILE *f, struct trace_record *rec, char type1, char type2)
+{
+	while (read_record(f, rec))
+		if (rec->type == type1 || rec->type == type2)
+			return true;
+	return false;
+}
+
+static FILE *open_replay_handle(const char *filename, int *chip_type)
+{
+	FILE *f = fopen(filename, "rb");
+	if (f == NULL)
+		return NULL;
+
+	char magic[8];
+	uint32_t version, type;
+	if (fread(magic, 8, 1, f) != 1 || memcmp(magic, TRACE_MAGIC, 8) ||
+			!get_u32(f, &version) || !get_u32(f, &type) || version != TRACE_VERSION) {
+		fprintf(stderr, "replay: '%s' is not an iceprog trace file\n", filename);
+		fclose(f);
+		return NULL;
+	}
+
+	*chip_type = type;
+	return f;
+}
+
+bool trace_replay_open(const char *filename, int *chip_type)
+{
+	memset(&replay, 0, sizeof(replay));
+
+	replay_wfile = open_replay_handle(filename, chip_type);
+	if (replay_wfile == NULL)
+		return false;
+	replay_rfile = open_replay_handle(filename, chip_type);
+	if (replay_rfile == NULL) {
+		fclose(replay_wfile);
+		return false;
+	}
+
+	/* Totals of the recorded session, for the summary */
+	FILE *f = open_replay_handle(filename, chip_type);
+	if (f != NULL) {
+		struct trace_record rec = { 0 };
+		while (read_record(f, &rec)) {
+			if (rec.type == 'R') {
+				replay.rec_reads++;
+				replay.rec_read_bytes += rec.data_len;
+			} else {
+				replay.rec_writes++;
+				replay.rec_write_bytes += rec.rc > 0 ? rec.rc : 0;
+			}
+		}
+		free(rec.data);
+		fclose(f);
+	}
+
+	return true;
+}
+
+int trace_replay_write(const uint8_t *data, int n)
+{
+	replay.writes++;
+
+	if (replay.writes_exhausted || !next_record(replay_wfile, &replay_write_rec, 'W', 'w')) {
+		if (!replay.writes_exhausted)
+			fprintf(stderr, "replay: more writes than recorded (from write #%llu on)\n",
+					(unsigned long long)replay.writes);
+		replay.writes_exhausted = true;
+		replay.write_bytes += n;
+		return n;
+	}
+
+	bool match = (int)replay_write_rec.n == n && (replay_write_rec.type == 'W' ?
+			memcmp(replay_write_rec.data, data, n) == 0 : replay_write_rec.hash == fnv1a32(data, n));
+	if (!match) {
+		if (replay.write_mismatches == 0)
+			replay.first_mismatch = replay.writes;
+		replay.write_mismatches++;
+	}
+
+	/* Reproduce recorded write errors */
+	int rc = match ? replay_write_rec.rc : n;
+	if (rc > 0)
+		replay.write_bytes += rc;
+	return rc;
+}
+
+int trace_replay_read(uint8_t *data, int n)
+{
+	int done = 0;
+
+	replay.reads++;
+
+	while (done < n && replay_read_error == 0) {
+		if (replay_read_pos == replay_read_rec.data_len) {
+			replay_read_pos = 0;
+			replay_read_rec.data_len = 0;
+			if (replay.reads_exhausted || !next_record(replay_rfile, &replay_read_rec, 'R', 'R')) {
+				replay.reads_exhausted = true;
+				break;
+			}
+			if (replay_read_rec.rc < 0)
+				replay_read_error = replay_read_rec.rc;
+			continue;
+		}
+
+		int len = replay_read_rec.data_len - replay_read_pos;
+		if (len > n - done)
+			len = n - done;
+		memcpy(data + done, replay_read_rec.data + replay_read_pos, len);
+		replay_read_pos += len;
+		done += len;
+	}
+
+	/* Reproduce recorded read errors, after the data before them */
+	if (done == 0 && replay_read_error != 0) {
+		int rc = replay_read_error;
+		replay_read_error = 0;
+		return rc;
+	}
+
+	if (done == 0 && replay.reads_exhausted) {
+		fprintf(stderr, "replay: trace exhausted, no more read data\n");
+		return -1;
+	}
+
+	replay.read_bytes += done;
+	return done;
+}
+
+void trace_replay_close(void)
+{
+	if (replay_wfile == NULL)
+		return;
+
+	fprintf(stderr, "replay summary:      %10s %12s %10s %12s\n", "writes", "write bytes", "reads", "read bytes");
+	fprintf(stderr, "  recorded           %10llu %12llu %10llu %12llu\n",
+			(unsigned long long)replay.rec_writes, (unsigned long long)replay.rec_write_bytes,
+			(unsigned long long)replay.rec_reads, (unsigned long long)replay.rec_read_bytes);
+	fprintf(stderr, "  replayed           %10llu %12llu %10llu %12llu\n",
+			(unsigned long long)replay.writes, (unsigned long long)replay.write_bytes,
+			(unsigned long long)replay.reads, (unsigned long long)replay.read_bytes);
+	if (replay.write_mismatches)
+		fprintf(stderr, "  %llu writes differ from the recording, first at write #%llu\n",
+				(unsigned long long)replay.write_mismatches, (unsigned long long)replay.first_mismatch);
+	else if (replay.writes_exhausted)
+		fprintf(stderr, "  session issued more writes than recorded\n");
+	else
+		fprintf(stderr, "  all writes match the recording\n");
+
+	fclose(replay_wfile);
+	fclose(replay_rfile);
+	replay_wfile = NULL;
+	replay_rfile = NULL;
+	free(replay_write_rec.data);
+	replay_write_rec.data = NULL;
+	free(replay_read_rec.data);
+	replay_read_rec.data = NULL;
+	replay_read_error = 0;
+}
@@ -0,0 +1,39 @@
+/*
+ *  iceprog -- simple programming tool for FTDI-based Lattice iCE programmers
+ *
+ *  Permission to use, copy, modify, and/or distribute this software for any
+ *  purpose with or without fee is hereby granted, provided that the above
+ *  copyright notice and this permission notice appear in all copies.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ *  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ *  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ *  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ *  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ *  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Recording: every libftdi read/write done by mpsse.c is appended to the
+ * trace file. */
+bool trace_record_open(const char *filename, bool hash_writes);
+void trace_record_close(void);
+void trace_set_chip_type(int chip_type);
+void trace_log_write(const uint8_t *data, int n, int rc);
+void trace_log_read(const uint8_t *data, int n, int rc);
+
+/* Replay: writes are checked against the recorded ones, reads are served
+ * from the recorded read data. Recorded write and read errors are
+ * returned again at the same point. */
+bool trace_replay_open(const char *filename, int *chip_type);
+int trace_replay_write(const uint8_t *data, int n);
+int trace_replay_read(uint8_t *data, int n);
+void trace_replay_close(void);
+
+#endif /* TRACE_H */
@@ -0,0 +1,59 @@
+/*
+ *  iceprog -- simple programming tool for FTDI-based Lattice iCE programmers
+ *
+ *  Permission to use, copy, modify, and/or distribute this software for any
+ *  purpose with or without fee is hereby granted, provided that the above
+ *  copyright notice and this permission notice appear in all copies.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ *  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ *  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ *  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ *  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ *  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "warmboot.h"
+
+/* One header: sync word, boot mode, boot address, bank offset, reboot */
+static void write_header(uint8_t *p, uint32_t addr)
+{
+	static const uint8_t header[] = {
+		0x7e, 0xaa, 0x99, 0x7e,
+		0x92, 0x00, 0x00,
+		0x44, 0x03, 0x00, 0x00, 0x00,
+		0x82, 0x00, 0x00,
+		0x01, 0x08,
+	};
+
+	memset(p, 0x00, 32);
+	memcpy(p, header, sizeof(header));
+	p[9] = addr >> 16;
+	p[10] = addr >> 8;
+	p[11] = addr;
+}
+
+uint8_t *warmboot_pack(const uint8_t *const images[], const long sizes[], int n,
+		int first_slot, int slot_size, long *size)
+{
+	*size = first_slot + (long)(n - 1) * slot_size + sizes[n - 1];
+
+	uint8_t *data = malloc(*size);
+	if (data == NULL)
+		return NULL;
+	memset(data, 0xff, *size);
+
+	write_header(data, first_slot);
+	for (int i = 0; i < WARMBOOT_MAX_IMAGES; i++)
+		write_header(data + 32 * (i + 1), first_slot + (i < n ? i : 0) * slot_size);
+
+	for (int i = 0; i < n; i++)
+		memcpy(data + first_slot + (long)i * slot_size, images[i], sizes[i]);
+
+	return data;
+}
@@ -0,0 +1,38 @@
+/*
+ *  iceprog -- simple programming tool for FTDI-based Lattice iCE programmers
+ *
+ *  Permission to use, copy, modify, and/or distribute this software for any
+ *  purpose with or without fee is hereby granted, provided that the above
+ *  copyright notice and this permission notice appear in all copies.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ *  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ *  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ *  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ *  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ *  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef WARMBOOT_H
+#define WARMBOOT_H
+
+#include <stdint.h>
+
+/* Multi-image flash layout for iCE40 warm boot, as icemulti writes it:
+ * five 32 byte headers at address 0, the first used after power up and
+ * the other four selected by the WARMBOOT primitive, followed by the
+ * images. Here every image starts at an erase block aligned slot, so a
+ * slot can be rewritten without touching the others. */
+
+#define WARMBOOT_MAX_IMAGES 4
+#define WARMBOOT_HEADER_SIZE (5 * 32)
+
+/* Pack n images into one flash image with the images at first_slot,
+ * first_slot + slot_size, ... Unused warm boot selections start image 0.
+ * Returns a malloc'ed buffer of *size bytes, 0xFF between the images,
+ * or NULL if out of memory. */
+uint8_t *warmboot_pack(const uint8_t *const images[], const long sizes[], int n,
+		int first_slot, int slot_size, long *size);
+
+#endif /* WARMBOOT_H */